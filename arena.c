@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "arena.h"
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * initArena function
+ * This function maps memory for the arena.
+ * When hugePages is TRUE, explicit huge pages are tried first, then the mapping
+ * is advised for transparent huge pages. If neither is available, normal pages are used.
+ * Mapped pages are not touched here, so unused space costs no physical memory.
+ * @param a is the pointer to arena
+ * @param size is the capacity of the arena in bytes
+ * @param hugePages requests huge page backing
+ * @return TRUE if the arena is mapped else FALSE
+ */
+BOOLEAN initArena(ARENA *a, size_t size, BOOLEAN hugePages) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    void *base = MAP_FAILED;
+
+    a->base = NULL;
+    a->size = 0;
+    a->used = 0;
+    a->hugePages = FALSE;
+
+    if (hugePages) {
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef MAP_HUGETLB
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        a->hugePages = (base != MAP_FAILED) ? TRUE : FALSE;
+#endif
+    } else {
+        size = (size + page - 1) / page * page;
+    }
+
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return FALSE;
+#ifdef MADV_HUGEPAGE
+        if (hugePages)
+            a->hugePages = (madvise(base, size, MADV_HUGEPAGE) == 0) ? TRUE : FALSE;
+#endif
+    }
+
+    a->base = (char *) base;
+    a->size = size;
+    return TRUE;
+}
+
+
+
+/**
+ * arenaAllocAligned function
+ * Takes the next block of the arena with the given alignment
+ * @param a is the pointer to arena
+ * @param size is the size of the block in bytes
+ * @param alignment is the alignment of the block, a power of two
+ * @return pointer to the block, NULL if the arena is exhausted
+ */
+void *arenaAllocAligned(ARENA *a, size_t size, size_t alignment) {
+    uintptr_t start = ((uintptr_t) a->base + a->used + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    size_t offset = start - (uintptr_t) a->base;
+
+    if (UNLIKELY((offset > a->size) || (a->size - offset < size)))
+        return NULL;
+    a->used = offset + size;
+    return (void *) start;
+}
+
+
+
+/**
+ * arenaAlloc function
+ * Takes the next block of the arena aligned to ARENA_ALIGNMENT
+ * @param a is the pointer to arena
+ * @param size is the size of the block in bytes
+ * @return pointer to the block, NULL if the arena is exhausted
+ */
+void *arenaAlloc(ARENA *a, size_t size) {
+    return arenaAllocAligned(a, size, ARENA_ALIGNMENT);
+}
+
+
+
+/**
+ * arenaMark function
+ * Reads the current fill level of the arena
+ * @param a is the pointer to arena
+ * @return mark to be given to arenaRelease
+ */
+size_t arenaMark(const ARENA *a) {
+    return a->used;
+}
+
+
+
+/**
+ * arenaRelease function
+ * Releases every block taken after the mark was read
+ * @param a is the pointer to arena
+ * @param mark is the value returned by arenaMark
+ */
+void arenaRelease(ARENA *a, size_t mark) {
+    if (mark < a->used)
+        a->used = mark;
+}
+
+
+
+/**
+ * resetArena function
+ * Releases every block of the arena in constant time.
+ * Memory stays mapped and is reused by the next allocations.
+ * @param a is the pointer to arena
+ */
+void resetArena(ARENA *a) {
+    a->used = 0;
+}
+
+
+
+/**
+ * deleteArena function
+ * Unmaps the arena and handles dangling pointers
+ * @param a is the pointer to arena
+ */
+void deleteArena(ARENA *a) {
+    if (a->base != NULL)
+        munmap(a->base, a->size);
+    a->base = NULL;
+    a->size = 0;
+    a->used = 0;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef EXPEVAL_ARENA_H
+#define EXPEVAL_ARENA_H
+
+#include <stddef.h>
+#include "stack_template.h"
+
+#define ARENA_ALIGNMENT 16
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Bump pointer arena.
+ * All memory of one evaluation or one batch is taken from a single mapping,
+ * allocation is a pointer increment and reset releases everything at once.
+ * base is the start of the mapping, size is its length in bytes
+ * used is the offset of the next free byte
+ * hugePages is TRUE when the mapping is backed by huge pages
+ */
+typedef struct ARENA {
+    char *base;
+    size_t size;
+    size_t used;
+    BOOLEAN hugePages;
+} ARENA;
+
+// Function prototypes
+BOOLEAN initArena(ARENA *arena, size_t size, BOOLEAN hugePages);
+
+void *arenaAlloc(ARENA *arena, size_t size);
+
+void *arenaAllocAligned(ARENA *arena, size_t size, size_t alignment);
+
+size_t arenaMark(const ARENA *arena);
+
+void arenaRelease(ARENA *arena, size_t mark);
+
+void resetArena(ARENA *arena);
+
+void deleteArena(ARENA *arena);
+
+#endif //EXPEVAL_ARENA_H
\ No newline at end of file
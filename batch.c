@@ -0,0 +1,673 @@
+#include "batch.h"
+#include "arena.h"
+#include "cache.h"
+#include "optimize.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+/**
+ * isBlankLine function
+ * Checks whether the line contains only whitespace characters
+ * @param line is the start of the line
+ * @param len is the length of the line
+ * @return TRUE if there is nothing to evaluate else FALSE
+ */
+static BOOLEAN isBlankLine(const char *line, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (!isspace((unsigned char) line[i]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+/**
+ * writeResult function
+ * Writes the result of one expression, or error when the expression has no result
+ * @param out is the output stream
+ * @param result is the result of the expression
+ * @param error is the error flag of the evaluation
+ */
+static void writeResult(FILE *out, VALUE result, BOOLEAN error) {
+    if (error)
+        fputs("error\n", out);
+    else
+        fprintf(out, "%" PRId64 "\n", result);
+}
+
+
+
+/**
+ * writeEvaluation function
+ * Writes the result of one evaluated expression. With explain an error is written
+ * with its reason and the byte offset in the line where it was found.
+ * @param out is the output stream
+ * @param result is the result of the expression
+ * @param status is the status of the evaluation
+ * @param offset is the offset of the error
+ * @param explain is TRUE to write the reason of an error
+ */
+static void writeEvaluation(FILE *out, VALUE result, enum EVAL_STATUS status, size_t offset, BOOLEAN explain) {
+    if ((status != EVAL_OK) && explain)
+        fprintf(out, "error: %s at %zu\n", evalStatusString(status), offset);
+    else
+        writeResult(out, result, status != EVAL_OK);
+}
+
+
+
+/**
+ * evaluateLine function
+ * Evaluates one line, through the expression cache when the evaluator has one
+ * @param line is the start of the line
+ * @param len is the length of the line
+ * @param e is the pointer to evaluator context
+ * @return result of the expression, not meaningful when e->error is set
+ */
+static VALUE evaluateLine(const char *line, size_t len, EVALUATOR *e) {
+    if (e->cache != NULL)
+        return cachedEvaluate(e->cache, line, len, e);
+    return evaluateBuffer(line, len, e);
+}
+
+
+
+/**
+ * evaluateBatch function
+ * Reads newline separated expressions from in and writes one result per line to out.
+ * The same evaluator context and its stacks are reused for every line. Lines have no
+ * length limit, the line buffer grows to the longest line and is reused for the others.
+ * Blank lines produce blank lines in the output to keep line numbers of input and output aligned.
+ * @param in is the input stream, a file or stdin
+ * @param out is the output stream
+ * @param e is the pointer to initialized evaluator context
+ * @return number of evaluated expressions, -1 if the input could not be read to its end
+ */
+int evaluateBatch(FILE *in, FILE *out, EVALUATOR *e) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t read;
+    size_t len;
+    VALUE result;
+    int count = 0;
+
+    while ((read = getline(&line, &capacity, in)) != -1) {
+        len = (size_t) read;
+        if (isBlankLine(line, len)) {
+            fputc('\n', out);
+            continue;
+        }
+        // Line terminator is not part of the line, like in a mapped file, so error offsets are the same
+        if (line[len - 1] == '\n')
+            len--;
+        result = evaluateLine(line, len, e);
+        writeEvaluation(out, result, e->status, e->errorOffset, e->explain);
+        count++;
+    }
+    free(line);
+    // getline also stops when the line buffer can not grow, only the end of the input is a success
+    return feof(in) ? count : -1;
+}
+
+
+
+/**
+ * evaluateMappedBatch function
+ * Evaluates every line of a memory mapped file in place.
+ * Lines are passed to evaluateBuffer as pointer and length,
+ * so there is no copy, no NUL terminator and no line length limit.
+ * @param file is the pointer to mapped input file
+ * @param out is the output stream
+ * @param e is the pointer to initialized evaluator context
+ * @return number of evaluated expressions
+ */
+int evaluateMappedBatch(const MAPPED_FILE *file, FILE *out, EVALUATOR *e) {
+    const char *cursor = file->data;
+    const char *end = file->data + file->size;
+    const char *line;
+    size_t len;
+    VALUE result;
+    int count = 0;
+
+    while (cursor < end) {
+        line = cursor;
+        cursor = nextLine(cursor, end, &len);
+        if (isBlankLine(line, len)) {
+            fputc('\n', out);
+            continue;
+        }
+        result = evaluateLine(line, len, e);
+        writeEvaluation(out, result, e->status, e->errorOffset, e->explain);
+        count++;
+    }
+    return count;
+}
+
+
+
+/**
+ * executeBatch function
+ * Reads one line of whitespace separated integers per execution, binds them to
+ * the placeholders of the compiled program in order and writes one result per line.
+ * Lines with fewer values than the program needs produce a blank output line
+ * and they are counted for the caller to report.
+ * @param program is the pointer to compiled program
+ * @param function is the native code of the program, NULL to interpret it
+ * @param in is the input stream of parameter lines
+ * @param out is the output stream
+ * @param e is the pointer to initialized evaluator context
+ * @param skipped is the pointer to number of lines with fewer values than the program needs
+ * @return number of executions, -1 if the input could not be read to its end
+ */
+int executeBatch(const PROGRAM *program, JIT_FUNCTION function, FILE *in, FILE *out, EVALUATOR *e, int *skipped) {
+    char *line = NULL;
+    size_t capacity = 0;
+    VALUE params[MAX_PARAM_COUNT];
+    VALUE result;
+    int count = 0;
+    int n;
+    char *cursor;
+    char *end;
+
+    *skipped = 0;
+    while (getline(&line, &capacity, in) != -1) {
+        cursor = line;
+        for (n = 0; n < program->paramCount; n++) {
+            params[n] = (VALUE) strtoll(cursor, &end, 10);
+            if (end == cursor)
+                break;
+            cursor = end;
+        }
+        if (n < program->paramCount) {
+            (*skipped)++;
+            fputc('\n', out);
+            continue;
+        }
+        METRICS_BEGIN(e);
+        if (function != NULL)
+            result = function(params, &e->error);
+        else
+            result = executeProgram(program, params, e);
+        METRICS_END(e);
+        writeResult(out, result, e->error);
+        count++;
+    }
+    free(line);
+    return feof(in) ? count : -1;
+}
+
+
+
+/**
+ * verifyBatch function
+ * Differential test of the JIT. Every line is evaluated by evaluateExpression, the reference,
+ * then compiled, translated to machine code and executed. A line whose results or error flags
+ * differ is reported to out. Lines that can not be compiled or have placeholders are skipped.
+ * @param in is the input stream of expressions without placeholders
+ * @param out is the output stream of mismatches
+ * @param optimized is TRUE to run the optimization pass before translation
+ * @param e is the pointer to initialized evaluator context
+ * @param stats is the pointer to counters of the check
+ * @return number of mismatches, -1 if the JIT is not available
+ */
+int verifyBatch(FILE *in, FILE *out, BOOLEAN optimized, EVALUATOR *e, VERIFY_STATS *stats) {
+    char *line = NULL;
+    size_t capacity = 0;
+    PROGRAM program;
+    JIT_PROGRAM jit;
+    VALUE expected, result;
+    BOOLEAN expectedError, error;
+
+    stats->lines = 0;
+    stats->compiled = 0;
+    stats->mismatches = 0;
+    while (getline(&line, &capacity, in) != -1) {
+        stats->lines++;
+        if (isBlankLine(line, strlen(line)) || !compileProgram(line, &program, NULL))
+            continue;
+        // Placeholders have no values here, such a line is skipped like one that can not be compiled
+        if (program.paramCount > 0) {
+            deleteProgram(&program);
+            continue;
+        }
+        if (optimized)
+            optimizeProgram(&program, e->checked);
+        if (!jitCompile(&program, e->checked, &jit)) {
+            // Only too long programs are left to the interpreter
+            error = program.length > JIT_MAX_LENGTH;
+            deleteProgram(&program);
+            if (!error) {
+                free(line);
+                return -1;
+            }
+            continue;
+        }
+        stats->compiled++;
+
+        expected = evaluateExpression(line, e);
+        expectedError = e->error;
+        result = jit.function(NULL, &error);
+        if ((error != expectedError) || (!error && (result != expected))) {
+            fprintf(out, "Line %d: evaluator ", stats->lines);
+            writeResult(out, expected, expectedError);
+            fprintf(out, "Line %d: jit ", stats->lines);
+            writeResult(out, result, error);
+            stats->mismatches++;
+        }
+        jitDelete(&jit);
+        deleteProgram(&program);
+    }
+    free(line);
+    return stats->mismatches;
+}
+
+
+/*
+ * One chunk of the input.
+ * Line i starts at start[i] and has length[i] bytes. Lines point into text when the
+ * input is read from a stream and into the mapping when the input file is mapped.
+ * Line i of the chunk has sequence number first + i, results are stored
+ * by sequence number so output order does not depend on which worker evaluated the line.
+ * status[i] is the status of the evaluation of line i, the result of a failed line is the offset of its error.
+ * longLine holds a line that does not fit in the room left in text, it is the last line of the chunk,
+ * longCapacity is its size.
+ * next is the shared claim counter, it is kept on its own cache line.
+ */
+typedef struct {
+    volatile int next __attribute__((aligned(CACHE_LINE_SIZE)));
+    char padding[CACHE_LINE_SIZE - sizeof(int)];
+    char *text;
+    const char **start;
+    size_t *length;
+    VALUE *result;
+    char *blank;
+    char *status;
+    char *longLine;
+    size_t longCapacity;
+    int count;
+    long first;
+} CHUNK;
+
+/*
+ * Worker thread state.
+ * Every worker has its own evaluator context and an arena owning its stacks.
+ * Struct is aligned to cache line size, so neighbouring workers
+ * never write to the same cache line.
+ */
+typedef struct {
+    EVALUATOR evaluator;
+    ARENA arena;
+    pthread_t thread;
+    struct POOL *pool;
+    int evaluated;
+} __attribute__((aligned(CACHE_LINE_SIZE))) WORKER;
+
+/*
+ * Worker pool shared by all workers.
+ * gate is held while threads are created, barriers are sized after that.
+ * start and done barriers are crossed once per chunk by every worker and the main thread.
+ */
+typedef struct POOL {
+    pthread_mutex_t gate;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    CHUNK *volatile current;
+    volatile BOOLEAN finished;
+} POOL;
+
+
+
+/**
+ * initChunk function
+ * Takes line and result buffers of a chunk from the arena
+ * @param c is the pointer to chunk
+ * @param a is the pointer to arena owning the buffers
+ * @return TRUE if all buffers are allocated else FALSE
+ */
+static BOOLEAN initChunk(CHUNK *c, ARENA *a) {
+    c->text = (char *) arenaAlloc(a, CHUNK_TEXT_SIZE);
+    c->start = (const char **) arenaAlloc(a, CHUNK_LINE_COUNT * sizeof(const char *));
+    c->length = (size_t *) arenaAlloc(a, CHUNK_LINE_COUNT * sizeof(size_t));
+    c->result = (VALUE *) arenaAlloc(a, CHUNK_LINE_COUNT * sizeof(VALUE));
+    c->blank = (char *) arenaAlloc(a, CHUNK_LINE_COUNT * sizeof(char));
+    c->status = (char *) arenaAlloc(a, CHUNK_LINE_COUNT * sizeof(char));
+    c->longLine = NULL;
+    c->longCapacity = 0;
+    c->count = 0;
+    c->first = 0;
+    c->next = 0;
+    return (c->text != NULL) && (c->start != NULL) && (c->length != NULL) && (c->result != NULL) &&
+           (c->blank != NULL) && (c->status != NULL);
+}
+
+
+
+/**
+ * readLongLine function
+ * Completes a line that is longer than MAX_LINE_SIZE. The rest of the line is appended
+ * in the chunk text when there is room, otherwise the whole line is moved to the long line buffer.
+ * @param c is the pointer to chunk
+ * @param in is the input stream
+ * @param line is the start of the line in the chunk text, MAX_LINE_SIZE - 1 bytes are read
+ * @param room is the number of bytes left in the chunk text from the start of the line
+ * @param len is the pointer to length of the line, it is updated
+ * @return start of the line, NULL if the line could not be read or stored
+ */
+static char *readLongLine(CHUNK *c, FILE *in, char *line, size_t room, size_t *len) {
+    ssize_t read = getline(&c->longLine, &c->longCapacity, in);
+    size_t rest = (read > 0) ? (size_t) read : 0;
+    char *tmp;
+
+    if (read < 0)
+        return feof(in) ? line : NULL;
+    if (rest == 0)
+        return line;
+    if (*len + rest < room) {
+        memcpy(line + *len, c->longLine, rest + 1);
+        *len += rest;
+        return line;
+    }
+    if (*len + rest >= c->longCapacity) {
+        tmp = (char *) realloc(c->longLine, *len + rest + 1);
+        if (tmp == NULL)
+            return NULL;
+        c->longLine = tmp;
+        c->longCapacity = *len + rest + 1;
+    }
+    memmove(c->longLine + *len, c->longLine, rest + 1);
+    memcpy(c->longLine, line, *len);
+    *len += rest;
+    return c->longLine;
+}
+
+
+
+/**
+ * readChunk function
+ * Fills the chunk with the next lines of the input.
+ * Reading stops when the chunk has no room for another line.
+ * Lines have no length limit, a line that does not fit in the chunk text ends the chunk.
+ * @param c is the pointer to chunk
+ * @param in is the input stream
+ * @param first is the sequence number of the first line
+ * @return number of lines read, -1 if the input could not be read or a long line could not be stored
+ */
+static int readChunk(CHUNK *c, FILE *in, long first) {
+    size_t used = 0;
+    size_t len;
+    char *line;
+
+    c->count = 0;
+    c->first = first;
+    c->next = 0;
+    while ((c->count < CHUNK_LINE_COUNT) && (CHUNK_TEXT_SIZE - used >= MAX_LINE_SIZE)) {
+        line = c->text + used;
+        if (fgets(line, MAX_LINE_SIZE, in) == NULL) {
+            if (!feof(in))
+                return -1;
+            break;
+        }
+        len = strlen(line);
+        // Piece without a line terminator that fills the buffer is the start of a long line
+        if ((len == MAX_LINE_SIZE - 1) && (line[len - 1] != '\n')) {
+            line = readLongLine(c, in, line, CHUNK_TEXT_SIZE - used, &len);
+            if (line == NULL)
+                return -1;
+        }
+        c->start[c->count] = line;
+        c->length[c->count] = ((len > 0) && (line[len - 1] == '\n')) ? len - 1 : len;
+        c->blank[c->count] = (char) isBlankLine(line, len);
+        c->count++;
+        if (line == c->longLine)
+            break;
+        used += len + 1;
+    }
+    return c->count;
+}
+
+
+
+/**
+ * mapChunk function
+ * Fills the chunk with the next lines of a mapped file.
+ * Lines are not copied, chunk points into the mapping.
+ * @param c is the pointer to chunk
+ * @param cursor is the pointer to start of the next line, it is advanced
+ * @param end is the end of the mapping
+ * @param first is the sequence number of the first line
+ * @return number of lines taken
+ */
+static int mapChunk(CHUNK *c, const char **cursor, const char *end, long first) {
+    size_t len;
+
+    c->count = 0;
+    c->first = first;
+    c->next = 0;
+    while ((c->count < CHUNK_LINE_COUNT) && (*cursor < end)) {
+        c->start[c->count] = *cursor;
+        *cursor = nextLine(*cursor, end, &len);
+        c->length[c->count] = len;
+        c->blank[c->count] = (char) isBlankLine(c->start[c->count], len);
+        c->count++;
+    }
+    return c->count;
+}
+
+
+
+/**
+ * nextChunk function
+ * Fills the chunk with the next lines of the mapping or of the stream
+ * @param c is the pointer to chunk
+ * @param in is the input stream, it is read when cursor is NULL
+ * @param cursor is the pointer to start of the next line in the mapping, NULL for a stream
+ * @param end is the end of the mapping
+ * @param sequence is the pointer to sequence number of the next line, it is advanced
+ * @return FALSE if the input could not be read, the chunk is left empty then, else TRUE
+ */
+static BOOLEAN nextChunk(CHUNK *c, FILE *in, const char **cursor, const char *end, long *sequence) {
+    int lines = (*cursor != NULL) ? mapChunk(c, cursor, end, *sequence) : readChunk(c, in, *sequence);
+
+    if (lines < 0) {
+        c->count = 0;
+        return FALSE;
+    }
+    *sequence += lines;
+    return TRUE;
+}
+
+
+
+/**
+ * writeChunk function
+ * Writes results of the chunk in sequence order
+ * @param c is the pointer to evaluated chunk
+ * @param out is the output stream
+ * @param explain is TRUE to write the reason of an error
+ */
+static void writeChunk(const CHUNK *c, FILE *out, BOOLEAN explain) {
+    int i;
+    for (i = 0; i < c->count; i++) {
+        if (c->blank[i])
+            fputc('\n', out);
+        else
+            writeEvaluation(out, c->result[i], (enum EVAL_STATUS) c->status[i], (size_t) c->result[i], explain);
+    }
+}
+
+
+
+/**
+ * evaluateChunk function
+ * Claims blocks of CLAIM_SIZE lines from the shared counter and evaluates them
+ * until the chunk is exhausted
+ * @param c is the pointer to chunk
+ * @param w is the pointer to worker evaluating the lines
+ */
+static void evaluateChunk(CHUNK *c, WORKER *w) {
+    int begin, end, i;
+
+    while ((begin = __sync_fetch_and_add(&c->next, CLAIM_SIZE)) < c->count) {
+        end = (begin + CLAIM_SIZE < c->count) ? begin + CLAIM_SIZE : c->count;
+        for (i = begin; i < end; i++) {
+            if (c->blank[i])
+                continue;
+            c->result[i] = evaluateLine(c->start[i], c->length[i], &w->evaluator);
+            c->status[i] = (char) w->evaluator.status;
+            if (UNLIKELY(w->evaluator.status != EVAL_OK))
+                c->result[i] = (VALUE) w->evaluator.errorOffset;
+            w->evaluated++;
+        }
+    }
+}
+
+
+
+/**
+ * workerMain function
+ * Entry point of the worker threads.
+ * Waits for a chunk, evaluates its share and waits for the others to finish.
+ * @param arg is the pointer to worker
+ * @return NULL
+ */
+static void *workerMain(void *arg) {
+    WORKER *w = (WORKER *) arg;
+    POOL *pool = w->pool;
+
+    // Barriers are ready when the gate is released
+    pthread_mutex_lock(&pool->gate);
+    pthread_mutex_unlock(&pool->gate);
+
+    while (TRUE) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->finished)
+            break;
+        evaluateChunk(pool->current, w);
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+
+
+/**
+ * evaluateParallelBatch function
+ * Reads newline separated expressions from in and evaluates them on threadCount
+ * worker threads, each with its own evaluator context. Lines get sequence numbers
+ * when they are read and results are written in input order.
+ * Input is processed in two alternating chunks: while workers evaluate one chunk,
+ * the calling thread writes the results of the previous chunk and reads the next one.
+ * When the input file is mapped, chunks point into the mapping and nothing is copied.
+ * Chunks and workers are taken from one arena, every worker gets its own arena for its stacks,
+ * so there is no malloc or free while lines are evaluated.
+ * @param in is the input stream, a file or stdin
+ * @param file is the pointer to mapping of the input, NULL to read the stream
+ * @param out is the output stream
+ * @param threadCount is the number of worker threads
+ * @param hugePages requests huge page backing for the arenas
+ * @param e is the pointer to evaluator context whose verbose, checked, cache and explain settings the workers use
+ * @return number of evaluated expressions, -1 if the pool could not be created or the input could not be read
+ */
+int evaluateParallelBatch(FILE *in, const MAPPED_FILE *file, FILE *out, int threadCount, BOOLEAN hugePages,
+                          const EVALUATOR *e) {
+    POOL pool;
+    CHUNK chunk[2];
+    ARENA arena;
+    const char *cursor = (file != NULL) ? file->data : NULL;
+    const char *end = (file != NULL) ? file->data + file->size : NULL;
+    WORKER *workers = NULL;
+    long sequence = 0;
+    int count = 0;
+    BOOLEAN failed = FALSE;
+    int started = 0;
+    int k, i;
+
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > MAX_THREAD_COUNT)
+        threadCount = MAX_THREAD_COUNT;
+
+    if (!initArena(&arena, POOL_ARENA_SIZE + threadCount * sizeof(WORKER), hugePages))
+        return -1;
+    BOOLEAN ok = initChunk(&chunk[0], &arena) && initChunk(&chunk[1], &arena);
+    workers = (WORKER *) arenaAllocAligned(&arena, threadCount * sizeof(WORKER), CACHE_LINE_SIZE);
+    for (i = 0; ok && (workers != NULL) && (i < threadCount); i++) {
+        ok = initArena(&workers[i].arena, WORKER_ARENA_SIZE, hugePages);
+        if (!ok)
+            break;
+        initEvaluatorArena(&workers[i].evaluator, &workers[i].arena);
+    }
+    if (!ok || (workers == NULL)) {
+        while ((workers != NULL) && (--i >= 0))
+            deleteArena(&workers[i].arena);
+        deleteArena(&arena);
+        return -1;
+    }
+
+    pool.finished = FALSE;
+    pool.current = NULL;
+    for (i = 0; i < threadCount; i++) {
+        workers[i].evaluator.verbose = e->verbose;
+        workers[i].evaluator.checked = e->checked;
+        workers[i].evaluator.cache = e->cache;
+        workers[i].evaluator.explain = e->explain;
+        workers[i].pool = &pool;
+        workers[i].evaluated = 0;
+    }
+    pthread_mutex_init(&pool.gate, NULL);
+    pthread_mutex_lock(&pool.gate);
+    for (started = 0; started < threadCount; started++) {
+        if (pthread_create(&workers[started].thread, NULL, workerMain, &workers[started]) != 0)
+            break;
+    }
+    // Pool runs with the threads that could be created
+    pthread_barrier_init(&pool.start, NULL, started + 1);
+    pthread_barrier_init(&pool.done, NULL, started + 1);
+    pthread_mutex_unlock(&pool.gate);
+
+    if (started == 0) {
+        if (file != NULL)
+            count = evaluateMappedBatch(file, out, &workers[0].evaluator);
+        else
+            count = evaluateBatch(in, out, &workers[0].evaluator);
+    } else {
+        // Input that can not be read ends the batch, lines read before are still written
+        failed = !nextChunk(&chunk[0], in, &cursor, end, &sequence);
+        for (k = 0; chunk[k & 1].count > 0; k++) {
+            pool.current = &chunk[k & 1];
+            pthread_barrier_wait(&pool.start);
+            if (k > 0)
+                writeChunk(&chunk[(k - 1) & 1], out, e->explain);
+            failed = !nextChunk(&chunk[(k + 1) & 1], in, &cursor, end, &sequence);
+            pthread_barrier_wait(&pool.done);
+        }
+        if (k > 0)
+            writeChunk(&chunk[(k - 1) & 1], out, e->explain);
+
+        pool.finished = TRUE;
+        pthread_barrier_wait(&pool.start);
+        for (i = 0; i < started; i++) {
+            pthread_join(workers[i].thread, NULL);
+            count += workers[i].evaluated;
+        }
+    }
+
+    for (i = 0; i < threadCount; i++) {
+        deleteEvaluator(&workers[i].evaluator);
+        deleteArena(&workers[i].arena);
+    }
+    pthread_barrier_destroy(&pool.start);
+    pthread_barrier_destroy(&pool.done);
+    pthread_mutex_destroy(&pool.gate);
+    free(chunk[0].longLine);
+    free(chunk[1].longLine);
+    deleteArena(&arena);
+    return failed ? -1 : count;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef EXPEVAL_BATCH_H
+#define EXPEVAL_BATCH_H
+
+#include <stdio.h>
+#include "stack.h"
+#include "program.h"
+#include "input.h"
+#include "jit.h"
+
+// Lines of a stream are read in pieces of this size, longer lines are completed with getline
+#define MAX_LINE_SIZE 4096
+#define MAX_THREAD_COUNT 256
+
+/*
+ * Parallel batch mode reads the input in chunks.
+ * Workers evaluate one chunk while the main thread
+ * writes the results of the previous chunk and reads the next one.
+ */
+#define CHUNK_LINE_COUNT 16384
+#define CHUNK_TEXT_SIZE (1 << 21)
+
+// Number of lines a worker claims at once from the shared sequence counter
+#define CLAIM_SIZE 64
+
+// Arena of the pool holds both chunks, every worker has a separate arena for its stacks
+#define POOL_ARENA_SIZE (2 * (CHUNK_TEXT_SIZE + CHUNK_LINE_COUNT * (sizeof(char *) + sizeof(size_t) + sizeof(VALUE) + 2)) + 4096)
+#define WORKER_ARENA_SIZE (256 * 1024)
+
+/*
+ * Counters of the JIT check, the caller reports them.
+ * lines is the number of input lines, compiled is the number of lines translated to machine code
+ * and mismatches is the number of lines whose results differ.
+ */
+typedef struct {
+    int lines;
+    int compiled;
+    int mismatches;
+} VERIFY_STATS;
+
+// Function prototypes
+int evaluateBatch(FILE *in, FILE *out, EVALUATOR *e);
+
+int evaluateMappedBatch(const MAPPED_FILE *file, FILE *out, EVALUATOR *e);
+
+int evaluateParallelBatch(FILE *in, const MAPPED_FILE *file, FILE *out, int threadCount, BOOLEAN hugePages,
+                          const EVALUATOR *e);
+
+int executeBatch(const PROGRAM *program, JIT_FUNCTION function, FILE *in, FILE *out, EVALUATOR *e, int *skipped);
+
+int verifyBatch(FILE *in, FILE *out, BOOLEAN optimized, EVALUATOR *e, VERIFY_STATS *stats);
+
+#endif //EXPEVAL_BATCH_H
\ No newline at end of file
@@ -0,0 +1,679 @@
+/**
+ * Microbenchmarks of the stack primitives and the evaluator.
+ *
+ * Every benchmark is calibrated during warm-up so one sample takes at least
+ * the sample time, then it is timed for the given number of repetitions.
+ * Results are printed as JSON, one object per benchmark with the median and
+ * 99th percentile of the time per operation and the operations per second
+ * of the median sample.
+ *
+ * Scaling mode evaluates generated corpora of growing depth, width, literal length
+ * or total size and prints the time per expression, time per byte and peak memory
+ * of every step, so complexity regressions show up as a bent curve.
+ *
+ * Usage:
+ *      expEval_bench [-r repetitions] [-w warmup] [-t sample milliseconds] [name filter]
+ *      expEval_bench -s depth|width|literal|size [-r repetitions]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "stack.h"
+#include "program.h"
+#include "optimize.h"
+#include "cache.h"
+#include "jit.h"
+#include "corpus.h"
+
+#define DEFAULT_REPETITIONS 30
+#define DEFAULT_WARMUP 3
+#define DEFAULT_SAMPLE_MS 20
+#define MAX_REPETITIONS 1000
+// Number of values pushed before they are popped in stack benchmarks
+#define BENCH_STACK_DEPTH 64
+// Long expression is LONG_TERM repeated LONG_TERM_COUNT times and a final operand
+#define LONG_TERM "12345 + 678 * 9 - 42 / 7 + "
+#define LONG_TERM_COUNT 256
+#define LONG_EXPRESSION_LENGTH (LONG_TERM_COUNT * (sizeof(LONG_TERM) - 1) + 1)
+// Deep expression nests this many parentheses
+#define DEEP_NESTING 512
+// Digit corpus holds this many numbers, each padded to NUMBER_WIDTH characters
+#define DIGIT_COUNT 1024
+#define NUMBER_WIDTH 11
+// Every step of a scaling run evaluates about this many bytes of expressions
+#define SCALING_BYTES (256 * 1024)
+#define SCALING_SEED 1
+
+/*
+ * One benchmark.
+ * run executes iterations of the benchmark and returns a value that depends on the work,
+ * so the compiler can not remove it.
+ * opsPerIteration is the number of measured operations done by one iteration
+ */
+typedef struct {
+    const char *name;
+    long (*run)(long iterations);
+    long opsPerIteration;
+} BENCHMARK;
+
+/*
+ * Timing of one benchmark.
+ * Times are nanoseconds per operation.
+ */
+typedef struct {
+    long iterations;
+    int repetitions;
+    double median;
+    double p99;
+    double min;
+    double opsPerSecond;
+} BENCH_RESULT;
+
+/*
+ * Dimension of a scaling run.
+ * Steps start with first and are multiplied by factor until last
+ * shape is the shape of the other dimensions
+ */
+typedef struct {
+    const char *name;
+    long first;
+    long last;
+    int factor;
+    CORPUS_SHAPE shape;
+} SCALING;
+
+/*
+ * Generated corpus held in memory.
+ * text holds NUL terminated expressions, start is the offset of every expression
+ * expected and failed are the expected result and error flag of every expression
+ */
+typedef struct {
+    char *text;
+    size_t *start;
+    VALUE *expected;
+    BOOLEAN *failed;
+    long count;
+    size_t bytes;
+} CORPUS;
+
+static const SCALING SCALINGS[] = {
+        {"depth", 1, 16384, 4, {0, 2, 3, "+-*/", 0}},
+        {"width", 2, 131072, 4, {0, 2, 3, "+-*/", 0}},
+        {"literal", 1, 16384, 4, {0, 4, 1, "+-*/", 0}},
+        {"size", 16 * 1024, 16 * 1024 * 1024, 4, {2, 4, 3, "+-*/", 0}}
+};
+
+#define SCALING_COUNT (int) (sizeof(SCALINGS) / sizeof(SCALINGS[0]))
+
+// Results of the benchmarks are added here, so no benchmark can be optimized away
+static volatile long benchSink;
+
+// Example expressions from the assignment, evaluated end to end
+static const char *SHORT_CORPUS[] = {
+        "13 + 5* (6+8/4)",
+        "8 + 2 * (21 / (7 - 4) + 2)",
+        "5 + 3 * 10 / 6 - 2",
+        "(12 + 4 - 3 ) * (7 * 2 + 5)",
+        "21  /  ((4 + 8 ) * 2  -  17)",
+        "4 - (3 + 5 + 6 * 2) + 17",
+        "-4 + 8",
+        "5*(-4*2)"
+};
+
+#define SHORT_CORPUS_SIZE (int) (sizeof(SHORT_CORPUS) / sizeof(SHORT_CORPUS[0]))
+
+// Machine generated style expression with identities and constant subexpressions
+#define REDUNDANT_EXPRESSION "(($1 + 0) * 1 + (3 + 4) * $2) / 8 + ($3 * 2 - (2 * 5 - 10)) % 16 + ($1 ^ 1) * (6 - 5)"
+
+// Long and deep expressions built once before the benchmarks run
+static char *longExpression;
+static char *deepExpression;
+static char *digitText;
+static size_t digitTextLength;
+static EVALUATOR evaluator;
+static EVALUATOR wrappingEvaluator;
+static PROGRAM redundantProgram;
+static PROGRAM optimizedProgram;
+static CACHE cache;
+static JIT_PROGRAM jitProgram;
+
+/**
+ * nowNanoseconds function
+ * @return monotonic clock in nanoseconds
+ */
+static long long nowNanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+
+/**
+ * buildCorpora function
+ * Builds the long, deep and digit corpora
+ * @return TRUE if the corpora are allocated else FALSE
+ */
+static BOOLEAN buildCorpora(void) {
+    size_t termLength = sizeof(LONG_TERM) - 1;
+    int i;
+    char *p;
+
+    longExpression = (char *) malloc(LONG_EXPRESSION_LENGTH + 1);
+    deepExpression = (char *) malloc(4 * DEEP_NESTING + 2);
+    digitTextLength = DIGIT_COUNT * NUMBER_WIDTH;
+    digitText = (char *) malloc(digitTextLength + 1);
+    if ((longExpression == NULL) || (deepExpression == NULL) || (digitText == NULL))
+        return FALSE;
+
+    for (i = 0, p = longExpression; i < LONG_TERM_COUNT; i++, p += termLength)
+        memcpy(p, LONG_TERM, termLength);
+    strcpy(p, "1");
+
+    // (1+(1+(1+ ... 1)))
+    p = deepExpression;
+    for (i = 0; i < DEEP_NESTING; i++) {
+        memcpy(p, "(1+", 3);
+        p += 3;
+    }
+    *p++ = '1';
+    for (i = 0; i < DEEP_NESTING; i++)
+        *p++ = ')';
+    *p = '\0';
+
+    // Numbers of different lengths, left aligned and padded with spaces
+    for (i = 0, p = digitText; i < DIGIT_COUNT; i++, p += NUMBER_WIDTH)
+        snprintf(p, NUMBER_WIDTH + 1, "%-*d ", NUMBER_WIDTH - 1, (i * 7919) % 1000000000);
+    digitText[digitTextLength] = '\0';
+    return TRUE;
+}
+
+
+
+// Benchmarks, every function runs the given number of iterations and returns a checksum
+static long benchPushPop(long iterations) {
+    STACK s;
+    long i, sum = 0;
+    int j, x;
+
+    initGrowableStack(&s, INT, BENCH_STACK_DEPTH);
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < BENCH_STACK_DEPTH; j++)
+            push(&j, &s);
+        for (j = 0; j < BENCH_STACK_DEPTH; j++) {
+            pop(&x, &s);
+            sum += x;
+        }
+    }
+    deleteStack(&s);
+    return sum;
+}
+
+
+
+static long benchPeek(long iterations) {
+    STACK s;
+    long i, sum = 0;
+    int x = 7;
+
+    initGrowableStack(&s, INT, BENCH_STACK_DEPTH);
+    push(&x, &s);
+    for (i = 0; i < iterations; i++) {
+        peek(&x, &s);
+        sum += x;
+    }
+    deleteStack(&s);
+    return sum;
+}
+
+
+
+static long benchTypedPushPop(long iterations) {
+    INT_STACK s;
+    long i, sum = 0;
+    int j, x = 0;
+
+    intStackInit(&s, BENCH_STACK_DEPTH, TRUE);
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < BENCH_STACK_DEPTH; j++)
+            intStackPush(&s, j);
+        for (j = 0; j < BENCH_STACK_DEPTH; j++) {
+            intStackPop(&s, &x);
+            sum += x;
+        }
+    }
+    intStackDelete(&s);
+    return sum;
+}
+
+
+
+static long benchTypeOfChar(long iterations) {
+    long i, sum = 0;
+    size_t j;
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < LONG_EXPRESSION_LENGTH; j++)
+            sum += typeOfChar(longExpression[j]);
+    }
+    return sum;
+}
+
+
+
+static long benchDigitHandler(long iterations) {
+    long i, sum = 0;
+    size_t j;
+    BOOLEAN overflow;
+
+    for (i = 0; i < iterations; i++) {
+        j = 0;
+        while (j < digitTextLength) {
+            if (typeOfChar(digitText[j]) == DIGIT)
+                sum += digitHandler(digitText, digitTextLength, &j, &overflow);
+            else
+                j++;
+        }
+    }
+    return sum;
+}
+
+
+
+static long benchToInt(long iterations) {
+    static const char *numbers[] = {"7", "42", "12345", "987654321"};
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++)
+        sum += toInt(numbers[i & 3]);
+    return sum;
+}
+
+
+
+static long benchCompare(long iterations) {
+    static const char operators[] = "+-*/";
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++)
+        sum += compare(operators[i & 3], operators[(i >> 2) & 3]);
+    return sum;
+}
+
+
+
+static long benchEvaluateShort(long iterations) {
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++)
+        sum += evaluateExpression(SHORT_CORPUS[i % SHORT_CORPUS_SIZE], &evaluator);
+    return sum;
+}
+
+
+
+static long benchEvaluateShortCached(long iterations) {
+    const char *exp;
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++) {
+        exp = SHORT_CORPUS[i % SHORT_CORPUS_SIZE];
+        sum += cachedEvaluate(&cache, exp, strlen(exp), &evaluator);
+    }
+    return sum;
+}
+
+
+
+static long benchEvaluateLong(long iterations) {
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++)
+        sum += evaluateExpression(longExpression, &evaluator);
+    return sum;
+}
+
+
+
+static long benchEvaluateLongWrapping(long iterations) {
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++)
+        sum += evaluateExpression(longExpression, &wrappingEvaluator);
+    return sum;
+}
+
+
+
+static long benchEvaluateDeep(long iterations) {
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++)
+        sum += evaluateExpression(deepExpression, &evaluator);
+    return sum;
+}
+
+
+
+static long benchExecuteRedundant(long iterations) {
+    VALUE params[3] = {0, 17, -5};
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++) {
+        params[0] = i;
+        sum += executeProgram(&redundantProgram, params, &evaluator);
+    }
+    return sum;
+}
+
+
+
+static long benchExecuteOptimized(long iterations) {
+    VALUE params[3] = {0, 17, -5};
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++) {
+        params[0] = i;
+        sum += executeProgram(&optimizedProgram, params, &evaluator);
+    }
+    return sum;
+}
+
+
+
+static long benchExecuteJit(long iterations) {
+    VALUE params[3] = {0, 17, -5};
+    BOOLEAN error;
+    long i, sum = 0;
+
+    for (i = 0; i < iterations; i++) {
+        params[0] = i;
+        sum += jitProgram.function(params, &error);
+    }
+    return sum;
+}
+
+
+
+static const BENCHMARK BENCHMARKS[] = {
+        {"stack_push_pop", benchPushPop, 2 * BENCH_STACK_DEPTH},
+        {"stack_peek", benchPeek, 1},
+        {"typed_stack_push_pop", benchTypedPushPop, 2 * BENCH_STACK_DEPTH},
+        {"type_of_char", benchTypeOfChar, LONG_EXPRESSION_LENGTH},
+        {"digit_handler", benchDigitHandler, DIGIT_COUNT},
+        {"to_int", benchToInt, 1},
+        {"compare", benchCompare, 1},
+        {"evaluate_short", benchEvaluateShort, 1},
+        {"evaluate_short_cached", benchEvaluateShortCached, 1},
+        {"evaluate_long", benchEvaluateLong, 1},
+        {"evaluate_long_wrapping", benchEvaluateLongWrapping, 1},
+        {"evaluate_deep", benchEvaluateDeep, 1},
+        {"execute_redundant", benchExecuteRedundant, 1},
+        {"execute_redundant_optimized", benchExecuteOptimized, 1},
+        {"execute_redundant_jit", benchExecuteJit, 1}
+};
+
+#define BENCHMARK_COUNT (int) (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+
+
+static int compareSamples(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+
+
+/**
+ * runBenchmark function
+ * Calibrates and times one benchmark
+ * @param b is the pointer to benchmark
+ * @param repetitions is the number of timed samples
+ * @param warmup is the number of untimed samples after calibration
+ * @param sampleNs is the minimum duration of one sample in nanoseconds
+ * @param r is the pointer to result to be filled
+ */
+static void runBenchmark(const BENCHMARK *b, int repetitions, int warmup, long long sampleNs, BENCH_RESULT *r) {
+    double samples[MAX_REPETITIONS];
+    long iterations = 1;
+    long long start, elapsed;
+    int i;
+
+    // Doubling the iterations until a sample is long enough also warms caches and branch predictors
+    while (TRUE) {
+        start = nowNanoseconds();
+        benchSink += b->run(iterations);
+        elapsed = nowNanoseconds() - start;
+        if (elapsed >= sampleNs)
+            break;
+        iterations *= 2;
+    }
+    for (i = 0; i < warmup; i++)
+        benchSink += b->run(iterations);
+
+    for (i = 0; i < repetitions; i++) {
+        start = nowNanoseconds();
+        benchSink += b->run(iterations);
+        elapsed = nowNanoseconds() - start;
+        samples[i] = (double) elapsed / ((double) iterations * b->opsPerIteration);
+    }
+    qsort(samples, repetitions, sizeof(double), compareSamples);
+
+    r->iterations = iterations;
+    r->repetitions = repetitions;
+    r->min = samples[0];
+    r->median = samples[repetitions / 2];
+    r->p99 = samples[(repetitions * 99 - 1) / 100];
+    r->opsPerSecond = 1e9 / r->median;
+}
+
+
+
+/**
+ * generateCorpus function
+ * Generates count expressions of the shape into memory
+ * @param shape is the pointer to valid shape
+ * @param count is the number of expressions
+ * @param c is the pointer to corpus to be filled
+ * @return TRUE if the corpus is allocated else FALSE
+ */
+static BOOLEAN generateCorpus(const CORPUS_SHAPE *shape, long count, CORPUS *c) {
+    size_t size = corpusExpressionSize(shape);
+    uint64_t state = seedCorpus(SCALING_SEED);
+    long i;
+
+    c->text = (char *) malloc(size * count);
+    c->start = (size_t *) malloc(count * sizeof(size_t));
+    c->expected = (VALUE *) malloc(count * sizeof(VALUE));
+    c->failed = (BOOLEAN *) malloc(count * sizeof(BOOLEAN));
+    c->count = count;
+    c->bytes = 0;
+    if ((c->text == NULL) || (c->start == NULL) || (c->expected == NULL) || (c->failed == NULL))
+        return FALSE;
+    for (i = 0; i < count; i++) {
+        c->start[i] = c->bytes;
+        c->bytes += generateExpression(shape, &state, c->text + c->bytes, &c->expected[i],
+                                       &c->failed[i]) + 1;
+    }
+    return TRUE;
+}
+
+
+
+static void deleteCorpus(CORPUS *c) {
+    free(c->text);
+    free(c->start);
+    free(c->expected);
+    free(c->failed);
+}
+
+
+
+/**
+ * runScaling function
+ * Evaluates corpora of growing size in one dimension and prints one JSON object per step.
+ * Every step uses a new evaluator, so its stack size shows the memory needed by the step.
+ * Peak resident size of the process never decreases, steps are run from small to large.
+ * @param scaling is the pointer to dimension
+ * @param repetitions is the number of timed passes over the corpus of every step
+ * @return FALSE if a corpus could not be allocated else TRUE
+ */
+static BOOLEAN runScaling(const SCALING *scaling, int repetitions) {
+    double samples[MAX_REPETITIONS];
+    CORPUS_SHAPE shape = scaling->shape;
+    CORPUS corpus;
+    EVALUATOR e;
+    struct rusage usage;
+    long long start;
+    long value, count, i;
+    long mismatches;
+    VALUE result;
+    int r;
+
+    printf("{\n  \"scaling\": \"%s\",\n  \"steps\": [", scaling->name);
+    for (value = scaling->first; value <= scaling->last; value *= scaling->factor) {
+        if (strcmp(scaling->name, "depth") == 0)
+            shape.depth = (int) value;
+        else if (strcmp(scaling->name, "width") == 0)
+            shape.width = (int) value;
+        else if (strcmp(scaling->name, "literal") == 0)
+            shape.literalLength = (int) value;
+        count = (strcmp(scaling->name, "size") == 0) ? value : SCALING_BYTES;
+        count = count / (long) corpusExpressionSize(&shape) + 1;
+        if (!generateCorpus(&shape, count, &corpus)) {
+            deleteCorpus(&corpus);
+            return FALSE;
+        }
+
+        initEvaluator(&e);
+        mismatches = 0;
+        for (i = 0; i < count; i++) {
+            result = evaluateExpression(corpus.text + corpus.start[i], &e);
+            if ((e.error != corpus.failed[i]) || (!e.error && (result != corpus.expected[i])))
+                mismatches++;
+        }
+        for (r = 0; r < repetitions; r++) {
+            start = nowNanoseconds();
+            for (i = 0; i < count; i++)
+                benchSink += evaluateExpression(corpus.text + corpus.start[i], &e);
+            samples[r] = (double) (nowNanoseconds() - start);
+        }
+        qsort(samples, repetitions, sizeof(double), compareSamples);
+        getrusage(RUSAGE_SELF, &usage);
+
+        printf("%s\n    {\"%s\": %ld, \"expressions\": %ld, \"bytes\": %zu, \"ns_per_expression\": %.1f, "
+               "\"ns_per_byte\": %.3f, \"stack_bytes\": %zu, \"max_rss_kb\": %ld, \"mismatches\": %ld}",
+               (value == scaling->first) ? "" : ",", scaling->name, value, count, corpus.bytes,
+               samples[repetitions / 2] / count, samples[repetitions / 2] / corpus.bytes,
+               e.operand.capacity * sizeof(e.operand.item[0]) + e.operator.capacity * sizeof(e.operator.item[0]),
+               usage.ru_maxrss, mismatches);
+        fflush(stdout);
+        deleteEvaluator(&e);
+        deleteCorpus(&corpus);
+    }
+    printf("\n  ]\n}\n");
+    return TRUE;
+}
+
+
+
+/**
+ * Entry point of the benchmark program.
+ * @param argc is the count of the argument entered
+ * @param argv is the argument vector
+ * @return 0 if successful termination else non-zero
+ */
+int main(int argc, char *argv[]) {
+    int repetitions = DEFAULT_REPETITIONS;
+    int warmup = DEFAULT_WARMUP;
+    long long sampleNs = DEFAULT_SAMPLE_MS * 1000000LL;
+    const char *filter = NULL;
+    const char *dimension = NULL;
+    BENCH_RESULT result;
+    BOOLEAN first = TRUE;
+    int option;
+    int i;
+
+    while ((option = getopt(argc, argv, "r:w:t:s:")) != -1) {
+        switch (option) {
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 't':
+                sampleNs = atoll(optarg) * 1000000LL;
+                break;
+            case 's':
+                dimension = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repetitions] [-w warmup] [-t sample milliseconds] [filter]\n", argv[0]);
+                fprintf(stderr, "       %s -s depth|width|literal|size [-r repetitions]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind < argc)
+        filter = argv[optind];
+    if (repetitions < 1)
+        repetitions = 1;
+    if (repetitions > MAX_REPETITIONS)
+        repetitions = MAX_REPETITIONS;
+
+    if (dimension != NULL) {
+        for (i = 0; (i < SCALING_COUNT) && (strcmp(SCALINGS[i].name, dimension) != 0); i++);
+        if (i == SCALING_COUNT) {
+            fprintf(stderr, "Error: Unknown scaling dimension: %s\n", dimension);
+            exit(EXIT_FAILURE);
+        }
+        if (!runScaling(&SCALINGS[i], repetitions)) {
+            fprintf(stderr, "Error memory allocation: corpus could not be generated\n");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    initEvaluator(&evaluator);
+    initEvaluator(&wrappingEvaluator);
+    wrappingEvaluator.checked = FALSE;
+    if (!buildCorpora() || !initCache(&cache, 0) || !compileProgram(REDUNDANT_EXPRESSION, &redundantProgram, NULL)
+        || !compileProgram(REDUNDANT_EXPRESSION, &optimizedProgram, NULL)
+        || (optimizeProgram(&optimizedProgram, evaluator.checked) < 0)
+        || !jitCompile(&optimizedProgram, evaluator.checked, &jitProgram)) {
+        fprintf(stderr, "Error memory allocation: corpora could not be built\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("{\n  \"benchmarks\": [");
+    for (i = 0; i < BENCHMARK_COUNT; i++) {
+        if ((filter != NULL) && (strstr(BENCHMARKS[i].name, filter) == NULL))
+            continue;
+        runBenchmark(&BENCHMARKS[i], repetitions, warmup, sampleNs, &result);
+        printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"repetitions\": %d, "
+               "\"ns_per_op_median\": %.3f, \"ns_per_op_p99\": %.3f, \"ns_per_op_min\": %.3f, "
+               "\"ops_per_sec\": %.0f}",
+               first ? "" : ",", BENCHMARKS[i].name, result.iterations, result.repetitions,
+               result.median, result.p99, result.min, result.opsPerSecond);
+        fflush(stdout);
+        first = FALSE;
+    }
+    printf("\n  ]\n}\n");
+
+    deleteEvaluator(&evaluator);
+    deleteEvaluator(&wrappingEvaluator);
+    deleteProgram(&redundantProgram);
+    deleteProgram(&optimizedProgram);
+    deleteCache(&cache);
+    jitDelete(&jitProgram);
+    free(longExpression);
+    free(deepExpression);
+    free(digitText);
+    return 0;
+}
\ No newline at end of file
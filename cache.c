@@ -0,0 +1,355 @@
+#include "cache.h"
+#include "tokenizer.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+
+
+/**
+ * normalizeExpression function
+ * Removes whitespace that does not change the meaning of the expression.
+ * Whitespace between two letters or digits separates tokens, it is kept as one space,
+ * every other run of whitespace is removed.
+ * @param exp is the expression
+ * @param len is the length of the expression
+ * @param key is the output buffer with at least len bytes
+ * @return length of the normalized expression
+ */
+static size_t normalizeExpression(const char *exp, size_t len, char *key) {
+    size_t i, n = 0;
+    BOOLEAN space = FALSE;
+    unsigned char c;
+
+    for (i = 0; i < len; i++) {
+        c = (unsigned char) exp[i];
+        if (CHAR_CLASS[c] == SPACE) {
+            space = TRUE;
+            continue;
+        }
+        if (space && (n > 0) && isalnum((unsigned char) key[n - 1]) && isalnum(c))
+            key[n++] = ' ';
+        space = FALSE;
+        key[n++] = (char) c;
+    }
+    return n;
+}
+
+
+
+/**
+ * hashKey function
+ * Hashes eight bytes per step with a multiply and rotate, then mixes all bits of the state
+ * @param key is the normalized expression
+ * @param len is the length of the key
+ * @return 64 bit hash
+ */
+static uint64_t hashKey(const char *key, size_t len) {
+    uint64_t h = len * HASH_MULTIPLIER;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, key + i, 8);
+        h = (h ^ word) * HASH_MULTIPLIER;
+        h = (h << 31) | (h >> 33);
+    }
+    word = 0;
+    memcpy(&word, key + i, len - i);
+    h = (h ^ word) * HASH_MULTIPLIER;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+
+/**
+ * initCache function
+ * Initializes an empty cache. Every shard gets an even part of the budget
+ * and a hash table sized for the number of entries that fit in it.
+ * @param cache is the pointer to cache
+ * @param budget is the memory the entries may hold in bytes, 0 for the default
+ * @return TRUE if the hash tables are allocated else FALSE
+ */
+BOOLEAN initCache(CACHE *cache, size_t budget) {
+    CACHE_SHARD *s;
+    size_t buckets = 64;
+    int k;
+
+    cache->budget = (budget > 0) ? budget : DEFAULT_CACHE_BUDGET;
+    while (buckets * CACHE_ENTRY_ESTIMATE * CACHE_SHARD_COUNT < cache->budget)
+        buckets *= 2;
+    for (k = 0; k < CACHE_SHARD_COUNT; k++) {
+        s = &cache->shard[k];
+        s->bucket = (CACHE_ENTRY **) calloc(buckets, sizeof(CACHE_ENTRY *));
+        if (s->bucket == NULL) {
+            while (--k >= 0) {
+                pthread_mutex_destroy(&cache->shard[k].lock);
+                free(cache->shard[k].bucket);
+            }
+            return FALSE;
+        }
+        pthread_mutex_init(&s->lock, NULL);
+        s->bucketCount = buckets;
+        s->newest = NULL;
+        s->oldest = NULL;
+        s->bytes = 0;
+        s->budget = cache->budget / CACHE_SHARD_COUNT;
+        s->entries = 0;
+        s->hits = 0;
+        s->misses = 0;
+        s->evictions = 0;
+    }
+    return TRUE;
+}
+
+
+
+/**
+ * unlinkEntry function
+ * Removes an entry from the LRU list of its shard
+ * @param s is the pointer to shard
+ * @param entry is the pointer to entry
+ */
+static void unlinkEntry(CACHE_SHARD *s, CACHE_ENTRY *entry) {
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        s->newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        s->oldest = entry->newer;
+}
+
+
+
+/**
+ * pushNewest function
+ * Puts an entry to the front of the LRU list of its shard
+ * @param s is the pointer to shard
+ * @param entry is the pointer to entry
+ */
+static void pushNewest(CACHE_SHARD *s, CACHE_ENTRY *entry) {
+    entry->newer = NULL;
+    entry->older = s->newest;
+    if (s->newest != NULL)
+        s->newest->newer = entry;
+    else
+        s->oldest = entry;
+    s->newest = entry;
+}
+
+
+
+/**
+ * evictOldest function
+ * Evicts least recently used entries until the shard is within its budget.
+ * The newest entry is never evicted, so an entry larger than the budget stays until the next insert.
+ * @param s is the pointer to shard, its lock is held
+ */
+static void evictOldest(CACHE_SHARD *s) {
+    CACHE_ENTRY *victim;
+    CACHE_ENTRY **link;
+
+    while ((s->bytes > s->budget) && (s->oldest != NULL) && (s->oldest != s->newest)) {
+        victim = s->oldest;
+        link = &s->bucket[victim->hash & (s->bucketCount - 1)];
+        while (*link != victim)
+            link = &(*link)->next;
+        *link = victim->next;
+        unlinkEntry(s, victim);
+        s->bytes -= victim->bytes;
+        s->entries--;
+        s->evictions++;
+        free(victim);
+    }
+}
+
+
+
+/**
+ * lookupEntry function
+ * Looks up a key in its shard and marks the entry as most recently used
+ * @param s is the pointer to shard, its lock is held
+ * @param key is the normalized expression
+ * @param len is the length of the key
+ * @param hash is the hash of the key
+ * @param checked is the arithmetic of the evaluator
+ * @return pointer to entry, NULL if the key is not cached
+ */
+static CACHE_ENTRY *lookupEntry(CACHE_SHARD *s, const char *key, size_t len, uint64_t hash, BOOLEAN checked) {
+    CACHE_ENTRY *entry;
+
+    for (entry = s->bucket[hash & (s->bucketCount - 1)]; entry != NULL; entry = entry->next) {
+        if ((entry->hash == hash) && (entry->keyLength == len) && (entry->checked == checked)
+            && (memcmp(entry->key, key, len) == 0)) {
+            if (entry != s->newest) {
+                unlinkEntry(s, entry);
+                pushNewest(s, entry);
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+
+/**
+ * insertEntry function
+ * Adds a new entry without result as the most recently used one,
+ * then evicts old entries if the shard is over its budget
+ * @param s is the pointer to shard, its lock is held
+ * @param key is the normalized expression
+ * @param len is the length of the key
+ * @param hash is the hash of the key
+ * @param checked is the arithmetic of the evaluator
+ * @return pointer to entry, NULL if memory could not allocated
+ */
+static CACHE_ENTRY *insertEntry(CACHE_SHARD *s, const char *key, size_t len, uint64_t hash, BOOLEAN checked) {
+    CACHE_ENTRY **head = &s->bucket[hash & (s->bucketCount - 1)];
+    CACHE_ENTRY *entry = (CACHE_ENTRY *) malloc(sizeof(CACHE_ENTRY) + len + 1);
+
+    if (entry == NULL)
+        return NULL;
+    memcpy(entry->key, key, len);
+    entry->key[len] = '\0';
+    entry->keyLength = len;
+    entry->hash = hash;
+    entry->checked = checked;
+    entry->hasResult = FALSE;
+    entry->error = FALSE;
+    entry->value = 0;
+    entry->bytes = sizeof(CACHE_ENTRY) + len + 1;
+    entry->next = *head;
+    *head = entry;
+    pushNewest(s, entry);
+    s->bytes += entry->bytes;
+    s->entries++;
+    evictOldest(s);
+    return entry;
+}
+
+
+
+/**
+ * cachedEvaluate function
+ * Evaluates an expression like evaluateBuffer and keeps its result in the cache,
+ * so the same expression, also with different whitespace, is evaluated only once.
+ * Expressions that failed are evaluated again, the offset of their error depends on the whitespace.
+ * Evaluation runs outside the shard lock, two threads that miss the same expression
+ * both evaluate it and the second one stores the same result again.
+ * @param cache is the pointer to cache
+ * @param exp is the expression, it does not need a terminating NUL
+ * @param len is the length of the expression
+ * @param e is the pointer to evaluator context, its error flag and status are set like evaluateBuffer does
+ * @return result of the expression, not meaningful when e->error is set
+ */
+VALUE cachedEvaluate(CACHE *cache, const char *exp, size_t len, EVALUATOR *e) {
+    char key[CACHE_MAX_KEY_SIZE];
+    CACHE_SHARD *s;
+    CACHE_ENTRY *entry;
+    uint64_t hash;
+    size_t keyLength;
+    VALUE result;
+
+    if (len > CACHE_MAX_KEY_SIZE)
+        return evaluateBuffer(exp, len, e);
+    keyLength = normalizeExpression(exp, len, key);
+    hash = hashKey(key, keyLength);
+    s = &cache->shard[hash >> (64 - CACHE_SHARD_BITS)];
+
+    // A hit is counted as an evaluation, a miss is counted by evaluateBuffer
+    METRICS_BEGIN(e);
+    pthread_mutex_lock(&s->lock);
+    entry = lookupEntry(s, key, keyLength, hash, e->checked);
+    if ((entry != NULL) && entry->hasResult && !entry->error) {
+        s->hits++;
+        result = entry->value;
+        e->error = FALSE;
+        e->invalid = FALSE;
+        e->status = EVAL_OK;
+        pthread_mutex_unlock(&s->lock);
+        METRICS_END(e);
+        return result;
+    }
+    s->misses++;
+    pthread_mutex_unlock(&s->lock);
+
+    result = evaluateBuffer(exp, len, e);
+
+    // Entry may have been evicted or added by another thread while the lock was released
+    pthread_mutex_lock(&s->lock);
+    entry = lookupEntry(s, key, keyLength, hash, e->checked);
+    if (entry == NULL)
+        entry = insertEntry(s, key, keyLength, hash, e->checked);
+    if (entry != NULL) {
+        entry->value = result;
+        entry->error = e->error;
+        entry->hasResult = TRUE;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return result;
+}
+
+
+
+/**
+ * cacheStats function
+ * Sums the counters of every shard
+ * @param cache is the pointer to cache
+ * @param stats is the pointer to counters to be filled
+ */
+void cacheStats(CACHE *cache, CACHE_STATS *stats) {
+    CACHE_SHARD *s;
+    int k;
+
+    memset(stats, 0, sizeof(CACHE_STATS));
+    for (k = 0; k < CACHE_SHARD_COUNT; k++) {
+        s = &cache->shard[k];
+        pthread_mutex_lock(&s->lock);
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->entries += s->entries;
+        stats->bytes += s->bytes;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+
+
+/**
+ * deleteCache function
+ * Frees every entry and the hash tables and handles dangling pointers.
+ * @param cache is the pointer to cache
+ */
+void deleteCache(CACHE *cache) {
+    CACHE_SHARD *s;
+    CACHE_ENTRY *entry, *older;
+    int k;
+
+    for (k = 0; k < CACHE_SHARD_COUNT; k++) {
+        s = &cache->shard[k];
+        for (entry = s->newest; entry != NULL; entry = older) {
+            older = entry->older;
+            free(entry);
+        }
+        free(s->bucket);
+        s->bucket = NULL;
+        s->newest = NULL;
+        s->oldest = NULL;
+        s->entries = 0;
+        s->bytes = 0;
+        pthread_mutex_destroy(&s->lock);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+#ifndef EXPEVAL_CACHE_H
+#define EXPEVAL_CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "stack.h"
+#include "arena.h"
+
+// Shards are selected by the top bits of the hash, every shard has its own lock
+#define CACHE_SHARD_BITS 4
+#define CACHE_SHARD_COUNT (1 << CACHE_SHARD_BITS)
+// Expressions longer than this after normalization are evaluated without the cache
+#define CACHE_MAX_KEY_SIZE 4096
+#define DEFAULT_CACHE_BUDGET (16 * 1024 * 1024)
+// Expected size of an entry, used to size the hash tables of the shards
+#define CACHE_ENTRY_ESTIMATE 128
+
+/*
+ * Cached expression.
+ * key is the whitespace normalized expression with keyLength bytes and hash is its hash
+ * checked is the arithmetic the result was computed with
+ * next links entries of one hash bucket, newer and older link the LRU list of the shard
+ * value and error are the result of evaluateBuffer, hasResult is set when they are known
+ * bytes is the memory charged to the shard for this entry
+ */
+typedef struct CACHE_ENTRY {
+    uint64_t hash;
+    struct CACHE_ENTRY *next;
+    struct CACHE_ENTRY *newer;
+    struct CACHE_ENTRY *older;
+    VALUE value;
+    size_t bytes;
+    size_t keyLength;
+    BOOLEAN checked;
+    BOOLEAN hasResult;
+    BOOLEAN error;
+    char key[];
+} CACHE_ENTRY;
+
+/*
+ * One shard of the cache, a chained hash table with an LRU list.
+ * bucket has bucketCount chains, bucketCount is a power of two
+ * newest and oldest are the ends of the LRU list, oldest is evicted first
+ * bytes is the memory held by the entries and budget is the limit of it
+ * Shards are aligned to cache lines, so threads working on different shards
+ * do not share lines.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    CACHE_ENTRY **bucket;
+    size_t bucketCount;
+    CACHE_ENTRY *newest;
+    CACHE_ENTRY *oldest;
+    size_t bytes;
+    size_t budget;
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} __attribute__((aligned(CACHE_LINE_SIZE))) CACHE_SHARD;
+
+/*
+ * Thread safe sharded LRU cache of expressions.
+ * budget is the total memory the entries may hold, it is split evenly between the shards.
+ */
+typedef struct CACHE {
+    CACHE_SHARD shard[CACHE_SHARD_COUNT];
+    size_t budget;
+} CACHE;
+
+/*
+ * Counters of the cache, summed over all shards.
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;
+} CACHE_STATS;
+
+// Function prototypes
+BOOLEAN initCache(CACHE *cache, size_t budget);
+
+VALUE cachedEvaluate(CACHE *cache, const char *exp, size_t len, EVALUATOR *e);
+
+void cacheStats(CACHE *cache, CACHE_STATS *stats);
+
+void deleteCache(CACHE *cache);
+
+#endif //EXPEVAL_CACHE_H
\ No newline at end of file
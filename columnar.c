@@ -0,0 +1,727 @@
+#include "columnar.h"
+#include "arena.h"
+#include "metrics.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLUMNAR_X86
+#endif
+
+#define VECTOR_ALIGNMENT 32
+
+/*
+ * Kernel of one binary operator over a block.
+ * out[k] = b[k] op a[k] for k < n, out can be the same array as b.
+ * Checked kernels set *error when any row of the block fails.
+ */
+typedef void (*COLUMN_KERNEL)(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error);
+
+
+
+/**
+ * addColumn function
+ * Adds a new empty column to the set
+ * @param set is the pointer to column set
+ * @param name is the name of the column
+ * @param len is the length of the name
+ * @return TRUE if the column is added else FALSE
+ */
+static BOOLEAN addColumn(COLUMN_SET *set, const char *name, size_t len) {
+    char *copy;
+    if ((len == 0) || (set->count == MAX_COLUMN_COUNT))
+        return FALSE;
+    copy = (char *) malloc(len + 1);
+    if (copy == NULL)
+        return FALSE;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    set->names[set->count] = copy;
+    set->data[set->count] = NULL;
+    set->count++;
+    return TRUE;
+}
+
+
+
+/**
+ * reserveRows function
+ * Grows every column array of the set to hold at least rows values
+ * @param set is the pointer to column set
+ * @param rows is the number of rows needed
+ * @return TRUE if the columns can hold rows values else FALSE
+ */
+static BOOLEAN reserveRows(COLUMN_SET *set, size_t rows) {
+    size_t capacity = (set->capacity > 0) ? set->capacity : COLUMN_BLOCK_SIZE;
+    VALUE *data;
+    int k;
+
+    while (capacity < rows)
+        capacity *= 2;
+    if (capacity == set->capacity)
+        return TRUE;
+    for (k = 0; k < set->count; k++) {
+        data = (VALUE *) realloc(set->data[k], capacity * sizeof(VALUE));
+        if (data == NULL)
+            return FALSE;
+        set->data[k] = data;
+    }
+    set->capacity = capacity;
+    return TRUE;
+}
+
+
+
+/**
+ * initColumns function
+ * Makes the column set empty
+ * @param set is the pointer to column set
+ */
+static void initColumns(COLUMN_SET *set) {
+    set->count = 0;
+    set->rows = 0;
+    set->capacity = 0;
+}
+
+
+
+/**
+ * readCsvColumns function
+ * Reads comma separated columns, the first line is the header of column names
+ * and every other line is one row of integer values. Blank lines are skipped.
+ * @param in is the input file
+ * @param set is the pointer to column set to be filled
+ * @return TRUE if every line is read else FALSE, the set is empty on failure
+ */
+BOOLEAN readCsvColumns(FILE *in, COLUMN_SET *set) {
+    char line[COLUMN_LINE_SIZE];
+    char *cursor, *end, *name;
+    long long value;
+    int k;
+    BOOLEAN ok;
+
+    initColumns(set);
+    if (fgets(line, COLUMN_LINE_SIZE, in) == NULL)
+        return FALSE;
+
+    // Header, names are trimmed
+    cursor = line;
+    ok = TRUE;
+    while (ok) {
+        while (isspace((unsigned char) *cursor))
+            cursor++;
+        name = cursor;
+        while ((*cursor != ',') && (*cursor != '\0') && !isspace((unsigned char) *cursor))
+            cursor++;
+        ok = addColumn(set, name, (size_t) (cursor - name));
+        while (isspace((unsigned char) *cursor))
+            cursor++;
+        if (*cursor != ',')
+            break;
+        cursor++;
+    }
+    ok = ok && (*cursor == '\0');
+
+    // Rows, every line must have one value per column
+    while (ok && (fgets(line, COLUMN_LINE_SIZE, in) != NULL)) {
+        cursor = line;
+        while (isspace((unsigned char) *cursor))
+            cursor++;
+        if (*cursor == '\0')
+            continue;
+        ok = reserveRows(set, set->rows + 1);
+        for (k = 0; ok && (k < set->count); k++) {
+            errno = 0;
+            value = strtoll(cursor, &end, 10);
+            ok = (end != cursor) && (errno == 0);
+            set->data[k][set->rows] = (VALUE) value;
+            cursor = end;
+            while (isspace((unsigned char) *cursor))
+                cursor++;
+            if (k + 1 < set->count)
+                ok = ok && (*cursor++ == ',');
+        }
+        ok = ok && (*cursor == '\0');
+        set->rows++;
+    }
+
+    if (!ok || ferror(in)) {
+        deleteColumns(set);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+/**
+ * readBinaryColumns function
+ * Reads raw binary columns. The file starts with COLUMN_MAGIC, a 32 bit column count,
+ * 32 reserved bits and a 64 bit row count. Column names follow as a 32 bit length
+ * and the name bytes, then the values of every column as rows native 64 bit integers.
+ * Values are read straight into the column arrays, there is no parsing.
+ * @param in is the input file
+ * @param set is the pointer to column set to be filled
+ * @return TRUE if the file is read else FALSE, the set is empty on failure
+ */
+BOOLEAN readBinaryColumns(FILE *in, COLUMN_SET *set) {
+    char magic[COLUMN_MAGIC_SIZE];
+    char name[COLUMN_LINE_SIZE];
+    uint32_t header[2];
+    uint32_t len;
+    uint64_t rows;
+    uint32_t k;
+    BOOLEAN ok;
+
+    initColumns(set);
+    ok = (fread(magic, 1, COLUMN_MAGIC_SIZE, in) == COLUMN_MAGIC_SIZE)
+         && (memcmp(magic, COLUMN_MAGIC, COLUMN_MAGIC_SIZE) == 0)
+         && (fread(header, sizeof(uint32_t), 2, in) == 2)
+         && (fread(&rows, sizeof(uint64_t), 1, in) == 1)
+         && (header[0] > 0) && (header[0] <= MAX_COLUMN_COUNT);
+    for (k = 0; ok && (k < header[0]); k++) {
+        ok = (fread(&len, sizeof(uint32_t), 1, in) == 1) && (len < COLUMN_LINE_SIZE)
+             && (fread(name, 1, len, in) == len) && addColumn(set, name, len);
+    }
+    ok = ok && (rows <= SIZE_MAX / sizeof(VALUE)) && reserveRows(set, (size_t) rows);
+    for (k = 0; ok && (k < header[0]); k++)
+        ok = fread(set->data[k], sizeof(VALUE), (size_t) rows, in) == (size_t) rows;
+
+    if (!ok) {
+        deleteColumns(set);
+        return FALSE;
+    }
+    set->rows = (size_t) rows;
+    return TRUE;
+}
+
+
+
+/**
+ * deleteColumns function
+ * Frees names and values of every column and handles dangling pointers.
+ * @param set is the pointer to column set
+ */
+void deleteColumns(COLUMN_SET *set) {
+    int k;
+    for (k = 0; k < set->count; k++) {
+        free(set->names[k]);
+        free(set->data[k]);
+        set->names[k] = NULL;
+        set->data[k] = NULL;
+    }
+    initColumns(set);
+}
+
+
+
+/**
+ * compileColumnProgram function
+ * Compiles an expression over the columns of a set, columns are referred to by name or by $1, $2, ...
+ * @param exp is the expression string
+ * @param set is the pointer to column set
+ * @param p is the pointer to program to be filled
+ * @param arena is the pointer to arena owning the program, NULL to use malloc
+ * @return TRUE if the expression is compiled and uses only existing columns else FALSE
+ */
+BOOLEAN compileColumnProgram(const char *exp, const COLUMN_SET *set, PROGRAM *p, ARENA *arena) {
+    if (!compileNamedProgram(exp, (const char *const *) set->names, set->count, p, arena))
+        return FALSE;
+    if (p->paramCount > set->count) {
+        deleteProgram(p);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+/*
+ * Scalar kernels, used for the tail of every block and on CPUs without vector units.
+ * Wrapping kernels compute modulo 2^64 like the wrapping registry functions,
+ * checked kernels accumulate the overflow flags and test them once per block.
+ */
+static void addScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = (VALUE) ((uint64_t) b[k] + (uint64_t) a[k]);
+}
+
+static void addCheckedScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    BOOLEAN overflow = FALSE;
+    for (k = 0; k < n; k++)
+        overflow |= __builtin_add_overflow(b[k], a[k], &out[k]);
+    *error |= overflow;
+}
+
+static void subScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = (VALUE) ((uint64_t) b[k] - (uint64_t) a[k]);
+}
+
+static void subCheckedScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    BOOLEAN overflow = FALSE;
+    for (k = 0; k < n; k++)
+        overflow |= __builtin_sub_overflow(b[k], a[k], &out[k]);
+    *error |= overflow;
+}
+
+static void mulScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = (VALUE) ((uint64_t) b[k] * (uint64_t) a[k]);
+}
+
+static void mulCheckedScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    BOOLEAN overflow = FALSE;
+    for (k = 0; k < n; k++)
+        overflow |= __builtin_mul_overflow(b[k], a[k], &out[k]);
+    *error |= overflow;
+}
+
+static void andScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = b[k] & a[k];
+}
+
+static void orScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = b[k] | a[k];
+}
+
+static void lessScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = b[k] < a[k];
+}
+
+static void greaterScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = b[k] > a[k];
+}
+
+static void equalScalar(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    size_t k;
+    (void) error;
+    for (k = 0; k < n; k++)
+        out[k] = b[k] == a[k];
+}
+
+
+
+#ifdef COLUMNAR_X86
+/*
+ * Vector kernels, two lanes with SSE2 and four lanes with AVX2.
+ * Signed overflow of b + a happened when the result has a different sign than
+ * both operands, of b - a when the operands differ in sign and the result differs from b.
+ * Sign bits of the lanes are collected in a mask and tested once after the block.
+ * Rows after the last full vector are left to the scalar kernel.
+ */
+#define SSE2_KERNEL(NAME, LANES, TAIL)                                                      \
+__attribute__((target("sse2")))                                                            \
+static void NAME(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {   \
+    size_t k = 0;                                                                           \
+    for (; k + 2 <= n; k += 2) {                                                            \
+        __m128i x = _mm_loadu_si128((const __m128i *) (b + k));                             \
+        __m128i y = _mm_loadu_si128((const __m128i *) (a + k));                             \
+        _mm_storeu_si128((__m128i *) (out + k), LANES(x, y));                               \
+    }                                                                                       \
+    TAIL(out + k, b + k, a + k, n - k, error);                                              \
+}
+
+#define AVX2_KERNEL(NAME, LANES, TAIL)                                                      \
+__attribute__((target("avx2")))                                                            \
+static void NAME(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {   \
+    size_t k = 0;                                                                           \
+    for (; k + 4 <= n; k += 4) {                                                            \
+        __m256i x = _mm256_loadu_si256((const __m256i *) (b + k));                          \
+        __m256i y = _mm256_loadu_si256((const __m256i *) (a + k));                          \
+        _mm256_storeu_si256((__m256i *) (out + k), LANES(x, y));                            \
+    }                                                                                       \
+    TAIL(out + k, b + k, a + k, n - k, error);                                              \
+}
+
+__attribute__((target("avx2")))
+static inline __m256i less256(__m256i x, __m256i y) {
+    return _mm256_and_si256(_mm256_cmpgt_epi64(y, x), _mm256_set1_epi64x(1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i greater256(__m256i x, __m256i y) {
+    return _mm256_and_si256(_mm256_cmpgt_epi64(x, y), _mm256_set1_epi64x(1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i equal256(__m256i x, __m256i y) {
+    return _mm256_and_si256(_mm256_cmpeq_epi64(x, y), _mm256_set1_epi64x(1));
+}
+
+SSE2_KERNEL(addSSE2, _mm_add_epi64, addScalar)
+SSE2_KERNEL(subSSE2, _mm_sub_epi64, subScalar)
+SSE2_KERNEL(andSSE2, _mm_and_si128, andScalar)
+SSE2_KERNEL(orSSE2, _mm_or_si128, orScalar)
+AVX2_KERNEL(addAVX2, _mm256_add_epi64, addScalar)
+AVX2_KERNEL(subAVX2, _mm256_sub_epi64, subScalar)
+AVX2_KERNEL(andAVX2, _mm256_and_si256, andScalar)
+AVX2_KERNEL(orAVX2, _mm256_or_si256, orScalar)
+AVX2_KERNEL(lessAVX2, less256, lessScalar)
+AVX2_KERNEL(greaterAVX2, greater256, greaterScalar)
+AVX2_KERNEL(equalAVX2, equal256, equalScalar)
+
+__attribute__((target("sse2")))
+static void addCheckedSSE2(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    __m128i overflow = _mm_setzero_si128();
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (b + k));
+        __m128i y = _mm_loadu_si128((const __m128i *) (a + k));
+        __m128i r = _mm_add_epi64(x, y);
+        overflow = _mm_or_si128(overflow, _mm_and_si128(_mm_xor_si128(x, r), _mm_xor_si128(y, r)));
+        _mm_storeu_si128((__m128i *) (out + k), r);
+    }
+    *error |= _mm_movemask_pd(_mm_castsi128_pd(overflow)) != 0;
+    addCheckedScalar(out + k, b + k, a + k, n - k, error);
+}
+
+__attribute__((target("sse2")))
+static void subCheckedSSE2(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    __m128i overflow = _mm_setzero_si128();
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (b + k));
+        __m128i y = _mm_loadu_si128((const __m128i *) (a + k));
+        __m128i r = _mm_sub_epi64(x, y);
+        overflow = _mm_or_si128(overflow, _mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, r)));
+        _mm_storeu_si128((__m128i *) (out + k), r);
+    }
+    *error |= _mm_movemask_pd(_mm_castsi128_pd(overflow)) != 0;
+    subCheckedScalar(out + k, b + k, a + k, n - k, error);
+}
+
+__attribute__((target("avx2")))
+static void addCheckedAVX2(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    __m256i overflow = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (b + k));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (a + k));
+        __m256i r = _mm256_add_epi64(x, y);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(x, r), _mm256_xor_si256(y, r)));
+        _mm256_storeu_si256((__m256i *) (out + k), r);
+    }
+    *error |= _mm256_movemask_pd(_mm256_castsi256_pd(overflow)) != 0;
+    addCheckedScalar(out + k, b + k, a + k, n - k, error);
+}
+
+__attribute__((target("avx2")))
+static void subCheckedAVX2(VALUE *out, const VALUE *b, const VALUE *a, size_t n, BOOLEAN *error) {
+    __m256i overflow = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (b + k));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (a + k));
+        __m256i r = _mm256_sub_epi64(x, y);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, r)));
+        _mm256_storeu_si256((__m256i *) (out + k), r);
+    }
+    *error |= _mm256_movemask_pd(_mm256_castsi256_pd(overflow)) != 0;
+    subCheckedScalar(out + k, b + k, a + k, n - k, error);
+}
+#endif
+
+/*
+ * Kernels selected for this CPU, indexed like OPCODE_FUNCTION, wrapping ones first.
+ * Opcodes without a kernel are applied row by row through the operator registry.
+ */
+static COLUMN_KERNEL COLUMN_KERNELS[2][OPCODE_COUNT] = {
+        {
+                [OP_ADD] = addScalar, [OP_SUB] = subScalar, [OP_MUL] = mulScalar,
+                [OP_AND] = andScalar, [OP_OR] = orScalar,
+                [OP_LESS] = lessScalar, [OP_GREATER] = greaterScalar, [OP_EQUAL] = equalScalar
+        },
+        {
+                [OP_ADD] = addCheckedScalar, [OP_SUB] = subCheckedScalar, [OP_MUL] = mulCheckedScalar,
+                [OP_AND] = andScalar, [OP_OR] = orScalar,
+                [OP_LESS] = lessScalar, [OP_GREATER] = greaterScalar, [OP_EQUAL] = equalScalar
+        }
+};
+static const char *backendName = "scalar";
+
+
+
+/**
+ * selectColumnKernels function
+ * Runtime CPU dispatch, runs once when the program is loaded.
+ * Picks the widest vector unit the CPU supports.
+ */
+__attribute__((constructor))
+static void selectColumnKernels(void) {
+#ifdef COLUMNAR_X86
+    int checked;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        COLUMN_KERNELS[FALSE][OP_ADD] = addAVX2;
+        COLUMN_KERNELS[FALSE][OP_SUB] = subAVX2;
+        COLUMN_KERNELS[TRUE][OP_ADD] = addCheckedAVX2;
+        COLUMN_KERNELS[TRUE][OP_SUB] = subCheckedAVX2;
+        for (checked = FALSE; checked <= TRUE; checked++) {
+            COLUMN_KERNELS[checked][OP_AND] = andAVX2;
+            COLUMN_KERNELS[checked][OP_OR] = orAVX2;
+            COLUMN_KERNELS[checked][OP_LESS] = lessAVX2;
+            COLUMN_KERNELS[checked][OP_GREATER] = greaterAVX2;
+            COLUMN_KERNELS[checked][OP_EQUAL] = equalAVX2;
+        }
+        backendName = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        COLUMN_KERNELS[FALSE][OP_ADD] = addSSE2;
+        COLUMN_KERNELS[FALSE][OP_SUB] = subSSE2;
+        COLUMN_KERNELS[TRUE][OP_ADD] = addCheckedSSE2;
+        COLUMN_KERNELS[TRUE][OP_SUB] = subCheckedSSE2;
+        for (checked = FALSE; checked <= TRUE; checked++) {
+            COLUMN_KERNELS[checked][OP_AND] = andSSE2;
+            COLUMN_KERNELS[checked][OP_OR] = orSSE2;
+        }
+        backendName = "sse2";
+    }
+#endif
+}
+
+
+
+/**
+ * columnBackend function
+ * Names the kernels selected by runtime dispatch
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *columnBackend(void) {
+    return backendName;
+}
+
+
+
+/**
+ * applyRows function
+ * Applies a registry function row by row, for operators without a block kernel
+ * @param apply is the operator function
+ * @param out is the result block, it can be the same array as b
+ * @param b is the left operand block
+ * @param a is the right operand block
+ * @param n is the number of rows
+ * @param error is the pointer to error flag of the block
+ */
+static void applyRows(OPERATOR_FUNCTION apply, VALUE *out, const VALUE *b, const VALUE *a, size_t n,
+                      BOOLEAN *error) {
+    size_t k;
+    for (k = 0; k < n; k++)
+        out[k] = apply(b[k], a[k], error);
+}
+
+
+
+/**
+ * recheckRows function
+ * Runs the scalar program on every row of a block that failed,
+ * so only the rows that overflow or divide by zero are marked
+ * @param p is the pointer to compiled program
+ * @param set is the pointer to column set
+ * @param start is the first row of the block
+ * @param n is the number of rows in the block
+ * @param result is the result column
+ * @param failed is the error column
+ * @param e is the pointer to evaluator used for scalar execution
+ * @return number of failed rows in the block
+ */
+static long recheckRows(const PROGRAM *p, const COLUMN_SET *set, size_t start, size_t n, VALUE *result,
+                        char *failed, EVALUATOR *e) {
+    VALUE params[MAX_COLUMN_COUNT];
+    size_t row;
+    long count = 0;
+    int k;
+
+    for (row = start; row < start + n; row++) {
+        for (k = 0; k < p->paramCount; k++)
+            params[k] = set->data[k][row];
+        result[row] = executeProgram(p, params, e);
+        failed[row] = (char) e->error;
+        count += e->error;
+    }
+    return count;
+}
+
+
+
+/**
+ * executeColumns function
+ * Runs a compiled program over whole columns. Rows are taken COLUMN_BLOCK_SIZE at a time
+ * and every instruction is applied to the whole block before the next one, so the dispatch
+ * cost is paid once per block and operators run as vector kernels.
+ * Operand stack items are blocks: parameters push a slice of their column without copying,
+ * constants are broadcast and every stack level owns one aligned scratch block for results.
+ * A block whose error flag is set is evaluated again row by row to find the failed rows.
+ * @param p is the pointer to compiled program, parameters are column indexes of set
+ * @param set is the pointer to column set
+ * @param result is the result column with set->rows elements
+ * @param failed is the error column with set->rows elements, nonzero for failed rows
+ * @param e is the pointer to evaluator, it selects checked arithmetic and runs rechecks
+ * @return number of failed rows, -1 if memory could not allocated
+ */
+long executeColumns(const PROGRAM *p, const COLUMN_SET *set, VALUE *result, char *failed, EVALUATOR *e) {
+    const INSTRUCTION *code = p->code;
+    const COLUMN_KERNEL *kernel = COLUMN_KERNELS[e->checked];
+    const OPERATOR_FUNCTION *apply = OPCODE_FUNCTION[e->checked];
+    VECTOR_STACK operand;
+    VALUE **scratch;
+    VALUE *out;
+    const VALUE *a, *b;
+    ARENA arena;
+    size_t start, n, k;
+    long count = 0;
+    BOOLEAN error;
+    int i, d;
+
+    if (!initArena(&arena, (size_t) p->maxDepth * (COLUMN_BLOCK_SIZE * sizeof(VALUE) + 2 * VECTOR_ALIGNMENT)
+                           + 4096, FALSE))
+        return -1;
+    scratch = (VALUE **) arenaAlloc(&arena, (size_t) p->maxDepth * sizeof(VALUE *));
+    if ((scratch == NULL) || !vectorStackInitArena(&operand, &arena, p->maxDepth)) {
+        deleteArena(&arena);
+        return -1;
+    }
+    for (d = 0; d < p->maxDepth; d++) {
+        scratch[d] = (VALUE *) arenaAllocAligned(&arena, COLUMN_BLOCK_SIZE * sizeof(VALUE), VECTOR_ALIGNMENT);
+        if (scratch[d] == NULL) {
+            deleteArena(&arena);
+            return -1;
+        }
+    }
+
+    for (start = 0; start < set->rows; start += n) {
+        n = (set->rows - start < COLUMN_BLOCK_SIZE) ? set->rows - start : COLUMN_BLOCK_SIZE;
+        error = FALSE;
+        vectorStackReset(&operand);
+        for (i = 0; i < p->length; i++) {
+            d = operand.top;
+            switch (code[i].op) {
+                case OP_CONST:
+                    out = scratch[d];
+                    for (k = 0; k < n; k++)
+                        out[k] = code[i].value;
+                    vectorStackPushUnchecked(&operand, out);
+                    break;
+                case OP_PARAM:
+                    vectorStackPushUnchecked(&operand, set->data[code[i].value] + start);
+                    break;
+                case OP_NEG:
+                    a = vectorStackPopUnchecked(&operand);
+                    out = scratch[d - 1];
+                    for (k = 0; k < n; k++)
+                        out[k] = apply[OP_NEG](0, a[k], &error);
+                    vectorStackPushUnchecked(&operand, out);
+                    break;
+                case OP_DUP:
+                    vectorStackPushUnchecked(&operand, vectorStackPeekUnchecked(&operand));
+                    break;
+                case OP_DIV_SHIFT:
+                case OP_MOD_MASK:
+                    a = vectorStackPopUnchecked(&operand);
+                    out = scratch[d - 1];
+                    if (code[i].op == OP_DIV_SHIFT) {
+                        for (k = 0; k < n; k++)
+                            out[k] = shiftDivide(a[k], (int) code[i].value);
+                    } else {
+                        for (k = 0; k < n; k++)
+                            out[k] = maskModulo(a[k], (int) code[i].value);
+                    }
+                    vectorStackPushUnchecked(&operand, out);
+                    break;
+                default:
+                    a = vectorStackPopUnchecked(&operand);
+                    b = vectorStackPopUnchecked(&operand);
+                    out = scratch[d - 2];
+                    if (kernel[code[i].op] != NULL)
+                        kernel[code[i].op](out, b, a, n, &error);
+                    else
+                        applyRows(apply[code[i].op], out, b, a, n, &error);
+                    vectorStackPushUnchecked(&operand, out);
+                    break;
+            }
+        }
+
+        memcpy(result + start, vectorStackPopUnchecked(&operand), n * sizeof(VALUE));
+        memset(failed + start, 0, n);
+        if (UNLIKELY(error))
+            count += recheckRows(p, set, start, n, result, failed, e);
+    }
+
+    METRICS_ROWS(set->rows, (uint64_t) count);
+    deleteArena(&arena);
+    return count;
+}
+
+
+
+/**
+ * writeResultColumn function
+ * Writes the result column as text, one value or "error" per line,
+ * or as a binary column file with a "result" and an "error" column
+ * that can be read back with readBinaryColumns.
+ * @param out is the output file
+ * @param result is the result column
+ * @param failed is the error column
+ * @param rows is the number of rows
+ * @param binary is TRUE for binary output
+ * @return TRUE if everything is written else FALSE
+ */
+BOOLEAN writeResultColumn(FILE *out, const VALUE *result, const char *failed, size_t rows, BOOLEAN binary) {
+    static const char *names[2] = {"result", "error"};
+    uint32_t header[2] = {2, 0};
+    uint64_t count = rows;
+    uint32_t len;
+    VALUE flag;
+    size_t row;
+    int k;
+
+    if (!binary) {
+        for (row = 0; row < rows; row++) {
+            if (failed[row])
+                fputs("error\n", out);
+            else
+                fprintf(out, "%" PRId64 "\n", result[row]);
+        }
+        return !ferror(out);
+    }
+
+    fwrite(COLUMN_MAGIC, 1, COLUMN_MAGIC_SIZE, out);
+    fwrite(header, sizeof(uint32_t), 2, out);
+    fwrite(&count, sizeof(uint64_t), 1, out);
+    for (k = 0; k < 2; k++) {
+        len = (uint32_t) strlen(names[k]);
+        fwrite(&len, sizeof(uint32_t), 1, out);
+        fwrite(names[k], 1, len, out);
+    }
+    fwrite(result, sizeof(VALUE), rows, out);
+    for (row = 0; row < rows; row++) {
+        flag = failed[row] ? 1 : 0;
+        fwrite(&flag, sizeof(VALUE), 1, out);
+    }
+    return !ferror(out);
+}
\ No newline at end of file
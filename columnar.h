@@ -0,0 +1,48 @@
+#ifndef EXPEVAL_COLUMNAR_H
+#define EXPEVAL_COLUMNAR_H
+
+#include <stdio.h>
+#include "stack.h"
+#include "program.h"
+
+// Rows evaluated by one pass over the program, a block of every stack level stays in cache
+#define COLUMN_BLOCK_SIZE 1024
+#define MAX_COLUMN_COUNT MAX_PARAM_COUNT
+#define COLUMN_LINE_SIZE 4096
+// First bytes of a raw binary column file, including the terminating zero
+#define COLUMN_MAGIC "EXPCOLS"
+#define COLUMN_MAGIC_SIZE 8
+
+/*
+ * Named integer columns of equal length.
+ * names[k] is the name of column k and data[k] holds its rows values
+ * count is the number of columns, rows is the number of values in every column
+ * capacity is the number of rows the column arrays can hold
+ */
+typedef struct {
+    char *names[MAX_COLUMN_COUNT];
+    VALUE *data[MAX_COLUMN_COUNT];
+    int count;
+    size_t rows;
+    size_t capacity;
+} COLUMN_SET;
+
+// Operand stack of the columnar engine, every item is a block of values
+DEFINE_STACK(VECTOR_STACK, vectorStack, const VALUE *)
+
+// Function prototypes
+BOOLEAN readCsvColumns(FILE *in, COLUMN_SET *set);
+
+BOOLEAN readBinaryColumns(FILE *in, COLUMN_SET *set);
+
+void deleteColumns(COLUMN_SET *set);
+
+BOOLEAN compileColumnProgram(const char *exp, const COLUMN_SET *set, PROGRAM *program, struct ARENA *arena);
+
+long executeColumns(const PROGRAM *program, const COLUMN_SET *set, VALUE *result, char *failed, EVALUATOR *e);
+
+BOOLEAN writeResultColumn(FILE *out, const VALUE *result, const char *failed, size_t rows, BOOLEAN binary);
+
+const char *columnBackend(void);
+
+#endif //EXPEVAL_COLUMNAR_H
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include "corpus.h"
+#include <string.h>
+
+/*
+ * Value of an operator chain without parentheses.
+ * Multiplication and division bind tighter, so they are applied to term,
+ * additions and subtractions are applied to sum when the next one is seen.
+ * Operations are done in the order the evaluator does them and checked the same way,
+ * after an overflow the values wrap around at 64 bits.
+ * sum is the value of the finished terms
+ * term is the value of the current term
+ * pending is the operator that adds term to sum
+ * error is set when an operation or a literal overflows
+ */
+typedef struct {
+    VALUE sum;
+    VALUE term;
+    char pending;
+    BOOLEAN error;
+} CHAIN;
+
+/**
+ * nextRandom function
+ * xorshift64* generator, same seed gives the same corpus on every platform
+ * @param state is the pointer to generator state
+ * @return next random number
+ */
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+
+/**
+ * seedCorpus function
+ * Creates a generator state from a seed
+ * @param seed is the seed of the corpus
+ * @return initial generator state
+ */
+uint64_t seedCorpus(unsigned long seed) {
+    // State of xorshift must not be zero
+    return ((uint64_t) seed * 0x9E3779B97F4A7C15ULL) ^ 0xD1B54A32D192ED03ULL;
+}
+
+
+
+/**
+ * validCorpusShape function
+ * Checks the limits of the shape
+ * @param shape is the pointer to shape
+ * @return TRUE if expressions can be generated with the shape else FALSE
+ */
+BOOLEAN validCorpusShape(const CORPUS_SHAPE *shape) {
+    const char *p;
+
+    if ((shape->depth < 0) || (shape->width < 1) || (shape->literalLength < 1) || (shape->negation < 0))
+        return FALSE;
+    // Every nesting level needs an operand beside the parentheses
+    if ((shape->depth > 0) && (shape->width < 2))
+        return FALSE;
+    if ((shape->operators == NULL) || (shape->operators[0] == '\0'))
+        return FALSE;
+    for (p = shape->operators; *p != '\0'; p++) {
+        if ((*p != '+') && (*p != '-') && (*p != '*') && (*p != '/'))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+/**
+ * corpusExpressionSize function
+ * Finds the buffer size needed by one expression of the shape
+ * @param shape is the pointer to shape
+ * @return size in bytes including the NUL terminator
+ */
+size_t corpusExpressionSize(const CORPUS_SHAPE *shape) {
+    // Every operand is a literal with an operator and two spaces, every level adds two parentheses,
+    // with negation every operand and level has room for two minus signs
+    size_t signs = (shape->negation > 0) ? 2 : 0;
+    return (size_t) (shape->depth + 1) * shape->width * (shape->literalLength + 3 + signs) +
+           (2 + signs) * shape->depth + 1;
+}
+
+
+
+/**
+ * appendOperand function
+ * Applies an operator and its right operand to the chain.
+ * Operators that would divide by zero or overflow the division
+ * are changed to multiplication, so division never sets the error.
+ * @param c is the pointer to chain
+ * @param op is the operator
+ * @param value is the right operand
+ * @return operator that is applied
+ */
+static char appendOperand(CHAIN *c, char op, VALUE value) {
+    if ((op == '/') && ((value == 0) || ((c->term == INT64_MIN) && (value == -1))))
+        op = '*';
+    switch (op) {
+        case '*':
+            c->error |= __builtin_mul_overflow(c->term, value, &c->term);
+            break;
+        case '/':
+            c->term = c->term / value;
+            break;
+        default:
+            if (c->pending == '+')
+                c->error |= __builtin_add_overflow(c->sum, c->term, &c->sum);
+            else
+                c->error |= __builtin_sub_overflow(c->sum, c->term, &c->sum);
+            c->pending = op;
+            c->term = value;
+            break;
+    }
+    return op;
+}
+
+
+
+/**
+ * finishChain function
+ * Applies the last term to the sum
+ * @param c is the pointer to chain
+ * @return value of the chain
+ */
+static VALUE finishChain(CHAIN *c) {
+    appendOperand(c, '+', 0);
+    return c->sum;
+}
+
+
+
+/**
+ * chooseNegation function
+ * Decides how many unary minus signs an operand gets
+ * @param shape is the pointer to shape
+ * @param state is the pointer to generator state
+ * @return number of minus signs, 0, 1 or 2
+ */
+static int chooseNegation(const CORPUS_SHAPE *shape, uint64_t *state) {
+    uint64_t r;
+
+    // Shapes without negation draw no numbers, so their corpora do not change
+    if (shape->negation == 0)
+        return 0;
+    r = nextRandom(state);
+    if (r % shape->negation != 0)
+        return 0;
+    return ((r >> 32) % 4 == 0) ? 2 : 1;
+}
+
+
+
+/**
+ * negateOperand function
+ * Applies unary minus signs to an operand the way the evaluator does.
+ * A minus in front of a literal is folded into it, the literal is at most INT64_MAX when it is valid,
+ * so only the negation of a parenthesized level can overflow.
+ * @param value is the value of the operand
+ * @param signs is the number of minus signs
+ * @param level is TRUE for a parenthesized level and FALSE for a literal
+ * @param error is the pointer to flag set when checked negation overflows
+ * @return negated value, wrapped at 64 bits
+ */
+static VALUE negateOperand(VALUE value, int signs, BOOLEAN level, BOOLEAN *error) {
+    if ((signs > 0) && level && (value == INT64_MIN))
+        *error = TRUE;
+    return (signs == 1) ? (VALUE) (0 - (uint64_t) value) : value;
+}
+
+
+
+/**
+ * writeLiteral function
+ * Writes a random literal, the first digit is never zero
+ * @param shape is the pointer to shape
+ * @param state is the pointer to generator state
+ * @param p is the output position
+ * @param value is the pointer to value of the literal, wrapped at 64 bits
+ * @param error is the pointer to flag set when the literal does not fit in VALUE
+ * @return output position after the literal
+ */
+static char *writeLiteral(const CORPUS_SHAPE *shape, uint64_t *state, char *p, VALUE *value, BOOLEAN *error) {
+    uint64_t v = 0;
+    BOOLEAN wide = FALSE;
+    int digit;
+    int i;
+
+    for (i = 0; i < shape->literalLength; i++) {
+        digit = (int) (nextRandom(state) % ((i == 0) ? 9 : 10)) + ((i == 0) ? 1 : 0);
+        *p++ = (char) ('0' + digit);
+        wide |= __builtin_mul_overflow(v, 10u, &v);
+        wide |= __builtin_add_overflow(v, (uint64_t) digit, &v);
+    }
+    *error |= wide | (v > (uint64_t) INT64_MAX);
+    *value = (VALUE) v;
+    return p;
+}
+
+
+
+/**
+ * writeSignedLiteral function
+ * Writes a random literal with the unary minus signs chosen for it
+ * @param shape is the pointer to shape
+ * @param state is the pointer to generator state
+ * @param p is the output position
+ * @param value is the pointer to value of the negated literal, wrapped at 64 bits
+ * @param error is the pointer to flag set when the literal does not fit in VALUE
+ * @return output position after the literal
+ */
+static char *writeSignedLiteral(const CORPUS_SHAPE *shape, uint64_t *state, char *p, VALUE *value,
+                                BOOLEAN *error) {
+    int signs = chooseNegation(shape, state);
+
+    memset(p, '-', signs);
+    p = writeLiteral(shape, state, p + signs, value, error);
+    *value = negateOperand(*value, signs, FALSE, error);
+    return p;
+}
+
+
+
+/**
+ * writeOperand function
+ * Writes an operator and a random literal operand and applies them to the chain
+ * @param shape is the pointer to shape
+ * @param state is the pointer to generator state
+ * @param c is the pointer to chain
+ * @param p is the output position
+ * @return output position after the operand
+ */
+static char *writeOperand(const CORPUS_SHAPE *shape, uint64_t *state, CHAIN *c, char *p) {
+    size_t mix = strlen(shape->operators);
+    char op = shape->operators[nextRandom(state) % mix];
+    char *opPosition = p + 1;
+    VALUE value;
+
+    memcpy(p, " ? ", 3);
+    p = writeSignedLiteral(shape, state, p + 3, &value, &c->error);
+    // Operator is decided when the operand is known
+    *opPosition = appendOperand(c, op, value);
+    return p;
+}
+
+
+
+/**
+ * generateExpression function
+ * Generates one expression of the shape and its expected result.
+ * Innermost level is written first after the opening parentheses,
+ * every outer level continues with the value of the inner one as its first operand,
+ * so the expression is generated without recursion. With negation every opening parenthesis
+ * has two characters before it, they are filled with spaces or minus signs when its level is closed.
+ * @param shape is the pointer to valid shape
+ * @param state is the pointer to generator state
+ * @param buffer is the output, it must hold corpusExpressionSize bytes
+ * @param expected is the pointer to expected result
+ * @param error is the pointer to flag set when checked evaluation of the expression fails
+ * @return length of the expression
+ */
+size_t generateExpression(const CORPUS_SHAPE *shape, uint64_t *state, char *buffer, VALUE *expected,
+                          BOOLEAN *error) {
+    char *p = buffer;
+    char *open;
+    CHAIN c;
+    VALUE value;
+    int slot = (shape->negation > 0) ? 3 : 1;
+    int level, i, signs;
+
+    for (i = 0; i < shape->depth; i++) {
+        memset(p, ' ', slot - 1);
+        p[slot - 1] = '(';
+        p += slot;
+    }
+
+    c.sum = 0;
+    c.pending = '+';
+    c.error = FALSE;
+    p = writeSignedLiteral(shape, state, p, &c.term, &c.error);
+    for (i = 1; i < shape->width; i++)
+        p = writeOperand(shape, state, &c, p);
+
+    for (level = 0; level < shape->depth; level++) {
+        value = finishChain(&c);
+        *p++ = ')';
+        // Level is closed by the innermost parenthesis that is still open
+        signs = chooseNegation(shape, state);
+        open = buffer + (size_t) (shape->depth - 1 - level) * slot;
+        memset(open + slot - 1 - signs, '-', signs);
+        c.sum = 0;
+        c.pending = '+';
+        c.term = negateOperand(value, signs, TRUE, &c.error);
+        for (i = 1; i < shape->width; i++)
+            p = writeOperand(shape, state, &c, p);
+    }
+
+    *p = '\0';
+    *expected = finishChain(&c);
+    *error = c.error;
+    return (size_t) (p - buffer);
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef EXPEVAL_CORPUS_H
+#define EXPEVAL_CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stack.h"
+
+/*
+ * Shape of generated expressions.
+ * depth is the number of nested parentheses
+ * width is the number of operands on every nesting level
+ * literalLength is the number of digits of every literal
+ * operators is the operator mix, every character is picked with equal probability,
+ * so "++*" gives twice as many additions as multiplications. Only + - * / are allowed.
+ * negation is the rate of unary minus, one in negation operands and parenthesized levels is negated,
+ * a quarter of them with two minus signs. 0 writes no unary minus.
+ *
+ * Example with depth 2 and width 3:
+ *      ((41 * 7 - 3) / 9 + 15) - 2 * 8
+ * and with negation:
+ *      --((41 * -7 - 3) / 9 + 15) - 2 * --8
+ */
+typedef struct {
+    int depth;
+    int width;
+    int literalLength;
+    const char *operators;
+    int negation;
+} CORPUS_SHAPE;
+
+// Function prototypes
+uint64_t seedCorpus(unsigned long seed);
+
+BOOLEAN validCorpusShape(const CORPUS_SHAPE *shape);
+
+size_t corpusExpressionSize(const CORPUS_SHAPE *shape);
+
+size_t generateExpression(const CORPUS_SHAPE *shape, uint64_t *state, char *buffer, VALUE *expected,
+                          BOOLEAN *error);
+
+#endif //EXPEVAL_CORPUS_H
\ No newline at end of file
@@ -0,0 +1,121 @@
+/**
+ * Stress corpus generator.
+ *
+ * Writes reproducible expression sets, one expression per line, and their expected
+ * results to a separate file in the format of the batch mode output with checked
+ * arithmetic, so a corpus can be checked with:
+ *      expEval -b corpus.txt | cmp - expected.txt
+ *
+ * Usage:
+ *      expEval_corpus [-s seed] [-n count | -S bytes] [-d depth] [-w width]
+ *                     [-l literal digits] [-m operator mix] [-u negation] [-e expected file] [output file]
+ *
+ * Defaults: seed 1, 1000 expressions, depth 2, width 4, 3 digit literals, mix "+-*\/", no unary minus.
+ * -u 4 negates one in four operands and parenthesized levels, so -V checks unary minus as well.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "corpus.h"
+
+/**
+ * Entry point of the corpus generator.
+ * @param argc is the count of the argument entered
+ * @param argv is the argument vector
+ * @return 0 if successful termination else non-zero
+ */
+int main(int argc, char *argv[]) {
+    CORPUS_SHAPE shape = {2, 4, 3, "+-*/", 0};
+    unsigned long seed = 1;
+    long count = 1000;
+    long long totalSize = -1;
+    long long written = 0;
+    const char *expectedPath = NULL;
+    FILE *out = stdout;
+    FILE *expectedOut = NULL;
+    uint64_t state;
+    char *buffer;
+    size_t len;
+    VALUE expected;
+    BOOLEAN error;
+    int option;
+    long i;
+
+    while ((option = getopt(argc, argv, "s:n:S:d:w:l:m:u:e:")) != -1) {
+        switch (option) {
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'S':
+                totalSize = atoll(optarg);
+                break;
+            case 'd':
+                shape.depth = atoi(optarg);
+                break;
+            case 'w':
+                shape.width = atoi(optarg);
+                break;
+            case 'l':
+                shape.literalLength = atoi(optarg);
+                break;
+            case 'm':
+                shape.operators = optarg;
+                break;
+            case 'u':
+                shape.negation = atoi(optarg);
+                break;
+            case 'e':
+                expectedPath = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s seed] [-n count | -S bytes] [-d depth] [-w width] "
+                                "[-l literal digits] [-m operator mix] [-u negation] [-e expected file] [output file]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!validCorpusShape(&shape)) {
+        fprintf(stderr, "Error: Invalid shape, width must be at least 2 when depth is used "
+                        "the mix may only contain + - * / and negation must not be negative\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((optind < argc) && (strcmp(argv[optind], "-") != 0))
+        out = fopen(argv[optind], "w");
+    if (expectedPath != NULL)
+        expectedOut = fopen(expectedPath, "w");
+    if ((out == NULL) || ((expectedPath != NULL) && (expectedOut == NULL))) {
+        perror("Output file could not opened");
+        exit(EXIT_FAILURE);
+    }
+    buffer = (char *) malloc(corpusExpressionSize(&shape));
+    if (buffer == NULL) {
+        perror("Memory could not allocated");
+        exit(EXIT_FAILURE);
+    }
+
+    // Total size, when given, decides the number of expressions
+    state = seedCorpus(seed);
+    for (i = 0; (totalSize >= 0) ? (written < totalSize) : (i < count); i++) {
+        len = generateExpression(&shape, &state, buffer, &expected, &error);
+        buffer[len] = '\n';
+        fwrite(buffer, 1, len + 1, out);
+        written += (long long) len + 1;
+        if ((expectedOut != NULL) && error)
+            fputs("error\n", expectedOut);
+        else if (expectedOut != NULL)
+            fprintf(expectedOut, "%" PRId64 "\n", expected);
+    }
+
+    free(buffer);
+    if (out != stdout)
+        fclose(out);
+    if (expectedOut != NULL)
+        fclose(expectedOut);
+    return 0;
+}
\ No newline at end of file
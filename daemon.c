@@ -0,0 +1,546 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "arena.h"
+#include "batch.h"
+#include "cache.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Kernels older than 4.5 wake every worker for a new connection, accept sorts it out
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
+/*
+ * Client connection, owned by the worker that accepted it.
+ * input holds received bytes that do not make a whole request yet.
+ * pending holds reply bytes the socket did not take, they are sent before any new reply.
+ * blocked is set when reading stopped because too many replies are pending,
+ * eof is set when the client closed its side, the connection is closed when pending is sent.
+ * Connections of a worker are kept in a doubly linked list to close them at shutdown.
+ */
+typedef struct CONNECTION {
+    int fd;
+    char *input;
+    size_t inputLength;
+    size_t inputCapacity;
+    char *pending;
+    size_t pendingLength;
+    size_t pendingCapacity;
+    BOOLEAN blocked;
+    BOOLEAN eof;
+    struct CONNECTION *prev;
+    struct CONNECTION *next;
+} CONNECTION;
+
+/*
+ * Reply waiting to be sent, header is the little endian length of text.
+ */
+typedef struct {
+    unsigned char header[DAEMON_HEADER_SIZE];
+    char text[DAEMON_REPLY_TEXT_SIZE];
+    int length;
+} REPLY;
+
+/*
+ * Worker thread state.
+ * Every worker has its own epoll instance, its evaluator context and an arena owning its stacks,
+ * so the stacks stay warm between requests and workers share nothing but the cache.
+ * listener and stop are registered in the epoll instance of every worker,
+ * their addresses tell them apart from connections in epoll events.
+ */
+typedef struct {
+    EVALUATOR evaluator;
+    ARENA arena;
+    pthread_t thread;
+    int epoll;
+    int listener;
+    int stop;
+    CONNECTION *connections;
+    REPLY replies[DAEMON_REPLY_COUNT];
+    struct iovec iov[2 * DAEMON_REPLY_COUNT];
+} __attribute__((aligned(CACHE_LINE_SIZE))) DAEMON_WORKER;
+
+
+
+/**
+ * readLength function
+ * @param p is the start of a request header
+ * @return length of the request
+ */
+static uint32_t readLength(const unsigned char *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+
+/**
+ * reserveBytes function
+ * Grows a connection buffer so it can hold count more bytes
+ * @param buffer is the pointer to buffer pointer, updated when the buffer moves
+ * @param length is the number of bytes in use
+ * @param capacity is the pointer to size of the buffer
+ * @param count is the number of bytes to be appended
+ * @return TRUE if the buffer has room else FALSE
+ */
+static BOOLEAN reserveBytes(char **buffer, size_t length, size_t *capacity, size_t count) {
+    size_t size = (*capacity > 0) ? *capacity : DAEMON_READ_SIZE;
+    char *tmp;
+
+    if (*capacity - length >= count)
+        return TRUE;
+    while (size - length < count)
+        size *= 2;
+    tmp = (char *) realloc(*buffer, size);
+    if (tmp == NULL)
+        return FALSE;
+    *buffer = tmp;
+    *capacity = size;
+    return TRUE;
+}
+
+
+
+/**
+ * closeConnection function
+ * Closes the socket, removes the connection from the list of the worker and frees it
+ * @param w is the pointer to worker
+ * @param c is the pointer to connection
+ */
+static void closeConnection(DAEMON_WORKER *w, CONNECTION *c) {
+    close(c->fd);
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        w->connections = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    free(c->input);
+    free(c->pending);
+    free(c);
+}
+
+
+
+/**
+ * flushPending function
+ * Sends the reply bytes that are waiting in the connection
+ * @param c is the pointer to connection
+ * @return FALSE if the connection failed else TRUE, also when the socket is full
+ */
+static BOOLEAN flushPending(CONNECTION *c) {
+    size_t sent = 0;
+    ssize_t n;
+
+    while (sent < c->pendingLength) {
+        n = write(c->fd, c->pending + sent, c->pendingLength - sent);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+            return FALSE;
+        }
+        sent += (size_t) n;
+    }
+    memmove(c->pending, c->pending + sent, c->pendingLength - sent);
+    c->pendingLength -= sent;
+    return TRUE;
+}
+
+
+
+/**
+ * sendReplies function
+ * Sends a group of replies with one writev. Bytes the socket does not take
+ * are kept in the pending buffer and sent when the socket is writable again.
+ * Replies always go after the pending bytes, so their order is kept.
+ * @param w is the pointer to worker holding the replies and their iovecs
+ * @param c is the pointer to connection
+ * @param count is the number of replies
+ * @return FALSE if the connection failed else TRUE
+ */
+static BOOLEAN sendReplies(DAEMON_WORKER *w, CONNECTION *c, int count) {
+    struct iovec *iov = w->iov;
+    ssize_t n = 0;
+    size_t skip;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        iov[2 * i].iov_base = w->replies[i].header;
+        iov[2 * i].iov_len = DAEMON_HEADER_SIZE;
+        iov[2 * i + 1].iov_base = w->replies[i].text;
+        iov[2 * i + 1].iov_len = (size_t) w->replies[i].length;
+    }
+    if (c->pendingLength == 0) {
+        do {
+            n = writev(c->fd, iov, 2 * count);
+        } while ((n < 0) && (errno == EINTR));
+        if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+            return FALSE;
+        if (n < 0)
+            n = 0;
+    }
+
+    // Unsent part is copied after the pending bytes
+    skip = (size_t) n;
+    for (i = 0; i < 2 * count; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        if (!reserveBytes(&c->pending, c->pendingLength, &c->pendingCapacity, iov[i].iov_len - skip))
+            return FALSE;
+        memcpy(c->pending + c->pendingLength, (char *) iov[i].iov_base + skip, iov[i].iov_len - skip);
+        c->pendingLength += iov[i].iov_len - skip;
+        skip = 0;
+    }
+    return TRUE;
+}
+
+
+
+/**
+ * evaluateRequest function
+ * Evaluates one request into a reply, through the expression cache when the evaluator has one
+ * @param e is the pointer to evaluator context of the worker
+ * @param exp is the start of the expression
+ * @param len is the length of the expression
+ * @param reply is the pointer to reply to be filled
+ */
+static void evaluateRequest(EVALUATOR *e, const char *exp, size_t len, REPLY *reply) {
+    VALUE result;
+
+    if (e->cache != NULL)
+        result = cachedEvaluate(e->cache, exp, len, e);
+    else
+        result = evaluateBuffer(exp, len, e);
+    if (e->error)
+        reply->length = snprintf(reply->text, DAEMON_REPLY_TEXT_SIZE, "error");
+    else
+        reply->length = snprintf(reply->text, DAEMON_REPLY_TEXT_SIZE, "%" PRId64, result);
+    reply->header[0] = (unsigned char) reply->length;
+    reply->header[1] = 0;
+    reply->header[2] = 0;
+    reply->header[3] = 0;
+}
+
+
+
+/**
+ * processRequests function
+ * Evaluates every whole request in the receive buffer and sends the replies
+ * in groups of DAEMON_REPLY_COUNT. A partial request is moved to the start of the buffer.
+ * @param w is the pointer to worker
+ * @param c is the pointer to connection
+ * @return FALSE if the connection failed or sent a too long request else TRUE
+ */
+static BOOLEAN processRequests(DAEMON_WORKER *w, CONNECTION *c) {
+    size_t used = 0;
+    uint32_t len;
+    int count = 0;
+
+    while (c->inputLength - used >= DAEMON_HEADER_SIZE) {
+        len = readLength((const unsigned char *) c->input + used);
+        if (len > DAEMON_MAX_REQUEST_SIZE)
+            return FALSE;
+        if (c->inputLength - used - DAEMON_HEADER_SIZE < len)
+            break;
+        evaluateRequest(&w->evaluator, c->input + used + DAEMON_HEADER_SIZE, len, &w->replies[count]);
+        used += DAEMON_HEADER_SIZE + len;
+        if ((++count == DAEMON_REPLY_COUNT) && !sendReplies(w, c, count))
+            return FALSE;
+        count %= DAEMON_REPLY_COUNT;
+    }
+    if ((count > 0) && !sendReplies(w, c, count))
+        return FALSE;
+    memmove(c->input, c->input + used, c->inputLength - used);
+    c->inputLength -= used;
+    return TRUE;
+}
+
+
+
+/**
+ * handleInput function
+ * Reads until the socket is drained, as edge triggered epoll requires, and evaluates the requests.
+ * Reading pauses while the client does not read its replies and resumes when they are sent.
+ * @param w is the pointer to worker
+ * @param c is the pointer to connection
+ * @return FALSE if the connection must be closed else TRUE
+ */
+static BOOLEAN handleInput(DAEMON_WORKER *w, CONNECTION *c) {
+    ssize_t n;
+
+    c->blocked = FALSE;
+    while (!c->eof) {
+        if (c->pendingLength > DAEMON_MAX_PENDING) {
+            c->blocked = TRUE;
+            return TRUE;
+        }
+        if (!reserveBytes(&c->input, c->inputLength, &c->inputCapacity, DAEMON_READ_SIZE))
+            return FALSE;
+        n = read(c->fd, c->input + c->inputLength, c->inputCapacity - c->inputLength);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? TRUE : FALSE;
+        }
+        if (n == 0)
+            c->eof = TRUE;
+        c->inputLength += (size_t) n;
+        if (!processRequests(w, c))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+/**
+ * acceptConnections function
+ * Accepts every waiting connection and registers it edge triggered in the epoll instance of the worker.
+ * Other workers woken for the same connection get EAGAIN.
+ * @param w is the pointer to worker
+ */
+static void acceptConnections(DAEMON_WORKER *w) {
+    struct epoll_event event;
+    CONNECTION *c;
+    int fd;
+
+    while ((fd = accept4(w->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        c = (CONNECTION *) calloc(1, sizeof(CONNECTION));
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->next = w->connections;
+        if (c->next != NULL)
+            c->next->prev = c;
+        w->connections = c;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = c;
+        if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+            closeConnection(w, c);
+    }
+}
+
+
+
+/**
+ * daemonWorkerMain function
+ * Event loop of a worker, it serves its connections until the stop event
+ * @param arg is the pointer to worker
+ * @return NULL
+ */
+static void *daemonWorkerMain(void *arg) {
+    DAEMON_WORKER *w = (DAEMON_WORKER *) arg;
+    struct epoll_event events[DAEMON_EVENT_COUNT];
+    CONNECTION *c;
+    BOOLEAN ok;
+    int i, n;
+
+    for (;;) {
+        n = epoll_wait(w->epoll, events, DAEMON_EVENT_COUNT, -1);
+        if ((n < 0) && (errno != EINTR))
+            break;
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == &w->stop)
+                return NULL;
+            if (events[i].data.ptr == &w->listener) {
+                acceptConnections(w);
+                continue;
+            }
+            c = (CONNECTION *) events[i].data.ptr;
+            ok = !(events[i].events & EPOLLERR);
+            if (ok && (events[i].events & EPOLLOUT))
+                ok = flushPending(c) && (!c->blocked || (c->pendingLength > DAEMON_MAX_PENDING) ||
+                                         handleInput(w, c));
+            if (ok && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)))
+                ok = handleInput(w, c);
+            if (!ok || (c->eof && (c->pendingLength == 0)))
+                closeConnection(w, c);
+        }
+    }
+    return NULL;
+}
+
+
+
+/**
+ * openListener function
+ * Creates the listening socket. A stale socket file left by a previous daemon is removed,
+ * other files are never replaced.
+ * @param path is the path of the socket
+ * @return socket descriptor, -1 on error with errno set
+ */
+static int openListener(const char *path) {
+    struct sockaddr_un address;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if ((bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0) || (listen(fd, DAEMON_BACKLOG) != 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+
+
+/**
+ * initDaemonWorker function
+ * Creates the evaluator, the arena and the epoll instance of a worker
+ * @param w is the pointer to worker
+ * @param listener is the listening socket
+ * @param stop is the event descriptor signalled at shutdown
+ * @param e is the pointer to evaluator whose settings are copied
+ * @return TRUE if the worker is ready else FALSE, nothing is left allocated on failure
+ */
+static BOOLEAN initDaemonWorker(DAEMON_WORKER *w, int listener, int stop, const EVALUATOR *e) {
+    struct epoll_event event;
+
+    if (!initArena(&w->arena, WORKER_ARENA_SIZE, FALSE))
+        return FALSE;
+    initEvaluatorArena(&w->evaluator, &w->arena);
+    w->evaluator.checked = e->checked;
+    w->evaluator.cache = e->cache;
+    w->listener = listener;
+    w->stop = stop;
+    w->connections = NULL;
+    w->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epoll < 0) {
+        deleteEvaluator(&w->evaluator);
+        deleteArena(&w->arena);
+        return FALSE;
+    }
+
+    // Only one worker is woken for a new connection
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = &w->listener;
+    if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, listener, &event) == 0) {
+        event.events = EPOLLIN;
+        event.data.ptr = &w->stop;
+        if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, stop, &event) == 0)
+            return TRUE;
+    }
+    close(w->epoll);
+    deleteEvaluator(&w->evaluator);
+    deleteArena(&w->arena);
+    return FALSE;
+}
+
+
+
+/**
+ * deleteDaemonWorker function
+ * Closes the connections of a stopped worker and frees its memory
+ * @param w is the pointer to worker
+ */
+static void deleteDaemonWorker(DAEMON_WORKER *w) {
+    while (w->connections != NULL)
+        closeConnection(w, w->connections);
+    close(w->epoll);
+    deleteEvaluator(&w->evaluator);
+    deleteArena(&w->arena);
+}
+
+
+
+/**
+ * runDaemon function
+ * Daemon mode. Listens on a Unix domain socket and evaluates the requests of many clients
+ * on a pool of workers until SIGINT or SIGTERM. The calling thread only waits for the signal.
+ * @param path is the path of the socket, it is removed at shutdown
+ * @param workerCount is the number of worker threads
+ * @param e is the pointer to evaluator whose arithmetic and cache are used by every worker
+ * @return 0 after a clean shutdown, -1 if the daemon could not be started with errno set
+ */
+int runDaemon(const char *path, int workerCount, const EVALUATOR *e) {
+    DAEMON_WORKER *workers;
+    sigset_t signals, previous;
+    uint64_t one = 1;
+    int listener, stop, started = 0, saved, received, i;
+    BOOLEAN ok;
+
+    if (workerCount < 1)
+        workerCount = 1;
+    if (workerCount > MAX_DAEMON_WORKERS)
+        workerCount = MAX_DAEMON_WORKERS;
+
+    // Workers inherit the mask, shutdown signals are taken only by sigwait below
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = openListener(path);
+    stop = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    workers = (DAEMON_WORKER *) aligned_alloc(CACHE_LINE_SIZE, workerCount * sizeof(DAEMON_WORKER));
+    ok = (listener >= 0) && (stop >= 0) && (workers != NULL);
+    while (ok && (started < workerCount)) {
+        if (!initDaemonWorker(&workers[started], listener, stop, e))
+            break;
+        if (pthread_create(&workers[started].thread, NULL, daemonWorkerMain, &workers[started]) != 0) {
+            deleteDaemonWorker(&workers[started]);
+            break;
+        }
+        started++;
+    }
+    saved = errno;
+
+    // Daemon runs with the workers that could be started
+    if (started > 0) {
+        while (sigwait(&signals, &received) != 0)
+            continue;
+        if (write(stop, &one, sizeof(one)) != sizeof(one))
+            saved = errno;
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        deleteDaemonWorker(&workers[i]);
+    }
+
+    free(workers);
+    if (stop >= 0)
+        close(stop);
+    if (listener >= 0) {
+        close(listener);
+        unlink(path);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (started == 0) {
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
\ No newline at end of file
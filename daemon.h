@@ -0,0 +1,31 @@
+#ifndef EXPEVAL_DAEMON_H
+#define EXPEVAL_DAEMON_H
+
+#include <stdint.h>
+#include "stack.h"
+
+/*
+ * Evaluation daemon protocol over a Unix domain stream socket.
+ * A request is a 4 byte little endian length followed by that many bytes of expression.
+ * A reply is a 4 byte little endian length followed by the result as text,
+ * the same text batch mode prints without the newline, for example "53" or "error".
+ * Requests can be pipelined, replies of a connection are sent in request order.
+ */
+#define DAEMON_HEADER_SIZE 4
+// Longer requests close the connection
+#define DAEMON_MAX_REQUEST_SIZE (1024 * 1024)
+// Receive buffer of a connection starts with this size and grows up to a whole request
+#define DAEMON_READ_SIZE (16 * 1024)
+// Reading stops while this many reply bytes wait for the client to read them
+#define DAEMON_MAX_PENDING (256 * 1024)
+// Replies sent by one writev, every reply takes two iovecs
+#define DAEMON_REPLY_COUNT 64
+#define DAEMON_REPLY_TEXT_SIZE 24
+#define DAEMON_EVENT_COUNT 64
+#define DAEMON_BACKLOG 512
+#define MAX_DAEMON_WORKERS 256
+
+// Function prototypes
+int runDaemon(const char *path, int workerCount, const EVALUATOR *e);
+
+#endif //EXPEVAL_DAEMON_H
\ No newline at end of file
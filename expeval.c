@@ -0,0 +1,337 @@
+#include "expeval.h"
+#include "stack.h"
+#include "program.h"
+#include "optimize.h"
+#include "jit.h"
+#include "metrics.h"
+#include <stdlib.h>
+
+/*
+ * Context of the library, the evaluator with heap stacks.
+ * checked is fixed when the context is created, compiled programs are prepared for it.
+ */
+struct EXPEVAL_CONTEXT {
+    EVALUATOR evaluator;
+    int flags;
+};
+
+/*
+ * Compiled program of the library.
+ * jit.function is NULL when the program is interpreted.
+ * checked is the arithmetic the program is compiled for.
+ */
+struct EXPEVAL_PROGRAM {
+    PROGRAM program;
+    JIT_PROGRAM jit;
+    BOOLEAN checked;
+};
+
+// Messages of the status codes, indexed by EXPEVAL_STATUS
+static const char *const STATUS_STRINGS[] = {
+        "success",
+        "arithmetic overflow or division by zero",
+        "invalid character",
+        "invalid expression",
+        "memory could not allocated",
+        "invalid argument",
+        "file could not written"
+};
+
+
+
+/**
+ * expevalCreateContext function
+ * Creates an evaluation context, stacks are allocated once and reused by every call
+ * @param flags is a combination of EXPEVAL_WRAPPING, EXPEVAL_OPTIMIZE and EXPEVAL_JIT
+ * @return pointer to the context, NULL if memory could not allocated
+ */
+EXPEVAL_CONTEXT *expevalCreateContext(int flags) {
+    EXPEVAL_CONTEXT *context = (EXPEVAL_CONTEXT *) malloc(sizeof(EXPEVAL_CONTEXT));
+
+    if (context == NULL)
+        return NULL;
+    initEvaluator(&context->evaluator);
+    if ((context->evaluator.operand.item == NULL) || (context->evaluator.operator.item == NULL)) {
+        deleteEvaluator(&context->evaluator);
+        free(context);
+        return NULL;
+    }
+    context->evaluator.checked = (flags & EXPEVAL_WRAPPING) ? FALSE : TRUE;
+    context->flags = flags;
+    return context;
+}
+
+
+
+/**
+ * expevalDeleteContext function
+ * Frees the context and its stacks
+ * @param context is the pointer to context, NULL is ignored
+ */
+void expevalDeleteContext(EXPEVAL_CONTEXT *context) {
+    if (context == NULL)
+        return;
+    deleteEvaluator(&context->evaluator);
+    free(context);
+}
+
+
+
+/**
+ * statusOf function
+ * Converts the status of the evaluator to a status code
+ * @param e is the pointer to evaluator
+ * @return status of the last evaluation
+ */
+static int statusOf(const EVALUATOR *e) {
+    switch (e->status) {
+        case EVAL_OK:
+            return EXPEVAL_OK;
+        case EVAL_OVERFLOW:
+        case EVAL_DIVISION_BY_ZERO:
+            return EXPEVAL_ARITHMETIC_ERROR;
+        case EVAL_INVALID_CHARACTER:
+            return EXPEVAL_INVALID_CHARACTER;
+        case EVAL_NO_MEMORY:
+            return EXPEVAL_NO_MEMORY;
+        default:
+            return EXPEVAL_INVALID_EXPRESSION;
+    }
+}
+
+
+
+/**
+ * expevalEvaluate function
+ * Evaluates an expression, it does not need a NUL terminator
+ * @param context is the pointer to context
+ * @param exp is the start of the expression
+ * @param len is the length of the expression in bytes
+ * @param result is the pointer to result, it is written only when EXPEVAL_OK is returned
+ * @return EXPEVAL_OK or the reason the expression has no result
+ */
+int expevalEvaluate(EXPEVAL_CONTEXT *context, const char *exp, size_t len, int64_t *result) {
+    VALUE value;
+    int status;
+
+    if ((context == NULL) || (exp == NULL) || (result == NULL))
+        return EXPEVAL_INVALID_ARGUMENT;
+    value = evaluateBuffer(exp, len, &context->evaluator);
+    status = statusOf(&context->evaluator);
+    if (status == EXPEVAL_OK)
+        *result = value;
+    return status;
+}
+
+
+
+/**
+ * expevalBegin function
+ * Starts a streamed expression
+ * @param context is the pointer to context
+ * @return EXPEVAL_OK or EXPEVAL_INVALID_ARGUMENT
+ */
+int expevalBegin(EXPEVAL_CONTEXT *context) {
+    if (context == NULL)
+        return EXPEVAL_INVALID_ARGUMENT;
+    beginEvaluation(&context->evaluator);
+    return EXPEVAL_OK;
+}
+
+
+
+/**
+ * expevalFeed function
+ * Evaluates the next part of a streamed expression.
+ * Arithmetic errors are reported by expevalEnd, because a later part can not undo them.
+ * @param context is the pointer to context
+ * @param part is the start of the part
+ * @param len is the length of the part in bytes
+ * @return EXPEVAL_OK, or EXPEVAL_INVALID_CHARACTER when the expression can not be completed
+ */
+int expevalFeed(EXPEVAL_CONTEXT *context, const char *part, size_t len) {
+    if ((context == NULL) || ((part == NULL) && (len > 0)))
+        return EXPEVAL_INVALID_ARGUMENT;
+    return feedEvaluation(part, len, &context->evaluator) ? EXPEVAL_OK : EXPEVAL_INVALID_CHARACTER;
+}
+
+
+
+/**
+ * expevalEnd function
+ * Ends a streamed expression
+ * @param context is the pointer to context
+ * @param result is the pointer to result, it is written only when EXPEVAL_OK is returned
+ * @return EXPEVAL_OK or the reason the expression has no result
+ */
+int expevalEnd(EXPEVAL_CONTEXT *context, int64_t *result) {
+    VALUE value;
+    int status;
+
+    if ((context == NULL) || (result == NULL))
+        return EXPEVAL_INVALID_ARGUMENT;
+    value = endEvaluation(&context->evaluator);
+    status = statusOf(&context->evaluator);
+    if (status == EXPEVAL_OK)
+        *result = value;
+    return status;
+}
+
+
+
+/**
+ * expevalErrorOffset function
+ * Finds where the last expression evaluated by expevalEvaluate or streamed to expevalEnd failed
+ * @param context is the pointer to context
+ * @return byte offset of the first error from the start of the expression, its length when the error
+ * was found after the last character, 0 when the expression has a result
+ */
+size_t expevalErrorOffset(const EXPEVAL_CONTEXT *context) {
+    if (context == NULL)
+        return 0;
+    return context->evaluator.errorOffset;
+}
+
+
+
+/**
+ * expevalCompile function
+ * Compiles an expression with $1, $2, ... placeholders or named parameters.
+ * The program is prepared for the arithmetic of the context, it is optimized
+ * and translated to machine code when the context flags ask for it.
+ * @param context is the pointer to context
+ * @param exp is the NUL terminated expression
+ * @param names is the array of parameter names, names[k] is bound to $k+1, NULL when there are none
+ * @param nameCount is the number of names
+ * @param program is the pointer to the new program, it is written only when EXPEVAL_OK is returned
+ * @return EXPEVAL_OK or the reason the expression is not compiled
+ */
+int expevalCompile(EXPEVAL_CONTEXT *context, const char *exp, const char *const *names, int nameCount,
+                   EXPEVAL_PROGRAM **program) {
+    EXPEVAL_PROGRAM *p;
+
+    if ((context == NULL) || (exp == NULL) || (program == NULL) || (nameCount < 0) ||
+        ((names == NULL) && (nameCount > 0)))
+        return EXPEVAL_INVALID_ARGUMENT;
+    p = (EXPEVAL_PROGRAM *) malloc(sizeof(EXPEVAL_PROGRAM));
+    if (p == NULL)
+        return EXPEVAL_NO_MEMORY;
+    if (!compileNamedProgram(exp, names, nameCount, &p->program, NULL)) {
+        free(p);
+        return EXPEVAL_INVALID_EXPRESSION;
+    }
+    p->checked = context->evaluator.checked;
+    if ((context->flags & EXPEVAL_OPTIMIZE) && (optimizeProgram(&p->program, p->checked) < 0)) {
+        deleteProgram(&p->program);
+        free(p);
+        return EXPEVAL_NO_MEMORY;
+    }
+    // Programs that can not be translated are interpreted
+    p->jit.function = NULL;
+    p->jit.code = NULL;
+    p->jit.size = 0;
+    if (context->flags & EXPEVAL_JIT)
+        jitCompile(&p->program, p->checked, &p->jit);
+    *program = p;
+    return EXPEVAL_OK;
+}
+
+
+
+/**
+ * expevalParamCount function
+ * @param program is the pointer to compiled program
+ * @return number of parameters expevalExecute reads
+ */
+int expevalParamCount(const EXPEVAL_PROGRAM *program) {
+    return (program != NULL) ? program->program.paramCount : 0;
+}
+
+
+
+/**
+ * expevalExecute function
+ * Executes a compiled program with the given parameter values
+ * @param context is the pointer to context, its arithmetic must be the one the program is compiled for
+ * @param program is the pointer to compiled program
+ * @param params is the array of expevalParamCount values, params[0] is bound to $1
+ * @param result is the pointer to result, it is written only when EXPEVAL_OK is returned
+ * @return EXPEVAL_OK or the reason the execution has no result
+ */
+int expevalExecute(EXPEVAL_CONTEXT *context, const EXPEVAL_PROGRAM *program, const int64_t *params,
+                   int64_t *result) {
+    EVALUATOR *e;
+    VALUE value;
+
+    if ((context == NULL) || (program == NULL) || (result == NULL) ||
+        ((params == NULL) && (program->program.paramCount > 0)) ||
+        (program->checked != context->evaluator.checked))
+        return EXPEVAL_INVALID_ARGUMENT;
+    e = &context->evaluator;
+    if ((program->jit.function == NULL) && !valueStackReserve(&e->operand, program->program.maxDepth))
+        return EXPEVAL_NO_MEMORY;
+    METRICS_BEGIN(e);
+    if (program->jit.function != NULL)
+        value = program->jit.function(params, &e->error);
+    else
+        value = executeProgram(&program->program, params, e);
+    METRICS_END(e);
+    if (e->error)
+        return EXPEVAL_ARITHMETIC_ERROR;
+    *result = value;
+    return EXPEVAL_OK;
+}
+
+
+
+/**
+ * expevalDeleteProgram function
+ * Frees a compiled program and its machine code
+ * @param program is the pointer to compiled program, NULL is ignored
+ */
+void expevalDeleteProgram(EXPEVAL_PROGRAM *program) {
+    if (program == NULL)
+        return;
+    jitDelete(&program->jit);
+    deleteProgram(&program->program);
+    free(program);
+}
+
+
+
+/**
+ * expevalEnableMetrics function
+ * Starts collecting evaluator metrics for every context of the process
+ */
+void expevalEnableMetrics(void) {
+    metricsEnable();
+}
+
+
+
+/**
+ * expevalWriteMetrics function
+ * Writes a snapshot of the evaluator metrics merged over all threads.
+ * The file is JSON when its name ends with .json and Prometheus text otherwise,
+ * it is replaced at once, so a reader never sees a partial snapshot.
+ * @param path is the snapshot file
+ * @return EXPEVAL_OK or EXPEVAL_IO_ERROR
+ */
+int expevalWriteMetrics(const char *path) {
+    if (path == NULL)
+        return EXPEVAL_INVALID_ARGUMENT;
+    return metricsWriteFile(path) ? EXPEVAL_OK : EXPEVAL_IO_ERROR;
+}
+
+
+
+/**
+ * expevalStatusString function
+ * @param status is a status code returned by the library
+ * @return message of the status code, it must not be freed
+ */
+const char *expevalStatusString(int status) {
+    if ((status < 0) || (status >= (int) (sizeof(STATUS_STRINGS) / sizeof(STATUS_STRINGS[0]))))
+        return "unknown status";
+    return STATUS_STRINGS[status];
+}
\ No newline at end of file
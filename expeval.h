@@ -0,0 +1,105 @@
+#ifndef EXPEVAL_EXPEVAL_H
+#define EXPEVAL_EXPEVAL_H
+
+/*
+ * Public interface of libexpeval.
+ * This is the only header an embedding program needs, it does not expose the internal
+ * stack, program or evaluator types, so they can change without breaking callers.
+ * Library functions never print and never terminate the process, every failure
+ * is returned as an EXPEVAL_STATUS code.
+ *
+ * A context evaluates one expression at a time, every thread needs its own context.
+ * A compiled program is read only after compilation, it can be executed by many contexts at once.
+ * Long expressions can be streamed: expevalBegin, then expevalFeed for every part in order,
+ * then expevalEnd gives the result. Parts can be split anywhere, even inside a number.
+ * After expevalEnableMetrics evaluations are counted, expevalWriteMetrics writes a snapshot.
+ * When an evaluation fails, expevalErrorOffset gives the byte offset where its first error was found.
+ *
+ * Example:
+ *      EXPEVAL_CONTEXT *context = expevalCreateContext(EXPEVAL_DEFAULT);
+ *      int64_t result;
+ *      if (expevalEvaluate(context, "13 + 5 * (6 + 8 / 4)", 20, &result) == EXPEVAL_OK)
+ *          ...
+ *      expevalDeleteContext(context);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXPEVAL_VERSION_MAJOR 1
+#define EXPEVAL_VERSION_MINOR 2
+
+#if defined(__GNUC__)
+#define EXPEVAL_API __attribute__((visibility("default")))
+#else
+#define EXPEVAL_API
+#endif
+
+// Context flags, they can be combined with |
+#define EXPEVAL_DEFAULT 0
+// Results wrap around at 64 bits instead of reporting overflow
+#define EXPEVAL_WRAPPING 1
+// Compiled programs are simplified by the optimization pass
+#define EXPEVAL_OPTIMIZE 2
+// Compiled programs are translated to machine code where it is supported
+#define EXPEVAL_JIT 4
+
+/*
+ * Status codes of the library functions.
+ * EXPEVAL_ARITHMETIC_ERROR is an overflow or a division by zero of a valid expression.
+ * EXPEVAL_INVALID_EXPRESSION is a missing operand or operator or an unbalanced parenthesis.
+ */
+enum EXPEVAL_STATUS {
+    EXPEVAL_OK = 0,
+    EXPEVAL_ARITHMETIC_ERROR,
+    EXPEVAL_INVALID_CHARACTER,
+    EXPEVAL_INVALID_EXPRESSION,
+    EXPEVAL_NO_MEMORY,
+    EXPEVAL_INVALID_ARGUMENT,
+    EXPEVAL_IO_ERROR
+};
+
+typedef struct EXPEVAL_CONTEXT EXPEVAL_CONTEXT;
+
+typedef struct EXPEVAL_PROGRAM EXPEVAL_PROGRAM;
+
+// Function prototypes
+EXPEVAL_API EXPEVAL_CONTEXT *expevalCreateContext(int flags);
+
+EXPEVAL_API void expevalDeleteContext(EXPEVAL_CONTEXT *context);
+
+EXPEVAL_API int expevalEvaluate(EXPEVAL_CONTEXT *context, const char *exp, size_t len, int64_t *result);
+
+EXPEVAL_API int expevalBegin(EXPEVAL_CONTEXT *context);
+
+EXPEVAL_API int expevalFeed(EXPEVAL_CONTEXT *context, const char *part, size_t len);
+
+EXPEVAL_API int expevalEnd(EXPEVAL_CONTEXT *context, int64_t *result);
+
+EXPEVAL_API size_t expevalErrorOffset(const EXPEVAL_CONTEXT *context);
+
+EXPEVAL_API int expevalCompile(EXPEVAL_CONTEXT *context, const char *exp, const char *const *names, int nameCount,
+                               EXPEVAL_PROGRAM **program);
+
+EXPEVAL_API int expevalParamCount(const EXPEVAL_PROGRAM *program);
+
+EXPEVAL_API int expevalExecute(EXPEVAL_CONTEXT *context, const EXPEVAL_PROGRAM *program, const int64_t *params,
+                               int64_t *result);
+
+EXPEVAL_API void expevalDeleteProgram(EXPEVAL_PROGRAM *program);
+
+EXPEVAL_API void expevalEnableMetrics(void);
+
+EXPEVAL_API int expevalWriteMetrics(const char *path);
+
+EXPEVAL_API const char *expevalStatusString(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //EXPEVAL_EXPEVAL_H
\ No newline at end of file
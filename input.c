@@ -0,0 +1,71 @@
+#include "input.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * mapInput function
+ * Maps the file behind an open stream into memory.
+ * Only regular files can be mapped, pipes and terminals are rejected
+ * and must be read through the stream.
+ * @param in is the open input stream
+ * @param file is the pointer to mapping to be filled
+ * @return TRUE if the file is mapped else FALSE
+ */
+BOOLEAN mapInput(FILE *in, MAPPED_FILE *file) {
+    struct stat status;
+    void *data;
+    int fd = fileno(in);
+
+    file->data = NULL;
+    file->size = 0;
+    if ((fd < 0) || (fstat(fd, &status) != 0) || !S_ISREG(status.st_mode))
+        return FALSE;
+    if (status.st_size == 0)
+        return TRUE;
+
+    data = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return FALSE;
+    // Lines are read front to back once
+    madvise(data, (size_t) status.st_size, MADV_SEQUENTIAL);
+    file->data = (const char *) data;
+    file->size = (size_t) status.st_size;
+    return TRUE;
+}
+
+
+
+/**
+ * unmapInput function
+ * Unmaps the file and handles dangling pointers
+ * @param file is the pointer to mapping
+ */
+void unmapInput(MAPPED_FILE *file) {
+    if (file->data != NULL)
+        munmap((void *) file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+
+
+/**
+ * nextLine function
+ * Finds the line starting at cursor without copying it.
+ * Line terminator is not part of the line.
+ * @param cursor is the start of the line
+ * @param end is the end of the buffer
+ * @param len is the pointer to length of the line
+ * @return start of the next line, end if this is the last line
+ */
+const char *nextLine(const char *cursor, const char *end, size_t *len) {
+    const char *newline = (const char *) memchr(cursor, '\n', end - cursor);
+
+    if (newline == NULL) {
+        *len = end - cursor;
+        return end;
+    }
+    *len = newline - cursor;
+    return newline + 1;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef EXPEVAL_INPUT_H
+#define EXPEVAL_INPUT_H
+
+#include <stdio.h>
+#include "stack.h"
+
+/*
+ * Read only memory mapping of a whole input file.
+ * data is the first byte of the file and size is the file length.
+ * Empty files have a NULL data pointer and size 0.
+ */
+typedef struct {
+    const char *data;
+    size_t size;
+} MAPPED_FILE;
+
+// Function prototypes
+BOOLEAN mapInput(FILE *in, MAPPED_FILE *file);
+
+void unmapInput(MAPPED_FILE *file);
+
+const char *nextLine(const char *cursor, const char *end, size_t *len);
+
+#endif //EXPEVAL_INPUT_H
\ No newline at end of file
@@ -0,0 +1,552 @@
+#include "jit.h"
+#include "optimize.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#define JIT_X86_64
+
+// Register numbers of the x86-64 encoding
+enum REGISTER {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+/*
+ * Opcodes of the instructions the generator writes.
+ * Two byte opcodes keep their 0x0F prefix in the high byte.
+ * Group opcodes take the operation in the reg field of ModRM, given as /n below.
+ */
+enum X86_OPCODE {
+    X86_ADD = 0x03, X86_OR = 0x0B, X86_AND = 0x23, X86_SUB = 0x2B, X86_XOR_STORE = 0x31,
+    X86_CMP = 0x3B, X86_STORE = 0x89, X86_LOAD = 0x8B, X86_LEA = 0x8D, X86_SHIFT = 0xC1,
+    X86_MOVE_IMMEDIATE = 0xC7, X86_UNARY = 0xF7, X86_INDIRECT = 0xFF, X86_IMUL = 0x0FAF
+};
+
+#define SHIFT_LEFT 4
+#define SHIFT_RIGHT 5
+#define SHIFT_ARITHMETIC 7
+#define UNARY_NEGATE 3
+#define INDIRECT_CALL 2
+
+// Bytes written for one instruction of the program at most, and for the prologue and epilogue
+#define JIT_BYTES_PER_INSTRUCTION 64
+#define JIT_FRAME_BYTES 128
+
+// Stack levels kept in registers, all of them are callee saved so they survive helper calls
+static const enum REGISTER DEPTH_REGISTER[JIT_REGISTER_COUNT] = {RBX, RBP, R14, R15};
+
+// Register holding the parameter array and the register collecting overflow flags
+#define PARAM_REGISTER R12
+#define ERROR_REGISTER R13
+
+/*
+ * Operand of an instruction, a register or the memory at reg + disp
+ */
+typedef struct {
+    enum REGISTER reg;
+    BOOLEAN memory;
+    int32_t disp;
+} LOCATION;
+
+/*
+ * Code generator state.
+ * code is the output buffer with length bytes written
+ * node is the expression tree and need holds the Sethi-Ullman number of every node
+ * helperError is the frame slot the operator functions write their error flag to,
+ * errorPointer keeps the error argument and spill is the slot of the first stack level
+ * that does not fit in registers
+ * checked selects overflow checked arithmetic
+ */
+typedef struct {
+    uint8_t *code;
+    size_t length;
+    const NODE *node;
+    int *need;
+    int32_t helperError;
+    int32_t errorPointer;
+    int32_t spill;
+    BOOLEAN checked;
+} JIT_BUILDER;
+
+
+
+// Operand constructors
+static LOCATION inRegister(enum REGISTER reg) {
+    LOCATION l = {reg, FALSE, 0};
+    return l;
+}
+
+static LOCATION inMemory(enum REGISTER base, int32_t disp) {
+    LOCATION l = {base, TRUE, disp};
+    return l;
+}
+
+static BOOLEAN sameLocation(LOCATION a, LOCATION b) {
+    return (a.reg == b.reg) && (a.memory == b.memory) && (!a.memory || (a.disp == b.disp));
+}
+
+
+
+/**
+ * stackLevel function
+ * Finds where an operand stack level lives
+ * @param b is the pointer to code generator
+ * @param d is the stack level
+ * @return register of the level, or its frame slot when registers are exhausted
+ */
+static LOCATION stackLevel(const JIT_BUILDER *b, int d) {
+    if (d < JIT_REGISTER_COUNT)
+        return inRegister(DEPTH_REGISTER[d]);
+    return inMemory(RSP, b->spill + 8 * (d - JIT_REGISTER_COUNT));
+}
+
+
+
+// Raw output
+static void emitByte(JIT_BUILDER *b, uint8_t x) {
+    b->code[b->length++] = x;
+}
+
+static void emit32(JIT_BUILDER *b, uint32_t x) {
+    memcpy(b->code + b->length, &x, 4);
+    b->length += 4;
+}
+
+static void emit64(JIT_BUILDER *b, uint64_t x) {
+    memcpy(b->code + b->length, &x, 8);
+    b->length += 8;
+}
+
+
+
+/**
+ * emitInstruction function
+ * Writes a 64 bit instruction with a ModRM operand.
+ * Memory operands always use a 32 bit displacement, RSP and R12 based ones need a SIB byte.
+ * @param b is the pointer to code generator
+ * @param opcode is the one or two byte opcode
+ * @param reg is the register operand, or the operation of a group opcode
+ * @param rm is the register or memory operand
+ */
+static void emitInstruction(JIT_BUILDER *b, unsigned opcode, int reg, LOCATION rm) {
+    emitByte(b, (uint8_t) (0x48 | ((reg & 8) >> 1) | ((rm.reg & 8) >> 3)));
+    if (opcode > 0xFF)
+        emitByte(b, (uint8_t) (opcode >> 8));
+    emitByte(b, (uint8_t) opcode);
+    if (!rm.memory) {
+        emitByte(b, (uint8_t) (0xC0 | ((reg & 7) << 3) | (rm.reg & 7)));
+        return;
+    }
+    emitByte(b, (uint8_t) (0x80 | ((reg & 7) << 3) | (rm.reg & 7)));
+    if ((rm.reg & 7) == RSP)
+        emitByte(b, 0x24);
+    emit32(b, (uint32_t) rm.disp);
+}
+
+
+
+// Moves between registers and operands, nothing is written when source and destination are the same
+static void emitLoad(JIT_BUILDER *b, enum REGISTER reg, LOCATION from) {
+    if (!sameLocation(inRegister(reg), from))
+        emitInstruction(b, X86_LOAD, reg, from);
+}
+
+static void emitStore(JIT_BUILDER *b, LOCATION to, enum REGISTER reg) {
+    if (!to.memory)
+        emitLoad(b, to.reg, inRegister(reg));
+    else
+        emitInstruction(b, X86_STORE, reg, to);
+}
+
+static void emitImmediate(JIT_BUILDER *b, enum REGISTER reg, VALUE value) {
+    emitByte(b, (uint8_t) (0x48 | ((reg & 8) >> 3)));
+    emitByte(b, (uint8_t) (0xB8 + (reg & 7)));
+    emit64(b, (uint64_t) value);
+}
+
+static void emitShift(JIT_BUILDER *b, int operation, enum REGISTER reg, int count) {
+    emitInstruction(b, X86_SHIFT, operation, inRegister(reg));
+    emitByte(b, (uint8_t) count);
+}
+
+
+
+/**
+ * emitOverflow function
+ * Collects the overflow flag of the last operation, seto al and or r13b, al
+ * @param b is the pointer to code generator
+ */
+static void emitOverflow(JIT_BUILDER *b) {
+    static const uint8_t code[] = {0x0F, 0x90, 0xC0, 0x41, 0x08, 0xC5};
+    if (!b->checked)
+        return;
+    memcpy(b->code + b->length, code, sizeof(code));
+    b->length += sizeof(code);
+}
+
+
+
+/**
+ * emitLeaf function
+ * Loads a constant or a parameter to a location
+ * @param b is the pointer to code generator
+ * @param n is the pointer to leaf node
+ * @param to is the destination
+ */
+static void emitLeaf(JIT_BUILDER *b, const NODE *n, LOCATION to) {
+    enum REGISTER reg = to.memory ? RAX : to.reg;
+    if (n->op == OP_CONST)
+        emitImmediate(b, reg, n->value);
+    else
+        emitLoad(b, reg, inMemory(PARAM_REGISTER, (int32_t) (8 * n->value)));
+    emitStore(b, to, reg);
+}
+
+
+
+/**
+ * leafOperand function
+ * Right operands that are leaves are used in place, parameters as memory operands
+ * and constants from a scratch register, so they do not take a stack level
+ * @param b is the pointer to code generator
+ * @param n is the pointer to leaf node
+ * @return operand of the leaf
+ */
+static LOCATION leafOperand(JIT_BUILDER *b, const NODE *n) {
+    if (n->op == OP_PARAM)
+        return inMemory(PARAM_REGISTER, (int32_t) (8 * n->value));
+    emitImmediate(b, RCX, n->value);
+    return inRegister(RCX);
+}
+
+
+
+/**
+ * emitOperation function
+ * Writes the instructions of one operator, left operand is at a, right one at b,
+ * result goes to stack level d.
+ * Add, subtract, multiply and logic operators work in place when the result level holds an operand,
+ * division, remainder and power call the checked or wrapping registry function,
+ * so their results and errors are exactly the ones of the interpreter.
+ * @param b is the pointer to code generator
+ * @param n is the pointer to operator node
+ * @param d is the stack level of the result
+ * @param left is the location of the left operand
+ * @param right is the location of the right operand, not used by unary operators
+ */
+static void emitOperation(JIT_BUILDER *b, const NODE *n, int d, LOCATION left, LOCATION right) {
+    static const unsigned ARITHMETIC[OPCODE_COUNT] = {
+            [OP_ADD] = X86_ADD, [OP_SUB] = X86_SUB, [OP_MUL] = X86_IMUL, [OP_AND] = X86_AND, [OP_OR] = X86_OR
+    };
+    static const uint8_t CONDITION[OPCODE_COUNT] = {[OP_LESS] = 0x9C, [OP_GREATER] = 0x9F, [OP_EQUAL] = 0x94};
+    LOCATION to = stackLevel(b, d);
+    BOOLEAN commutative = (n->op != OP_SUB);
+    int shift = (int) n->value;
+
+    switch (n->op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_AND:
+        case OP_OR:
+            if (!to.memory && sameLocation(left, to)) {
+                emitInstruction(b, ARITHMETIC[n->op], to.reg, right);
+            } else if (!to.memory && commutative && sameLocation(right, to)) {
+                emitInstruction(b, ARITHMETIC[n->op], to.reg, left);
+            } else {
+                emitLoad(b, RAX, left);
+                emitInstruction(b, ARITHMETIC[n->op], RAX, right);
+                emitStore(b, to, RAX);
+            }
+            if ((n->op == OP_ADD) || (n->op == OP_SUB) || (n->op == OP_MUL))
+                emitOverflow(b);
+            break;
+        case OP_NEG:
+            emitLoad(b, RAX, left);
+            emitInstruction(b, X86_UNARY, UNARY_NEGATE, inRegister(RAX));
+            emitStore(b, to, RAX);
+            emitOverflow(b);
+            break;
+        case OP_LESS:
+        case OP_GREATER:
+        case OP_EQUAL:
+            // cmp rax, right, setcc al, movzx eax, al
+            emitLoad(b, RAX, left);
+            emitInstruction(b, X86_CMP, RAX, right);
+            emitByte(b, 0x0F);
+            emitByte(b, CONDITION[n->op]);
+            emitByte(b, 0xC0);
+            emitByte(b, 0x0F);
+            emitByte(b, 0xB6);
+            emitByte(b, 0xC0);
+            emitStore(b, to, RAX);
+            break;
+        case OP_DIV_SHIFT:
+        case OP_MOD_MASK:
+            // Negative dividends are biased by 2^shift - 1, see shiftDivide
+            emitLoad(b, RAX, left);
+            emitLoad(b, RDX, inRegister(RAX));
+            emitShift(b, SHIFT_ARITHMETIC, RDX, 63);
+            emitShift(b, SHIFT_RIGHT, RDX, 64 - shift);
+            if (n->op == OP_DIV_SHIFT) {
+                emitInstruction(b, X86_ADD, RAX, inRegister(RDX));
+                emitShift(b, SHIFT_ARITHMETIC, RAX, shift);
+            } else {
+                emitInstruction(b, X86_ADD, RDX, inRegister(RAX));
+                emitShift(b, SHIFT_ARITHMETIC, RDX, shift);
+                emitShift(b, SHIFT_LEFT, RDX, shift);
+                emitInstruction(b, X86_SUB, RAX, inRegister(RDX));
+            }
+            emitStore(b, to, RAX);
+            break;
+        default:
+            // Registry function(b, a, &helperError)
+            emitLoad(b, RDI, left);
+            emitLoad(b, RSI, right);
+            emitInstruction(b, X86_LEA, RDX, inMemory(RSP, b->helperError));
+            emitImmediate(b, RAX, (VALUE) (uintptr_t) OPCODE_FUNCTION[b->checked][n->op]);
+            emitInstruction(b, X86_INDIRECT, INDIRECT_CALL, inRegister(RAX));
+            emitStore(b, to, RAX);
+            break;
+    }
+}
+
+
+
+/**
+ * emitNode function
+ * Sethi-Ullman code generation. The value of the subtree goes to stack level d.
+ * Of two operands the one that needs more levels is computed first, so the other one
+ * fits in the levels left, and right operands that are leaves take no level at all.
+ * Levels that do not fit in registers are spilled to the native stack.
+ * @param b is the pointer to code generator
+ * @param i is the index of the subtree root
+ * @param d is the stack level of the result
+ */
+static void emitNode(JIT_BUILDER *b, int i, int d) {
+    const NODE *n = &b->node[i];
+    const NODE *r;
+    LOCATION left, right;
+
+    if ((n->op == OP_CONST) || (n->op == OP_PARAM)) {
+        emitLeaf(b, n, stackLevel(b, d));
+        return;
+    }
+    if ((n->right < 0) || (n->right == n->left)) {
+        // Unary operator, or both operands are the same value
+        emitNode(b, n->left, d);
+        emitOperation(b, n, d, stackLevel(b, d), stackLevel(b, d));
+        return;
+    }
+
+    r = &b->node[n->right];
+    if ((r->op == OP_CONST) || (r->op == OP_PARAM)) {
+        emitNode(b, n->left, d);
+        left = stackLevel(b, d);
+        right = leafOperand(b, r);
+    } else if (b->need[n->right] > b->need[n->left]) {
+        emitNode(b, n->right, d);
+        emitNode(b, n->left, d + 1);
+        left = stackLevel(b, d + 1);
+        right = stackLevel(b, d);
+    } else {
+        emitNode(b, n->left, d);
+        emitNode(b, n->right, d + 1);
+        left = stackLevel(b, d);
+        right = stackLevel(b, d + 1);
+    }
+    emitOperation(b, n, d, left, right);
+}
+
+
+
+/**
+ * buildTree function
+ * Turns a postfix program into an expression tree and labels every node with its Sethi-Ullman number,
+ * the number of stack levels needed to compute it
+ * @param p is the pointer to compiled program
+ * @param node is the node array with p->length elements
+ * @param need is the label array with p->length elements
+ * @return index of the root, -1 if memory could not allocated
+ */
+static int buildTree(const PROGRAM *p, NODE *node, int *need) {
+    INT_STACK operand;
+    int i, l, r, root;
+
+    if (!intStackInit(&operand, p->maxDepth, FALSE))
+        return -1;
+    for (i = 0; i < p->length; i++) {
+        node[i].op = p->code[i].op;
+        node[i].value = p->code[i].value;
+        node[i].left = -1;
+        node[i].right = -1;
+        need[i] = 1;
+        switch (node[i].op) {
+            case OP_CONST:
+            case OP_PARAM:
+                break;
+            case OP_DUP:
+                // A copy is the same node pushed again
+                intStackPushUnchecked(&operand, intStackPeekUnchecked(&operand));
+                continue;
+            case OP_NEG:
+            case OP_DIV_SHIFT:
+            case OP_MOD_MASK:
+                node[i].left = intStackPopUnchecked(&operand);
+                need[i] = need[node[i].left];
+                break;
+            default:
+                node[i].right = intStackPopUnchecked(&operand);
+                node[i].left = intStackPopUnchecked(&operand);
+                l = need[node[i].left];
+                r = need[node[i].right];
+                if ((node[i].right == node[i].left) || (node[node[i].right].op == OP_CONST)
+                    || (node[node[i].right].op == OP_PARAM))
+                    need[i] = l;
+                else
+                    need[i] = (l == r) ? l + 1 : ((l > r) ? l : r);
+                break;
+        }
+        intStackPushUnchecked(&operand, i);
+    }
+    root = intStackPopUnchecked(&operand);
+    intStackDelete(&operand);
+    return root;
+}
+
+
+
+/**
+ * emitFunction function
+ * Writes the whole function: prologue saving callee saved registers, the expression,
+ * then the epilogue storing the error flag and returning the value of stack level 0
+ * @param b is the pointer to code generator
+ * @param root is the index of the tree root
+ */
+static void emitFunction(JIT_BUILDER *b, int root) {
+    static const enum REGISTER SAVED[] = {RBX, RBP, R12, R13, R14, R15};
+    int spills = (b->need[root] > JIT_REGISTER_COUNT) ? b->need[root] - JIT_REGISTER_COUNT : 0;
+    int32_t frame = 16 + 8 * spills;
+    int k;
+
+    // Six pushes and the frame keep the stack 16 byte aligned at helper calls
+    if (frame % 16 == 0)
+        frame += 8;
+    b->helperError = 0;
+    b->errorPointer = 8;
+    b->spill = 16;
+
+    for (k = 0; k < 6; k++) {
+        if (SAVED[k] >= R8)
+            emitByte(b, 0x41);
+        emitByte(b, (uint8_t) (0x50 + (SAVED[k] & 7)));
+    }
+    emitInstruction(b, 0x81, 5, inRegister(RSP));
+    emit32(b, (uint32_t) frame);
+    emitLoad(b, PARAM_REGISTER, inRegister(RDI));
+    emitStore(b, inMemory(RSP, b->errorPointer), RSI);
+    emitInstruction(b, X86_MOVE_IMMEDIATE, 0, inMemory(RSP, b->helperError));
+    emit32(b, 0);
+    emitInstruction(b, X86_XOR_STORE, ERROR_REGISTER, inRegister(ERROR_REGISTER));
+
+    emitNode(b, root, 0);
+
+    // rax = level 0, *error = r13d | helperError
+    emitLoad(b, RAX, stackLevel(b, 0));
+    emitInstruction(b, X86_OR, ERROR_REGISTER, inMemory(RSP, b->helperError));
+    emitLoad(b, RCX, inMemory(RSP, b->errorPointer));
+    emitByte(b, 0x44);
+    emitByte(b, 0x89);
+    emitByte(b, 0x29);
+    emitInstruction(b, 0x81, 0, inRegister(RSP));
+    emit32(b, (uint32_t) frame);
+    for (k = 5; k >= 0; k--) {
+        if (SAVED[k] >= R8)
+            emitByte(b, 0x41);
+        emitByte(b, (uint8_t) (0x58 + (SAVED[k] & 7)));
+    }
+    emitByte(b, 0xC3);
+}
+#endif
+
+
+
+/**
+ * jitCompile function
+ * Translates a compiled program to x86-64 machine code in an executable mapping.
+ * The function gives the same results and errors as executeProgram with the same arithmetic.
+ * The code is written to a writable mapping which is made executable and read only
+ * before it is returned, so it is never writable and executable at the same time.
+ * @param p is the pointer to compiled program
+ * @param checked is TRUE for overflow checked arithmetic
+ * @param jit is the pointer to translated program to be filled
+ * @return TRUE if the program is translated, FALSE on other CPUs, for too long programs
+ * or if memory could not allocated
+ */
+BOOLEAN jitCompile(const PROGRAM *p, BOOLEAN checked, JIT_PROGRAM *jit) {
+#ifdef JIT_X86_64
+    JIT_BUILDER b;
+    NODE *node;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size;
+    void *code;
+    int root;
+
+    jit->function = NULL;
+    jit->code = NULL;
+    jit->size = 0;
+    if ((p->length == 0) || (p->length > JIT_MAX_LENGTH))
+        return FALSE;
+
+    size = (size_t) p->length * JIT_BYTES_PER_INSTRUCTION + JIT_FRAME_BYTES;
+    size = (size + page - 1) / page * page;
+    node = (NODE *) malloc(p->length * sizeof(NODE));
+    b.need = (int *) malloc(p->length * sizeof(int));
+    code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    root = ((node != NULL) && (b.need != NULL) && (code != MAP_FAILED)) ? buildTree(p, node, b.need) : -1;
+    if (root >= 0) {
+        b.code = (uint8_t *) code;
+        b.length = 0;
+        b.node = node;
+        b.checked = checked;
+        emitFunction(&b, root);
+    }
+    free(node);
+    free(b.need);
+
+    if ((root < 0) || (mprotect(code, size, PROT_READ | PROT_EXEC) != 0)) {
+        if (code != MAP_FAILED)
+            munmap(code, size);
+        return FALSE;
+    }
+    jit->code = code;
+    jit->size = size;
+    jit->function = (JIT_FUNCTION) code;
+    return TRUE;
+#else
+    (void) p;
+    (void) checked;
+    jit->function = NULL;
+    jit->code = NULL;
+    jit->size = 0;
+    return FALSE;
+#endif
+}
+
+
+
+/**
+ * jitDelete function
+ * Unmaps the machine code and handles dangling pointers.
+ * @param jit is the pointer to translated program
+ */
+void jitDelete(JIT_PROGRAM *jit) {
+    if (jit->code != NULL)
+        munmap(jit->code, jit->size);
+    jit->function = NULL;
+    jit->code = NULL;
+    jit->size = 0;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef EXPEVAL_JIT_H
+#define EXPEVAL_JIT_H
+
+#include <stddef.h>
+#include "stack.h"
+#include "program.h"
+
+// Longer programs are left to the interpreter, code generation recurses once per tree level
+#define JIT_MAX_LENGTH 4096
+// Operands of the first stack levels live in callee saved registers, deeper ones in the native stack
+#define JIT_REGISTER_COUNT 4
+
+/*
+ * Native code of a compiled expression.
+ * params[0] is bound to $1 like in executeProgram, *error is set to TRUE when the
+ * program overflows or divides by zero and to FALSE otherwise.
+ */
+typedef VALUE (*JIT_FUNCTION)(const VALUE *params, BOOLEAN *error);
+
+/*
+ * Executable mapping of a translated program.
+ * function is the entry point at the start of code, size is the length of the mapping.
+ */
+typedef struct {
+    JIT_FUNCTION function;
+    void *code;
+    size_t size;
+} JIT_PROGRAM;
+
+// Function prototypes
+BOOLEAN jitCompile(const PROGRAM *program, BOOLEAN checked, JIT_PROGRAM *jit);
+
+void jitDelete(JIT_PROGRAM *jit);
+
+#endif //EXPEVAL_JIT_H
\ No newline at end of file
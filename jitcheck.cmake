@@ -0,0 +1,32 @@
+# Differential test of the JIT, run by ctest as: cmake -D EXPEVAL=... -D CORPUS=... -D WORK=... -P jitcheck.cmake
+# Seeded stress corpora with unary minus and a few fixed unary minus cases are evaluated by the
+# evaluator and by machine code with expEval -V, plain and optimized, any mismatch fails the test.
+
+foreach (name EXPEVAL CORPUS WORK)
+    if (NOT DEFINED ${name})
+        message(FATAL_ERROR "jitcheck: ${name} is not set")
+    endif ()
+endforeach ()
+file(MAKE_DIRECTORY ${WORK})
+
+# Unary minus in front of parentheses, literals and other minus signs
+file(WRITE ${WORK}/unary.txt "-(2+3)\n--3\n2*-(3+4)\n5 - -3\n-2^2\n-(2)^2\n--(4*2)-1\n-(-(1))\n3*--(2-7)\n")
+set(inputs ${WORK}/unary.txt)
+
+foreach (seed 1 2 3)
+    set(corpus ${WORK}/corpus${seed}.txt)
+    execute_process(COMMAND ${CORPUS} -s ${seed} -n 2000 -d 4 -u 4 ${corpus} RESULT_VARIABLE status)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "jitcheck: corpus of seed ${seed} could not generated")
+    endif ()
+    list(APPEND inputs ${corpus})
+endforeach ()
+
+foreach (input ${inputs})
+    foreach (flags "-V" "-V;-O")
+        execute_process(COMMAND ${EXPEVAL} ${flags} ${input} RESULT_VARIABLE status OUTPUT_VARIABLE mismatches)
+        if (NOT status EQUAL 0)
+            message(FATAL_ERROR "jitcheck: ${flags} ${input} failed\n${mismatches}")
+        endif ()
+    endforeach ()
+endforeach ()
\ No newline at end of file
@@ -11,8 +11,9 @@
  * char by char, finds every character type and calls appropriate function to handle
  * the case. Allowed characters are [1-9]+[0-9]* and '+', '-', '/', '*', '(', ')'.
  *
- * Important note: Program does integer arithmetic. So any floating point arithmetic value will be
- * converted to integer value. Typing allowed characters and considering floating point values is in users
+ * Important note: Program does 64 bit integer arithmetic. So any floating point arithmetic value will be
+ * converted to integer value. Overflow and division by zero are reported as an error,
+ * -u selects wrapping arithmetic without overflow checks. Typing allowed characters and considering floating point values is in users
  * responsibility.
  *
  * Some test(example) cases:
@@ -26,20 +27,239 @@
  *      -4 + 8 = 4
  *      5*(-4*2) = -40
  *
+ * Batch mode:
+ *      expEval -b [-j threads] [file]
+ * Reads one expression per line from file (or stdin when file is omitted or "-")
+ * and prints one result per line. Stacks are allocated once and reused for every line.
+ * With -j, lines are evaluated by a pool of worker threads and printed in input order.
+ * A line without a result prints error and the next line is evaluated, with -e it prints
+ * the reason and the byte offset of the first error in the line, e.g. "error: missing operand at 4".
+ *
+ * Regular input files are memory mapped and every line is evaluated in place.
+ * Memory of the evaluation is taken from arenas, -H backs them with huge pages.
+ *
+ * Expression cache:
+ *      expEval -b -C 16 [-j threads] [file]
+ * Results are kept in a sharded LRU cache of at most 16 MiB, keyed by the expression with
+ * insignificant whitespace removed. Repeated expressions are evaluated once, the hit, miss
+ * and eviction counters are printed to stderr at the end.
+ *
+ * Prepared mode:
+ *      expEval -p "$1 * ($2 + 3)" [file]
+ * Compiles the expression once, then reads one line of parameter values per execution
+ * from file (or stdin) and prints one result per line.
+ *
+ * Optimizer:
+ *      expEval -O -p "($1 + 0) * (3 + 4)" [file]
+ * -O runs the optimization pass over prepared and columnar programs. Constant subexpressions
+ * are folded, identities are removed and divisions by powers of two become shifts.
+ * The number of eliminated operations is printed to stderr.
+ *
+ * JIT:
+ *      expEval -J -p "$1 * ($2 + 3)" [file]
+ *      expEval -V [-O] [file]
+ * -J translates the prepared expression to x86-64 machine code and calls it for every line.
+ * -V is the differential test of the JIT, every expression of the file is evaluated by the
+ * evaluator and by its machine code and differences are printed.
+ *
+ * Streaming mode:
+ *      expEval -s [-j threads] [file]
+ * The whole file is one expression, it is read and evaluated 64 KiB at a time,
+ * so memory depends on the nesting depth of the expression and not on its length.
+ * With -j a regular file is mapped, split at its loosest top level operators and
+ * the parts are evaluated on the threads.
+ *
+ * Daemon mode:
+ *      expEval -S /tmp/expEval.sock [-j threads] [-C 16]
+ * Listens on a Unix domain socket and evaluates length prefixed requests of many clients
+ * on worker threads until SIGINT or SIGTERM, see daemon.h for the protocol.
+ *
+ * Columnar mode:
+ *      expEval -c "price * quantity - discount" [-r] [-o result.bin] [file]
+ * Reads named integer columns from a CSV file with a header line (or a raw binary column file with -r),
+ * compiles the expression once and evaluates it a block of rows at a time with vector kernels.
+ * Results are printed one per line, -o writes them as a binary column file instead.
+ *
+ * Tracing:
+ *      expEval -t trace.bin -b [file]
+ *      expEval -d trace.bin
+ * Stack steps are recorded as binary events to a ring buffer of every thread.
+ * Interactive mode prints them after evaluation, -t writes them to a trace file
+ * and -d decodes a trace file into stack dumps.
+ *
+ * Metrics:
+ *      expEval -m metrics.prom [-i 10] -b -j 4 [file]
+ * Counts evaluations, tokens, operations, stack depths and latencies in every thread.
+ * A snapshot of the merged counters is written to the file every -i seconds, on SIGUSR1
+ * and at exit, as JSON when the file name ends with .json and as Prometheus text otherwise.
+ *
  * @author Mert Turkmenoglu
  * @date 13.03.2019
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <unistd.h>
 #include "stack.h"
+#include "batch.h"
+#include "program.h"
+#include "arena.h"
+#include "input.h"
+#include "trace.h"
+#include "columnar.h"
+#include "optimize.h"
+#include "cache.h"
+#include "jit.h"
+#include "daemon.h"
+#include "parallel.h"
+#include "metrics.h"
+
+// Arena of the main thread, holds the evaluator and its stacks
+#define MAIN_ARENA_SIZE (1024 * 1024)
 
 extern int errno;
 
+
+
+/**
+ * stopMetrics function
+ * Stops the metrics writer at exit and reports the snapshots that could not be written
+ */
+static void stopMetrics(void) {
+    int failures = stopMetricsWriter();
+    if (failures > 0)
+        fprintf(stderr, "Metrics: %d snapshots could not written\n", failures);
+}
+
+
+
+/**
+ * optimize function
+ * Runs the optimization pass over a compiled program and reports the eliminated operations
+ * @param program is the pointer to compiled program
+ * @param checked is TRUE when the program will run with checked arithmetic
+ */
+static void optimize(PROGRAM *program, BOOLEAN checked) {
+    int eliminated = optimizeProgram(program, checked);
+    if (eliminated < 0)
+        fprintf(stderr, "Optimizer: memory could not allocated, program is not optimized\n");
+    else
+        fprintf(stderr, "Optimizer: %d operations eliminated\n", eliminated);
+}
+
+
+
+/**
+ * evaluateStream function
+ * Streaming mode, evaluates the whole input as one expression and prints its result,
+ * or error when the expression has no result, with its reason and offset when e->explain is set.
+ * With more than one thread a regular file is mapped and split between the threads,
+ * other input is read and evaluated in fixed size parts.
+ * @param input is the expression file
+ * @param threadCount is the number of threads
+ * @param e is the pointer to evaluator
+ * @return TRUE if the input is read else FALSE
+ */
+static BOOLEAN evaluateStream(FILE *input, int threadCount, EVALUATOR *e) {
+    MAPPED_FILE mapping;
+    char *buffer;
+    size_t n;
+    VALUE result;
+
+    if ((threadCount > 1) && mapInput(input, &mapping)) {
+        result = evaluateParallel(mapping.data, mapping.size, threadCount, e);
+        unmapInput(&mapping);
+    } else {
+        buffer = (char *) malloc(STREAM_CHUNK_SIZE);
+        if (buffer == NULL) {
+            fprintf(stderr, "Error memory allocation: stream buffer could not allocated\n");
+            return FALSE;
+        }
+        beginEvaluation(e);
+        while (((n = fread(buffer, 1, STREAM_CHUNK_SIZE, input)) > 0) && feedEvaluation(buffer, n, e))
+            continue;
+        result = endEvaluation(e);
+        free(buffer);
+        if (ferror(input)) {
+            perror("Input file could not read");
+            return FALSE;
+        }
+    }
+    if (e->error && e->explain)
+        printf("error: %s at %zu\n", evalStatusString(e->status), e->errorOffset);
+    else if (e->error)
+        printf("error\n");
+    else
+        printf("%" PRId64 "\n", result);
+    return TRUE;
+}
+
+
+
+/**
+ * evaluateColumnFile function
+ * Columnar mode, reads the columns, evaluates the expression over all rows and writes the result column
+ * @param exp is the expression over column names
+ * @param input is the column file
+ * @param binaryInput is TRUE when input is a raw binary column file
+ * @param outputPath is the binary result file, NULL to print results as text
+ * @param optimized is TRUE to run the optimization pass over the program
+ * @param e is the pointer to evaluator
+ * @param arena is the pointer to arena owning the program
+ * @return TRUE if the result column is written else FALSE
+ */
+static BOOLEAN evaluateColumnFile(const char *exp, FILE *input, BOOLEAN binaryInput, const char *outputPath,
+                                  BOOLEAN optimized, EVALUATOR *e, ARENA *arena) {
+    COLUMN_SET set;
+    PROGRAM program;
+    VALUE *result;
+    char *failed;
+    FILE *output = stdout;
+    BOOLEAN ok;
+
+    if (!(binaryInput ? readBinaryColumns(input, &set) : readCsvColumns(input, &set))) {
+        fprintf(stderr, "Error: Malformed column file\n");
+        return FALSE;
+    }
+    if (!compileColumnProgram(exp, &set, &program, arena)) {
+        fprintf(stderr, "Error: Invalid expression: %s\n", exp);
+        deleteColumns(&set);
+        return FALSE;
+    }
+    if (optimized)
+        optimize(&program, e->checked);
+
+    result = (VALUE *) malloc((set.rows + 1) * sizeof(VALUE));
+    failed = (char *) malloc(set.rows + 1);
+    ok = (result != NULL) && (failed != NULL) && (executeColumns(&program, &set, result, failed, e) >= 0);
+    if (!ok)
+        fprintf(stderr, "Error memory allocation: columns are too large\n");
+
+    if (ok && (outputPath != NULL)) {
+        output = fopen(outputPath, "wb");
+        if (output == NULL)
+            perror("Result file could not opened");
+        ok = output != NULL;
+    }
+    if (ok && !writeResultColumn(output, result, failed, set.rows, outputPath != NULL)) {
+        perror("Result could not written");
+        ok = FALSE;
+    }
+    if ((output != NULL) && (output != stdout))
+        fclose(output);
+
+    free(result);
+    free(failed);
+    deleteColumns(&set);
+    return ok;
+}
+
+
 /**
  * Entry point of the program.
  * @param argc is the count of the argument entered
@@ -55,53 +275,326 @@ int main(int argc, char const *argv[]) {
      */
     char expression[MAX_INPUT_SIZE];
     int errnum;
-    int result;
+    int part;
+    VALUE result;
+    FILE *input = NULL;
+    PROGRAM program;
+    const char *preparedExpression = NULL;
+    BOOLEAN batch = FALSE;
+    BOOLEAN hugePages = FALSE;
+    BOOLEAN checked = TRUE;
+    int threadCount = 1;
+    int option;
+    ARENA arena;
+    MAPPED_FILE mapping;
+    BOOLEAN mapped = FALSE;
+    FILE *traceFile = NULL;
+    const char *decodePath = NULL;
+    const char *columnExpression = NULL;
+    const char *resultPath = NULL;
+    BOOLEAN binaryColumns = FALSE;
+    BOOLEAN optimized = FALSE;
+    long cacheMegabytes = 0;
+    BOOLEAN native = FALSE;
+    BOOLEAN verify = FALSE;
+    const char *socketPath = NULL;
+    BOOLEAN stream = FALSE;
+    const char *metricsPath = NULL;
+    int metricsInterval = 0;
+    BOOLEAN explain = FALSE;
+    JIT_PROGRAM jit = {NULL, NULL, 0};
+    CACHE cache;
+    CACHE_STATS stats;
+    VERIFY_STATS verifyStats;
+    int skipped;
 
-    // Operand stack keeps numbers in the expression
-    STACK *operand;
-    operand = (STACK *) malloc(sizeof(STACK));
+    // Command line options
+    while ((option = getopt(argc, (char *const *) argv, "bp:j:Hut:d:c:ro:OC:JVS:sm:i:e")) != -1) {
+        switch (option) {
+            case 'b':
+                batch = TRUE;
+                break;
+            case 'p':
+                preparedExpression = optarg;
+                break;
+            case 'j':
+                threadCount = atoi(optarg);
+                break;
+            case 'H':
+                hugePages = TRUE;
+                break;
+            case 'u':
+                checked = FALSE;
+                break;
+            case 't':
+                traceFile = fopen(optarg, "wb");
+                if (traceFile == NULL) {
+                    perror("Trace file could not opened");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'd':
+                decodePath = optarg;
+                break;
+            case 'c':
+                columnExpression = optarg;
+                break;
+            case 'r':
+                binaryColumns = TRUE;
+                break;
+            case 'o':
+                resultPath = optarg;
+                break;
+            case 'O':
+                optimized = TRUE;
+                break;
+            case 'C':
+                cacheMegabytes = atol(optarg);
+                break;
+            case 'J':
+                native = TRUE;
+                break;
+            case 'V':
+                verify = TRUE;
+                break;
+            case 'S':
+                socketPath = optarg;
+                break;
+            case 's':
+                stream = TRUE;
+                break;
+            case 'm':
+                metricsPath = optarg;
+                break;
+            case 'i':
+                metricsInterval = atoi(optarg);
+                break;
+            case 'e':
+                explain = TRUE;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-H] [-u] [-t trace] [-m metrics [-i seconds]] [-b [-e] [-j threads] [-C megabytes] | [-O] [-J] -p expression] [file]\n", argv[0]);
+                fprintf(stderr, "       %s [-u] [-O] -c expression [-r] [-o result] [file]\n", argv[0]);
+                fprintf(stderr, "       %s [-u] [-O] -V [file]\n", argv[0]);
+                fprintf(stderr, "       %s [-u] [-e] [-j threads] -s [file]\n", argv[0]);
+                fprintf(stderr, "       %s [-u] [-j threads] [-C megabytes] -S socket\n", argv[0]);
+                fprintf(stderr, "       %s -d trace\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
 
-    // Error handling
-    if (operand == NULL) {
+    // Metrics writer is started before any other thread, so only it receives SIGUSR1
+    if (metricsPath != NULL) {
+        if (!startMetricsWriter(metricsPath, metricsInterval)) {
+            perror("Metrics writer could not started");
+            exit(EXIT_FAILURE);
+        }
+        // Last snapshot is written on every way out of the program
+        atexit(stopMetrics);
+    }
+
+    // Decoding a trace file does not evaluate anything
+    if (decodePath != NULL) {
+        input = fopen(decodePath, "rb");
+        if (input == NULL) {
+            perror("Trace file could not opened");
+            exit(EXIT_FAILURE);
+        }
+        batch = traceDecode(input, stdout);
+        fclose(input);
+        if (!batch) {
+            fprintf(stderr, "Error: Malformed trace file: %s\n", decodePath);
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    // Batch mode input is opened before any allocation
+    if (batch || verify || stream || (preparedExpression != NULL) || (columnExpression != NULL)) {
+        if ((optind < argc) && (strcmp(argv[optind], "-") != 0))
+            input = fopen(argv[optind], (columnExpression != NULL) ? "rb" : "r");
+        else
+            input = stdin;
+
+        // Error handling
+        if (input == NULL) {
+            errnum = errno;
+            perror("Input file could not opened");
+            fprintf(stderr, "Error opening file: %s\n", strerror(errnum));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Arena owns all memory of the evaluation, it is released at once
+    if (initArena(&arena, MAIN_ARENA_SIZE, hugePages) == FALSE) {
         errnum = errno;
         fprintf(stderr, "Error No: %d\n", errno);
         perror("Memory could not allocated");
         fprintf(stderr, "Error memory allocation: %s\n", strerror(errnum));
-        free(operand);
         exit(EXIT_FAILURE);
     }
 
-    // Operator stack keeps operators in the expression
-    STACK *operator;
-    operator = (STACK *) malloc(sizeof(STACK));
+    // Evaluator context owns the operand and operator stacks
+    EVALUATOR *evaluator;
+    evaluator = (EVALUATOR *) arenaAlloc(&arena, sizeof(EVALUATOR));
 
     // Error handling
-    if (operator == NULL) {
-        errnum = errno;
-        fprintf(stderr, "Error No: %d\n", errno);
-        perror("Memory could not allocated");
-        fprintf(stderr, "Error memory allocation: %s\n", strerror(errnum));
-        free(operand);
-        free(operator);
+    if (evaluator == NULL) {
+        fprintf(stderr, "Error memory allocation: arena is too small\n");
+        deleteArena(&arena);
         exit(EXIT_FAILURE);
     }
+    initEvaluatorArena(evaluator, &arena);
 
-    // Initializing of the stacks.
-    initStack(operand, INT);
-    initStack(operator, CHAR);
+    // Prepared mode compiles the expression given as argument
+    if ((preparedExpression != NULL) && (compileProgram(preparedExpression, &program, &arena) == FALSE)) {
+        fprintf(stderr, "Error: Invalid expression: %s\n", preparedExpression);
+        deleteArena(&arena);
+        exit(EXIT_FAILURE);
+    }
+    if ((preparedExpression != NULL) && optimized)
+        optimize(&program, checked);
+    if ((preparedExpression != NULL) && native && !jitCompile(&program, checked, &jit))
+        fprintf(stderr, "JIT: expression is not translated, it is interpreted\n");
 
-    // Taking expression from user
-    printf("Enter arithmetic expression: \n");
-    fgets(expression, MAX_INPUT_SIZE, stdin);
-    printf("\nYou entered: %s", expression);
+    // Steps are recorded when they are written to a trace file
+    evaluator->verbose = (traceFile != NULL) ? TRUE : FALSE;
+    evaluator->checked = checked;
+    evaluator->explain = explain;
+
+    // Differential test of the JIT against the evaluator
+    if (verify) {
+        errnum = verifyBatch(input, stdout, optimized, evaluator, &verifyStats);
+        if (errnum < 0)
+            fprintf(stderr, "Error: JIT is not available on this platform\n");
+        else
+            fprintf(stderr, "JIT check: %d lines, %d compiled, %d mismatches\n",
+                    verifyStats.lines, verifyStats.compiled, verifyStats.mismatches);
+        if (input != stdin)
+            fclose(input);
+        deleteEvaluator(evaluator);
+        deleteArena(&arena);
+        return (errnum == 0) ? 0 : EXIT_FAILURE;
+    }
+
+    // Streaming mode evaluates the whole input as one expression
+    if (stream) {
+        batch = evaluateStream(input, threadCount, evaluator);
+        if (input != stdin)
+            fclose(input);
+        deleteEvaluator(evaluator);
+        deleteArena(&arena);
+        return batch ? 0 : EXIT_FAILURE;
+    }
+
+    // Columnar mode evaluates the expression over whole columns
+    if (columnExpression != NULL) {
+        batch = evaluateColumnFile(columnExpression, input, binaryColumns, resultPath, optimized, evaluator,
+                                   &arena);
+        if (input != stdin)
+            fclose(input);
+        if (traceFile != NULL)
+            fclose(traceFile);
+        deleteEvaluator(evaluator);
+        deleteArena(&arena);
+        return batch ? 0 : EXIT_FAILURE;
+    }
+
+    // Batch and daemon workers share one cache, its budget is given in MiB
+    if ((batch || (socketPath != NULL)) && (cacheMegabytes > 0)) {
+        if (!initCache(&cache, (size_t) cacheMegabytes * 1024 * 1024)) {
+            fprintf(stderr, "Error memory allocation: cache could not be created\n");
+            deleteArena(&arena);
+            exit(EXIT_FAILURE);
+        }
+        evaluator->cache = &cache;
+    }
+
+    // Daemon mode serves requests until it is stopped by SIGINT or SIGTERM
+    if (socketPath != NULL) {
+        errnum = runDaemon(socketPath, threadCount, evaluator);
+        if (errnum != 0)
+            perror("Daemon could not started");
+        if (evaluator->cache != NULL)
+            deleteCache(&cache);
+        deleteEvaluator(evaluator);
+        deleteArena(&arena);
+        return (errnum == 0) ? 0 : EXIT_FAILURE;
+    }
 
-    // Evaluating and printing the result
-    result = evaluateExpression(expression, operand, operator);
-    printf("\nResult of the arithmetic expression is: %d\n", result);
+    // Regular input files are mapped and evaluated in place, pipes are read line by line
+    if (batch && (input != NULL))
+        mapped = mapInput(input, &mapping);
+
+    // Evaluating every line of the input, stacks are reused
+    if (input != NULL) {
+        if (preparedExpression != NULL) {
+            errnum = executeBatch(&program, jit.function, input, stdout, evaluator, &skipped);
+            if (skipped > 0)
+                fprintf(stderr, "Prepared: %d lines have fewer than %d parameters, their results are blank\n",
+                        skipped, program.paramCount);
+        }
+        else if (threadCount > 1)
+            errnum = evaluateParallelBatch(input, mapped ? &mapping : NULL, stdout, threadCount, hugePages,
+                                           evaluator);
+        else if (mapped)
+            errnum = evaluateMappedBatch(&mapping, stdout, evaluator);
+        else
+            errnum = evaluateBatch(input, stdout, evaluator);
+        // Batch functions return -1 when memory or input ran out before the end of the input
+        if (errnum < 0)
+            fprintf(stderr, "Error: batch is not completed, memory could not allocated or input could not read\n");
+        if (evaluator->cache != NULL) {
+            cacheStats(&cache, &stats);
+            fprintf(stderr, "Cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions, "
+                            "%zu entries, %zu bytes\n",
+                    stats.hits, stats.misses, stats.evictions, stats.entries, stats.bytes);
+            deleteCache(&cache);
+        }
+        jitDelete(&jit);
+        if (mapped)
+            unmapInput(&mapping);
+        if (input != stdin)
+            fclose(input);
+        if ((traceFile != NULL) && !traceWrite(traceFile))
+            perror("Trace file could not written");
+        if (traceFile != NULL)
+            fclose(traceFile);
+        traceShutdown();
+        deleteEvaluator(evaluator);
+        deleteArena(&arena);
+        return (errnum < 0) ? EXIT_FAILURE : 0;
+    }
+
+    // Taking expression from user, a line longer than the buffer is evaluated part by part
+    // Evaluating and printing the result, stack steps are printed from the trace
+    printf("Enter arithmetic expression: \n");
+    evaluator->verbose = TRUE;
+    beginEvaluation(evaluator);
+    for (part = 0; fgets(expression, MAX_INPUT_SIZE, stdin) != NULL; part++) {
+        printf((part == 0) ? "\nYou entered: %s" : "%s", expression);
+        // Line terminator is not fed, so an error at the end is at the length of the expression
+        feedEvaluation(expression, strcspn(expression, "\n"), evaluator);
+        if (strchr(expression, '\n') != NULL)
+            break;
+    }
+    result = endEvaluation(evaluator);
+    traceDecodeThread(stdout);
+    if (traceFile != NULL) {
+        traceWrite(traceFile);
+        fclose(traceFile);
+    }
+    traceShutdown();
+    if (evaluator->error)
+        printf("\nError: %s at offset %zu\n", evalStatusString(evaluator->status), evaluator->errorOffset);
+    else
+        printf("\nResult of the arithmetic expression is: %" PRId64 "\n", result);
+    errnum = evaluator->invalid ? EXIT_FAILURE : 0;
 
     // Preventing memory leaks
-    finalize(operand, operator);
+    deleteEvaluator(evaluator);
+    deleteArena(&arena);
 
-    // Indicates successful termination
-    return 0;
+    // Expression with an invalid character fails the program
+    return errnum;
 }
\ No newline at end of file
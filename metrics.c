@@ -0,0 +1,531 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+/*
+ * Counter block of one thread.
+ * Blocks are never freed while the process runs. When a thread exits its block
+ * goes to the free list and the next new thread goes on counting into it,
+ * so totals are kept and short lived threads do not grow the list.
+ * next links all blocks of the process, free links the unused ones.
+ */
+typedef struct METRICS_BLOCK {
+    METRICS_COUNTERS counters;
+    struct METRICS_BLOCK *next;
+    struct METRICS_BLOCK *free;
+} METRICS_BLOCK;
+
+/*
+ * Metrics writer thread.
+ * path is the snapshot file, its format is selected by its extension.
+ * A snapshot is written every interval seconds and whenever SIGUSR1 is received,
+ * stop is set before the last snapshot, failures counts snapshots that could not be written.
+ */
+typedef struct {
+    pthread_t thread;
+    const char *path;
+    int interval;
+    int failures;
+    BOOLEAN stop;
+    BOOLEAN running;
+} METRICS_WRITER;
+
+// Snapshot quantiles of the latency histogram
+static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+#define QUANTILE_COUNT ((int) (sizeof(QUANTILES) / sizeof(QUANTILES[0])))
+
+// Token type names, indexed by enum CHAR_TYPE
+static const char *const TOKEN_NAMES[] = {"space", "digit", "punctuation", "wrong"};
+
+const unsigned char METRICS_TOKEN_TYPE[] = {DIGIT, PUNCTUATION, WRONG};
+
+__thread METRICS_COUNTERS *metricsActive = NULL;
+BOOLEAN metricsEnabled = FALSE;
+
+static __thread METRICS_BLOCK *metricsBlock = NULL;
+static __thread uint64_t metricsStart = 0;
+
+static METRICS_BLOCK *metricsBlocks = NULL;
+static METRICS_BLOCK *metricsFree = NULL;
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t metricsKey;
+static pthread_once_t metricsOnce = PTHREAD_ONCE_INIT;
+static METRICS_WRITER metricsWriter = {0};
+
+/**
+ * nowNanoseconds function
+ * Reads the monotonic clock
+ * @return time in nanoseconds
+ */
+static inline uint64_t nowNanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+
+
+/**
+ * releaseBlock function
+ * Thread exit destructor, puts the block of the thread to the free list
+ * @param block is the block of the exiting thread
+ */
+static void releaseBlock(void *block) {
+    pthread_mutex_lock(&metricsLock);
+    ((METRICS_BLOCK *) block)->free = metricsFree;
+    metricsFree = (METRICS_BLOCK *) block;
+    pthread_mutex_unlock(&metricsLock);
+}
+
+
+
+/**
+ * createKey function
+ * Creates the thread key whose destructor releases blocks
+ */
+static void createKey(void) {
+    pthread_key_create(&metricsKey, releaseBlock);
+}
+
+
+
+/**
+ * blockOfThread function
+ * Finds the block of the calling thread, takes one from the free list
+ * or allocates a new one on first use
+ * @return pointer to block, NULL if it could not be allocated
+ */
+static METRICS_BLOCK *blockOfThread(void) {
+    METRICS_BLOCK *block = metricsBlock;
+
+    if (block != NULL)
+        return block;
+    pthread_once(&metricsOnce, createKey);
+    pthread_mutex_lock(&metricsLock);
+    block = metricsFree;
+    if (block != NULL) {
+        metricsFree = block->free;
+    } else {
+        block = (METRICS_BLOCK *) calloc(1, sizeof(METRICS_BLOCK));
+        if (block != NULL) {
+            block->next = metricsBlocks;
+            metricsBlocks = block;
+        }
+    }
+    pthread_mutex_unlock(&metricsLock);
+    if (block != NULL)
+        pthread_setspecific(metricsKey, block);
+    metricsBlock = block;
+    return block;
+}
+
+
+
+/**
+ * metricsEnable function
+ * Starts collecting metrics, evaluations that begin after the call are counted
+ */
+void metricsEnable(void) {
+    __atomic_store_n(&metricsEnabled, TRUE, __ATOMIC_RELAXED);
+}
+
+
+
+/**
+ * metricsBegin function
+ * Starts counting an evaluation into the counters of the calling thread and its latency
+ * @param e is the pointer to evaluator context
+ */
+void metricsBegin(EVALUATOR *e) {
+    METRICS_BLOCK *block = blockOfThread();
+
+    metricsActive = (block != NULL) ? &block->counters : NULL;
+    e->metrics = metricsActive;
+    if (block != NULL)
+        metricsStart = nowNanoseconds();
+}
+
+
+
+/**
+ * metricsEnd function
+ * Counts a finished evaluation and adds its latency to the histogram
+ * @param c is the pointer to counters of the evaluation
+ * @param error is TRUE if the evaluation failed
+ */
+void metricsEnd(METRICS_COUNTERS *c, BOOLEAN error) {
+    uint64_t latency = nowNanoseconds() - metricsStart;
+    int bucket = metricsBucket(latency);
+
+    METRICS_ADD(c->expressions, 1);
+    METRICS_ADD(c->errors, error ? 1 : 0);
+    METRICS_ADD(c->latencySum, latency);
+    METRICS_ADD(c->latency[bucket], 1);
+}
+
+
+
+/**
+ * metricsRows function
+ * Counts the rows of a columnar run as evaluations. Rows are executed a block at a time,
+ * so they have no latency of their own and the histogram is left as it is.
+ * @param rows is the number of rows
+ * @param errors is the number of failed rows
+ */
+void metricsRows(uint64_t rows, uint64_t errors) {
+    METRICS_BLOCK *block = blockOfThread();
+
+    if (block == NULL)
+        return;
+    METRICS_ADD(block->counters.expressions, rows);
+    METRICS_ADD(block->counters.errors, errors);
+}
+
+
+
+/**
+ * metricsBucket function
+ * Finds the histogram bucket of a value. Values below 2^METRICS_PRECISION_BITS have a bucket each,
+ * above that every power of two is split into METRICS_SUB_BUCKETS buckets of equal width.
+ * @param value is the sample
+ * @return index of the bucket
+ */
+int metricsBucket(uint64_t value) {
+    int msb, shift;
+
+    if (value < (1u << METRICS_PRECISION_BITS))
+        return (int) value;
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - METRICS_PRECISION_BITS + 1;
+    return shift * METRICS_SUB_BUCKETS + (int) (value >> shift);
+}
+
+
+
+/**
+ * metricsBucketHigh function
+ * Finds the highest value of a histogram bucket
+ * @param bucket is the index of the bucket
+ * @return highest value counted in the bucket
+ */
+uint64_t metricsBucketHigh(int bucket) {
+    int shift;
+
+    if (bucket < (1 << METRICS_PRECISION_BITS))
+        return (uint64_t) bucket;
+    shift = bucket / METRICS_SUB_BUCKETS - 1;
+    return (((uint64_t) (bucket % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS) + 1) << shift) - 1;
+}
+
+
+
+/**
+ * metricsSnapshot function
+ * Merges the counters of every thread, counters go on while they are read,
+ * so every counter is exact but they may be taken at slightly different times
+ * @param total is the pointer to merged counters
+ */
+void metricsSnapshot(METRICS_COUNTERS *total) {
+    const METRICS_BLOCK *block;
+    const METRICS_COUNTERS *c;
+    uint64_t high;
+    int i;
+
+    memset(total, 0, sizeof(METRICS_COUNTERS));
+    pthread_mutex_lock(&metricsLock);
+    for (block = metricsBlocks; block != NULL; block = block->next) {
+        c = &block->counters;
+        total->expressions += __atomic_load_n(&c->expressions, __ATOMIC_RELAXED);
+        total->errors += __atomic_load_n(&c->errors, __ATOMIC_RELAXED);
+        for (i = 0; i <= WRONG; i++)
+            total->tokens[i] += __atomic_load_n(&c->tokens[i], __ATOMIC_RELAXED);
+        for (i = 0; i < 256; i++)
+            total->operations[i] += __atomic_load_n(&c->operations[i], __ATOMIC_RELAXED);
+        high = __atomic_load_n(&c->operandHigh, __ATOMIC_RELAXED);
+        total->operandHigh = (high > total->operandHigh) ? high : total->operandHigh;
+        high = __atomic_load_n(&c->operatorHigh, __ATOMIC_RELAXED);
+        total->operatorHigh = (high > total->operatorHigh) ? high : total->operatorHigh;
+        total->rejections += __atomic_load_n(&c->rejections, __ATOMIC_RELAXED);
+        total->latencySum += __atomic_load_n(&c->latencySum, __ATOMIC_RELAXED);
+        for (i = 0; i < METRICS_BUCKETS; i++)
+            total->latency[i] += __atomic_load_n(&c->latency[i], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&metricsLock);
+}
+
+
+
+/**
+ * latencyQuantile function
+ * Finds a quantile of the latency histogram, it is the highest value of the bucket holding it
+ * @param c is the pointer to merged counters
+ * @param count is the number of samples in the histogram
+ * @param q is the quantile between 0 and 1
+ * @return latency in nanoseconds, 0 when there are no samples
+ */
+static uint64_t latencyQuantile(const METRICS_COUNTERS *c, uint64_t count, double q) {
+    uint64_t rank = (uint64_t) (q * (double) count);
+    uint64_t seen = 0;
+    int i;
+
+    if (count == 0)
+        return 0;
+    if (rank >= count)
+        rank = count - 1;
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        seen += c->latency[i];
+        if (seen > rank)
+            return metricsBucketHigh(i);
+    }
+    return metricsBucketHigh(METRICS_BUCKETS - 1);
+}
+
+
+
+/**
+ * writeLabel function
+ * Writes an operator character as a quoted JSON string or Prometheus label value
+ * @param out is the output stream
+ * @param c is the operator character
+ */
+static void writeLabel(FILE *out, char c) {
+    if ((c == '"') || (c == '\\'))
+        fprintf(out, "\"\\%c\"", c);
+    else if ((unsigned char) c < 0x20 || (unsigned char) c >= 0x7f)
+        fprintf(out, "\"\\u%04x\"", (unsigned char) c);
+    else
+        fprintf(out, "\"%c\"", c);
+}
+
+
+
+/**
+ * writeJson function
+ * Writes a snapshot as one JSON object
+ * @param out is the output stream
+ * @param c is the pointer to merged counters
+ * @param count is the number of latency samples
+ */
+static void writeJson(FILE *out, const METRICS_COUNTERS *c, uint64_t count) {
+    BOOLEAN first = TRUE;
+    int i;
+
+    fprintf(out, "{\n  \"expressions\": %" PRIu64 ",\n  \"errors\": %" PRIu64 ",\n  \"tokens\": {",
+            c->expressions, c->errors);
+    for (i = 0; i <= WRONG; i++)
+        fprintf(out, "%s\"%s\": %" PRIu64, (i == 0) ? "" : ", ", TOKEN_NAMES[i], c->tokens[i]);
+    fprintf(out, "},\n  \"operations\": {");
+    for (i = 0; i < 256; i++) {
+        if (c->operations[i] == 0)
+            continue;
+        fprintf(out, first ? "" : ", ");
+        writeLabel(out, (char) i);
+        fprintf(out, ": %" PRIu64, c->operations[i]);
+        first = FALSE;
+    }
+    fprintf(out, "},\n  \"operandStackHighWater\": %" PRIu64 ",\n  \"operatorStackHighWater\": %" PRIu64
+                 ",\n  \"stackRejections\": %" PRIu64 ",\n",
+            c->operandHigh, c->operatorHigh, c->rejections);
+    fprintf(out, "  \"latencyNanoseconds\": {\"count\": %" PRIu64 ", \"sum\": %" PRIu64, count, c->latencySum);
+    for (i = 0; i < QUANTILE_COUNT; i++)
+        fprintf(out, ", \"p%g\": %" PRIu64, QUANTILES[i] * 100, latencyQuantile(c, count, QUANTILES[i]));
+    fprintf(out, ", \"max\": %" PRIu64 ",\n    \"buckets\": [", latencyQuantile(c, count, 1.0));
+    first = TRUE;
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        if (c->latency[i] == 0)
+            continue;
+        fprintf(out, "%s[%" PRIu64 ", %" PRIu64 "]", first ? "" : ", ", metricsBucketHigh(i), c->latency[i]);
+        first = FALSE;
+    }
+    fprintf(out, "]}\n}\n");
+}
+
+
+
+/**
+ * writePrometheus function
+ * Writes a snapshot in the Prometheus text exposition format
+ * @param out is the output stream
+ * @param c is the pointer to merged counters
+ * @param count is the number of latency samples
+ */
+static void writePrometheus(FILE *out, const METRICS_COUNTERS *c, uint64_t count) {
+    int i;
+
+    fprintf(out, "# HELP expeval_expressions_total Expressions evaluated by the stack evaluator.\n"
+                 "# TYPE expeval_expressions_total counter\n"
+                 "expeval_expressions_total %" PRIu64 "\n"
+                 "# HELP expeval_expression_errors_total Expressions that failed.\n"
+                 "# TYPE expeval_expression_errors_total counter\n"
+                 "expeval_expression_errors_total %" PRIu64 "\n"
+                 "# HELP expeval_tokens_total Tokens read by type.\n"
+                 "# TYPE expeval_tokens_total counter\n", c->expressions, c->errors);
+    for (i = 0; i <= WRONG; i++)
+        fprintf(out, "expeval_tokens_total{type=\"%s\"} %" PRIu64 "\n", TOKEN_NAMES[i], c->tokens[i]);
+    fprintf(out, "# HELP expeval_operations_total Operations executed by operator.\n"
+                 "# TYPE expeval_operations_total counter\n");
+    for (i = 0; i < 256; i++) {
+        if (c->operations[i] == 0)
+            continue;
+        fprintf(out, "expeval_operations_total{operator=");
+        writeLabel(out, (char) i);
+        fprintf(out, "} %" PRIu64 "\n", c->operations[i]);
+    }
+    fprintf(out, "# HELP expeval_stack_high_water Highest depth the evaluator stacks reached.\n"
+                 "# TYPE expeval_stack_high_water gauge\n"
+                 "expeval_stack_high_water{stack=\"operand\"} %" PRIu64 "\n"
+                 "expeval_stack_high_water{stack=\"operator\"} %" PRIu64 "\n"
+                 "# HELP expeval_stack_rejections_total Pushes refused by a full stack.\n"
+                 "# TYPE expeval_stack_rejections_total counter\n"
+                 "expeval_stack_rejections_total %" PRIu64 "\n"
+                 "# HELP expeval_latency_seconds Evaluation latency.\n"
+                 "# TYPE expeval_latency_seconds summary\n",
+            c->operandHigh, c->operatorHigh, c->rejections);
+    for (i = 0; i < QUANTILE_COUNT; i++)
+        fprintf(out, "expeval_latency_seconds{quantile=\"%g\"} %.9f\n", QUANTILES[i],
+                (double) latencyQuantile(c, count, QUANTILES[i]) / 1e9);
+    fprintf(out, "expeval_latency_seconds_sum %.9f\nexpeval_latency_seconds_count %" PRIu64 "\n",
+            (double) c->latencySum / 1e9, count);
+}
+
+
+
+/**
+ * metricsWrite function
+ * Writes a snapshot of the merged counters
+ * @param out is the output stream
+ * @param format is the snapshot format
+ * @return TRUE if the snapshot is written else FALSE
+ */
+BOOLEAN metricsWrite(FILE *out, enum METRICS_FORMAT format) {
+    METRICS_COUNTERS *c = (METRICS_COUNTERS *) malloc(sizeof(METRICS_COUNTERS));
+    uint64_t count = 0;
+    int i;
+
+    if (c == NULL)
+        return FALSE;
+    metricsSnapshot(c);
+    // Samples are counted from the histogram, so quantiles and count agree
+    for (i = 0; i < METRICS_BUCKETS; i++)
+        count += c->latency[i];
+    if (format == METRICS_JSON)
+        writeJson(out, c, count);
+    else
+        writePrometheus(out, c, count);
+    free(c);
+    return (ferror(out) == 0) ? TRUE : FALSE;
+}
+
+
+
+/**
+ * metricsWriteFile function
+ * Writes a snapshot to a file, JSON when its name ends with .json and Prometheus text otherwise.
+ * The snapshot is written to a temporary file renamed over the path,
+ * so readers of the file never see a partial snapshot.
+ * @param path is the snapshot file
+ * @return TRUE if the snapshot is written else FALSE
+ */
+BOOLEAN metricsWriteFile(const char *path) {
+    size_t len = strlen(path);
+    enum METRICS_FORMAT format = ((len >= 5) && (strcmp(path + len - 5, ".json") == 0)) ? METRICS_JSON
+                                                                                      : METRICS_PROMETHEUS;
+    char *temporary = (char *) malloc(len + 5);
+    FILE *out;
+    BOOLEAN ok;
+
+    if (temporary == NULL)
+        return FALSE;
+    memcpy(temporary, path, len);
+    memcpy(temporary + len, ".tmp", 5);
+    out = fopen(temporary, "w");
+    ok = (out != NULL) && metricsWrite(out, format);
+    if ((out != NULL) && (fclose(out) != 0))
+        ok = FALSE;
+    if (ok && (rename(temporary, path) != 0))
+        ok = FALSE;
+    if (!ok && (out != NULL))
+        remove(temporary);
+    free(temporary);
+    return ok;
+}
+
+
+
+/**
+ * metricsWriterMain function
+ * Writer thread, writes a snapshot every interval and on every SIGUSR1
+ * until it is stopped, the last snapshot is written after the stop
+ * @param arg is the pointer to writer
+ * @return NULL
+ */
+static void *metricsWriterMain(void *arg) {
+    METRICS_WRITER *w = (METRICS_WRITER *) arg;
+    struct timespec timeout = {w->interval, 0};
+    sigset_t set;
+    BOOLEAN last;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    for (;;) {
+        if ((sigtimedwait(&set, NULL, &timeout) < 0) && (errno == EINTR))
+            continue;
+        last = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+        if (!metricsWriteFile(w->path))
+            w->failures++;
+        if (last)
+            break;
+    }
+    return NULL;
+}
+
+
+
+/**
+ * startMetricsWriter function
+ * Enables metrics and starts the writer thread. SIGUSR1 is blocked in the calling thread,
+ * threads created after this call inherit the mask, so the signal reaches only the writer.
+ * It must be called before any other thread is started.
+ * @param path is the snapshot file
+ * @param interval is the number of seconds between snapshots
+ * @return TRUE if the writer is started else FALSE
+ */
+BOOLEAN startMetricsWriter(const char *path, int interval) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    metricsWriter.path = path;
+    metricsWriter.interval = (interval > 0) ? interval : METRICS_DEFAULT_INTERVAL;
+    metricsWriter.stop = FALSE;
+    metricsWriter.failures = 0;
+    metricsEnable();
+    if (pthread_create(&metricsWriter.thread, NULL, metricsWriterMain, &metricsWriter) != 0)
+        return FALSE;
+    metricsWriter.running = TRUE;
+    return TRUE;
+}
+
+
+
+/**
+ * stopMetricsWriter function
+ * Stops the writer thread after it writes the last snapshot
+ * @return number of snapshots that could not be written
+ */
+int stopMetricsWriter(void) {
+    if (!metricsWriter.running)
+        return 0;
+    __atomic_store_n(&metricsWriter.stop, TRUE, __ATOMIC_RELEASE);
+    pthread_kill(metricsWriter.thread, SIGUSR1);
+    pthread_join(metricsWriter.thread, NULL);
+    metricsWriter.running = FALSE;
+    return metricsWriter.failures;
+}
\ No newline at end of file
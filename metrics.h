@@ -0,0 +1,150 @@
+#ifndef EXPEVAL_METRICS_H
+#define EXPEVAL_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "stack.h"
+#include "tokenizer.h"
+
+/*
+ * Evaluator metrics, compiled in when METRICS is 1 and collected after metricsEnable.
+ * Every thread counts into its own block, blocks are merged when a snapshot is taken,
+ * so counting does not share cache lines or take locks.
+ */
+#ifndef METRICS
+#define METRICS 1
+#endif
+
+// Latency histogram keeps this many significant bits of every sample, values below 2^bits are exact
+#define METRICS_PRECISION_BITS 5
+#define METRICS_SUB_BUCKETS (1 << (METRICS_PRECISION_BITS - 1))
+#define METRICS_BUCKETS ((64 - METRICS_PRECISION_BITS + 2) * METRICS_SUB_BUCKETS)
+// Seconds between two snapshots of the metrics writer when no interval is given
+#define METRICS_DEFAULT_INTERVAL 10
+
+enum METRICS_FORMAT {
+    METRICS_JSON, METRICS_PROMETHEUS
+};
+
+/*
+ * Counters of the stack evaluator.
+ * expressions and errors count evaluations, errors include invalid characters.
+ * tokens is indexed by enum CHAR_TYPE, a run of spaces is one space token.
+ * operations is indexed by the operator character.
+ * operandHigh and operatorHigh are the highest top the stacks reached,
+ * rejections are pushes refused because the stack was full and could not grow.
+ * latency is a log linear histogram of evaluation times in nanoseconds, latencySum is their sum.
+ */
+typedef struct METRICS_COUNTERS {
+    uint64_t expressions;
+    uint64_t errors;
+    uint64_t tokens[WRONG + 1];
+    uint64_t operations[256];
+    uint64_t operandHigh;
+    uint64_t operatorHigh;
+    uint64_t rejections;
+    uint64_t latencySum;
+    uint64_t latency[METRICS_BUCKETS];
+} METRICS_COUNTERS;
+
+// Counters of the calling thread, NULL before its first counted evaluation
+extern __thread METRICS_COUNTERS *metricsActive;
+
+extern BOOLEAN metricsEnabled;
+
+// Counter type of every token type, indexed by enum TOKEN_TYPE
+extern const unsigned char METRICS_TOKEN_TYPE[];
+
+/*
+ * Counters are written only by their thread and read by snapshots of other threads,
+ * relaxed stores keep both sides free of locked instructions.
+ */
+#define METRICS_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+#define METRICS_MAX(field, value)                                               \
+    do {                                                                        \
+        if ((uint64_t) (value) > (field))                                       \
+            __atomic_store_n(&(field), (uint64_t) (value), __ATOMIC_RELAXED);   \
+    } while (0)
+
+/*
+ * Evaluator hooks. Counters of an evaluation are reached through e->metrics,
+ * it is set by METRICS_BEGIN while metrics are enabled, so a disabled evaluator
+ * pays one predicted branch on a field it already has in cache.
+ * METRICS_TOKEN counts a token and the spaces skipped before it, end is the end of the previous token.
+ * Compiled programs and cache hits are counted with METRICS_BEGIN and METRICS_END around the execution,
+ * METRICS_ROWS counts the rows of a columnar run, they have no latency samples.
+ */
+#if METRICS
+#define METRICS_BEGIN(e)                                                        \
+    do {                                                                        \
+        if (UNLIKELY(__atomic_load_n(&metricsEnabled, __ATOMIC_RELAXED)))       \
+            metricsBegin(e);                                                    \
+    } while (0)
+#define METRICS_END(e)                                                          \
+    do {                                                                        \
+        if (UNLIKELY((e)->metrics != NULL))                                     \
+            metricsEnd((e)->metrics, (e)->error);                               \
+    } while (0)
+#define METRICS_ROWS(rows, errors)                                              \
+    do {                                                                        \
+        if (UNLIKELY(__atomic_load_n(&metricsEnabled, __ATOMIC_RELAXED)))       \
+            metricsRows(rows, errors);                                          \
+    } while (0)
+#define METRICS_TOKEN(e, token, end)                                            \
+    do {                                                                        \
+        if (UNLIKELY((e)->metrics != NULL)) {                                   \
+            if ((token)->offset > (end))                                        \
+                METRICS_ADD((e)->metrics->tokens[SPACE], 1);                    \
+            METRICS_ADD((e)->metrics->tokens[METRICS_TOKEN_TYPE[(token)->type]], 1); \
+            (end) = (token)->offset + (token)->length;                          \
+        }                                                                       \
+    } while (0)
+#define METRICS_OPERATION(e, op)                                                \
+    do {                                                                        \
+        if (UNLIKELY((e)->metrics != NULL))                                     \
+            METRICS_ADD((e)->metrics->operations[(unsigned char) (op)], 1);     \
+    } while (0)
+#define METRICS_DEPTH(e, field, top)                                            \
+    do {                                                                        \
+        if (UNLIKELY((e)->metrics != NULL))                                     \
+            METRICS_MAX((e)->metrics->field, top);                              \
+    } while (0)
+#define METRICS_REJECT(c)                                                       \
+    do {                                                                        \
+        if ((c) != NULL)                                                        \
+            METRICS_ADD((c)->rejections, 1);                                    \
+    } while (0)
+#else
+#define METRICS_BEGIN(e) ((void) 0)
+#define METRICS_END(e) ((void) 0)
+#define METRICS_ROWS(rows, errors) ((void) 0)
+#define METRICS_TOKEN(e, token, end) ((void) 0)
+#define METRICS_OPERATION(e, op) ((void) 0)
+#define METRICS_DEPTH(e, field, top) ((void) 0)
+#define METRICS_REJECT(c) ((void) 0)
+#endif
+
+// Function prototypes
+void metricsEnable(void);
+
+void metricsBegin(EVALUATOR *e);
+
+void metricsEnd(METRICS_COUNTERS *c, BOOLEAN error);
+
+void metricsRows(uint64_t rows, uint64_t errors);
+
+int metricsBucket(uint64_t value);
+
+uint64_t metricsBucketHigh(int bucket);
+
+void metricsSnapshot(METRICS_COUNTERS *total);
+
+BOOLEAN metricsWrite(FILE *out, enum METRICS_FORMAT format);
+
+BOOLEAN metricsWriteFile(const char *path);
+
+BOOLEAN startMetricsWriter(const char *path, int interval);
+
+int stopMetricsWriter(void);
+
+#endif //EXPEVAL_METRICS_H
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "operators.h"
+
+/*
+ * Operators come in pairs. Wrapping variants compute in unsigned arithmetic,
+ * so overflow is defined and wraps around at 64 bits. Checked variants use
+ * the overflow builtins and or the overflow flag into error without branching.
+ * Division and remainder by zero set error in both variants and give the left operand
+ * or zero instead of trapping.
+ */
+
+/**
+ * applyNegate function
+ * @param b is not used
+ * @param a is the operand
+ * @param error is not used
+ * @return negative of the operand
+ */
+static VALUE applyNegate(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) b;
+    (void) error;
+    return (VALUE) (0 - (uint64_t) a);
+}
+
+
+
+static VALUE applyNegateChecked(VALUE b, VALUE a, BOOLEAN *error) {
+    VALUE result;
+    (void) b;
+    *error |= __builtin_sub_overflow((VALUE) 0, a, &result);
+    return result;
+}
+
+
+
+// Binary operators, b is the left operand and a is the right one
+static VALUE applyAdd(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return (VALUE) ((uint64_t) b + (uint64_t) a);
+}
+
+
+
+static VALUE applyAddChecked(VALUE b, VALUE a, BOOLEAN *error) {
+    VALUE result;
+    *error |= __builtin_add_overflow(b, a, &result);
+    return result;
+}
+
+
+
+static VALUE applySubtract(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return (VALUE) ((uint64_t) b - (uint64_t) a);
+}
+
+
+
+static VALUE applySubtractChecked(VALUE b, VALUE a, BOOLEAN *error) {
+    VALUE result;
+    *error |= __builtin_sub_overflow(b, a, &result);
+    return result;
+}
+
+
+
+static VALUE applyMultiply(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return (VALUE) ((uint64_t) b * (uint64_t) a);
+}
+
+
+
+static VALUE applyMultiplyChecked(VALUE b, VALUE a, BOOLEAN *error) {
+    VALUE result;
+    *error |= __builtin_mul_overflow(b, a, &result);
+    return result;
+}
+
+
+
+/**
+ * applyDivide function
+ * INT64_MIN / -1 wraps around to INT64_MIN, which is also the result of dividing by one
+ * @param b is the dividend
+ * @param a is the divisor
+ * @param error is the pointer to error flag, set when a is zero
+ * @return quotient, b when a is zero
+ */
+static VALUE applyDivide(VALUE b, VALUE a, BOOLEAN *error) {
+    BOOLEAN invalid = (a == 0) | ((b == INT64_MIN) & (a == -1));
+    *error |= (a == 0);
+    return b / (invalid ? 1 : a);
+}
+
+
+
+static VALUE applyDivideChecked(VALUE b, VALUE a, BOOLEAN *error) {
+    BOOLEAN invalid = (a == 0) | ((b == INT64_MIN) & (a == -1));
+    *error |= invalid;
+    return b / (invalid ? 1 : a);
+}
+
+
+
+/**
+ * applyModulo function
+ * INT64_MIN % -1 is zero, it is computed as a remainder of dividing by one
+ * @param b is the dividend
+ * @param a is the divisor
+ * @param error is the pointer to error flag, set when a is zero
+ * @return remainder, zero when a is zero
+ */
+static VALUE applyModulo(VALUE b, VALUE a, BOOLEAN *error) {
+    BOOLEAN invalid = (a == 0) | (a == -1);
+    *error |= (a == 0);
+    return b % (invalid ? 1 : a);
+}
+
+
+
+/**
+ * power function
+ * Integer exponentiation by squaring.
+ * Negative exponents give the integer part of the reciprocal.
+ * @param b is the base
+ * @param a is the exponent
+ * @param checked reports overflow when TRUE, otherwise the result wraps around
+ * @param error is the pointer to error flag
+ * @return b to the power of a
+ */
+static VALUE power(VALUE b, VALUE a, BOOLEAN checked, BOOLEAN *error) {
+    VALUE base = b;
+    VALUE result = 1;
+    BOOLEAN overflow = FALSE;
+
+    if (a < 0) {
+        *error |= (b == 0);
+        if (b == 1)
+            return 1;
+        if (b == -1)
+            return (a & 1) ? -1 : 1;
+        return 0;
+    }
+    while (a != 0) {
+        if (a & 1)
+            overflow |= __builtin_mul_overflow(result, base, &result);
+        a >>= 1;
+        // Square of the base is not needed after the last bit
+        if (a != 0)
+            overflow |= __builtin_mul_overflow(base, base, &base);
+    }
+    *error |= overflow & checked;
+    return result;
+}
+
+
+
+static VALUE applyPower(VALUE b, VALUE a, BOOLEAN *error) {
+    return power(b, a, FALSE, error);
+}
+
+
+
+static VALUE applyPowerChecked(VALUE b, VALUE a, BOOLEAN *error) {
+    return power(b, a, TRUE, error);
+}
+
+
+
+static VALUE applyAnd(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return b & a;
+}
+
+
+
+static VALUE applyOr(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return b | a;
+}
+
+
+
+static VALUE applyLess(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return b < a;
+}
+
+
+
+static VALUE applyGreater(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return b > a;
+}
+
+
+
+static VALUE applyEqual(VALUE b, VALUE a, BOOLEAN *error) {
+    (void) error;
+    return b == a;
+}
+
+
+
+/*
+ * Operator registry.
+ * Precedence from loose to tight: or, and, equal, less and greater, additive,
+ * multiplicative and modulo, power, unary minus
+ * Characters without an entry are not operators.
+ */
+const OPERATOR_INFO OPERATOR_TABLE[256] = {
+        ['|'] = {1, 2, LEFT_ASSOCIATIVE, OP_OR, {applyOr, applyOr}},
+        ['&'] = {2, 2, LEFT_ASSOCIATIVE, OP_AND, {applyAnd, applyAnd}},
+        ['='] = {3, 2, LEFT_ASSOCIATIVE, OP_EQUAL, {applyEqual, applyEqual}},
+        ['<'] = {4, 2, LEFT_ASSOCIATIVE, OP_LESS, {applyLess, applyLess}},
+        ['>'] = {4, 2, LEFT_ASSOCIATIVE, OP_GREATER, {applyGreater, applyGreater}},
+        ['+'] = {5, 2, LEFT_ASSOCIATIVE, OP_ADD, {applyAdd, applyAddChecked}},
+        ['-'] = {5, 2, LEFT_ASSOCIATIVE, OP_SUB, {applySubtract, applySubtractChecked}},
+        ['*'] = {6, 2, LEFT_ASSOCIATIVE, OP_MUL, {applyMultiply, applyMultiplyChecked}},
+        ['/'] = {6, 2, LEFT_ASSOCIATIVE, OP_DIV, {applyDivide, applyDivideChecked}},
+        ['%'] = {6, 2, LEFT_ASSOCIATIVE, OP_MOD, {applyModulo, applyModulo}},
+        ['^'] = {7, 2, RIGHT_ASSOCIATIVE, OP_POW, {applyPower, applyPowerChecked}},
+        [UNARY_MINUS] = {8, 1, RIGHT_ASSOCIATIVE, OP_NEG, {applyNegate, applyNegateChecked}}
+};
+
+const OPERATOR_FUNCTION OPCODE_FUNCTION[2][OPCODE_COUNT] = {
+        {
+                [OP_NEG] = applyNegate,
+                [OP_ADD] = applyAdd,
+                [OP_SUB] = applySubtract,
+                [OP_MUL] = applyMultiply,
+                [OP_DIV] = applyDivide,
+                [OP_MOD] = applyModulo,
+                [OP_POW] = applyPower,
+                [OP_AND] = applyAnd,
+                [OP_OR] = applyOr,
+                [OP_LESS] = applyLess,
+                [OP_GREATER] = applyGreater,
+                [OP_EQUAL] = applyEqual
+        },
+        {
+                [OP_NEG] = applyNegateChecked,
+                [OP_ADD] = applyAddChecked,
+                [OP_SUB] = applySubtractChecked,
+                [OP_MUL] = applyMultiplyChecked,
+                [OP_DIV] = applyDivideChecked,
+                [OP_MOD] = applyModulo,
+                [OP_POW] = applyPowerChecked,
+                [OP_AND] = applyAnd,
+                [OP_OR] = applyOr,
+                [OP_LESS] = applyLess,
+                [OP_GREATER] = applyGreater,
+                [OP_EQUAL] = applyEqual
+        }
+};
\ No newline at end of file
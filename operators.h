@@ -0,0 +1,99 @@
+#ifndef EXPEVAL_OPERATORS_H
+#define EXPEVAL_OPERATORS_H
+
+#include "stack.h"
+
+/*
+ * Instructions of a compiled expression.
+ * Program is in postfix(RPN) order, so executing it
+ * needs only the operand stack.
+ * OP_DUP, OP_DIV_SHIFT and OP_MOD_MASK are not written by the compiler, the optimizer
+ * uses them for strength reduction. OP_DUP pushes a copy of the top operand,
+ * OP_DIV_SHIFT and OP_MOD_MASK divide the top operand by 2 to the power of the instruction value.
+ * OPCODE_COUNT is the number of opcodes, it is not an instruction.
+ */
+enum OPCODE {
+    OP_CONST, OP_PARAM, OP_NEG, OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_MOD, OP_POW, OP_AND, OP_OR, OP_LESS, OP_GREATER, OP_EQUAL,
+    OP_DUP, OP_DIV_SHIFT, OP_MOD_MASK, OPCODE_COUNT
+};
+
+/*
+ * Order of operators with the same precedence.
+ * a - b - c is (a - b) - c, a ^ b ^ c is a ^ (b ^ c)
+ */
+enum ASSOCIATIVITY {
+    LEFT_ASSOCIATIVE, RIGHT_ASSOCIATIVE
+};
+
+/*
+ * Operator implementation, b is the left operand and a is the right one. Unary operators use only a.
+ * error is set when the operation overflows or divides by zero and it is never cleared,
+ * so a sequence of operations is checked once at the end.
+ */
+typedef VALUE (*OPERATOR_FUNCTION)(VALUE b, VALUE a, BOOLEAN *error);
+
+/*
+ * Operator registry entry.
+ * precedence is zero for characters that are not operators, bigger binds tighter
+ * arity is the number of operands the operator pops
+ * opcode is the program instruction of the operator
+ * apply holds the functions that compute the result, apply[FALSE] wraps around on overflow
+ * and apply[TRUE] reports overflow, so EVALUATOR.checked selects one without a branch
+ */
+typedef struct {
+    unsigned char precedence;
+    unsigned char arity;
+    enum ASSOCIATIVITY associativity;
+    enum OPCODE opcode;
+    OPERATOR_FUNCTION apply[2];
+} OPERATOR_INFO;
+
+// Operator stack symbol of the unary minus, binds tighter than any binary operator
+#define UNARY_MINUS '~'
+
+// Operator registry indexed by byte
+extern const OPERATOR_INFO OPERATOR_TABLE[256];
+
+// Operator functions indexed by checked flag and opcode, NULL for opcodes that are not operators
+extern const OPERATOR_FUNCTION OPCODE_FUNCTION[2][OPCODE_COUNT];
+
+/**
+ * operatorInfo function
+ * Finds the registry entry of a character
+ * @param c is the operator character
+ * @return pointer to registry entry, its precedence is zero if c is not an operator
+ */
+static inline const OPERATOR_INFO *operatorInfo(char c) {
+    return &OPERATOR_TABLE[(unsigned char) c];
+}
+
+
+
+/**
+ * shiftDivide function
+ * Divides by a power of two with a shift, rounding toward zero like the division operator.
+ * Negative dividends are biased by 2^shift - 1 before the arithmetic shift.
+ * @param b is the dividend
+ * @param shift is the exponent of the divisor, between 1 and 62
+ * @return quotient
+ */
+static inline VALUE shiftDivide(VALUE b, int shift) {
+    VALUE bias = (VALUE) ((uint64_t) (b >> 63) >> (64 - shift));
+    return (b + bias) >> shift;
+}
+
+
+
+/**
+ * maskModulo function
+ * Remainder of dividing by a power of two, it has the sign of the dividend like the remainder operator
+ * @param b is the dividend
+ * @param shift is the exponent of the divisor, between 1 and 62
+ * @return remainder
+ */
+static inline VALUE maskModulo(VALUE b, int shift) {
+    return (VALUE) ((uint64_t) b - ((uint64_t) shiftDivide(b, shift) << shift));
+}
+
+#endif //EXPEVAL_OPERATORS_H
\ No newline at end of file
@@ -0,0 +1,375 @@
+#include "optimize.h"
+#include <stdlib.h>
+
+/**
+ * isOperation function
+ * Tells whether an instruction computes something, constants, parameters and copies do not
+ * @param op is the opcode
+ * @return TRUE for operators else FALSE
+ */
+static BOOLEAN isOperation(enum OPCODE op) {
+    return (op != OP_CONST) && (op != OP_PARAM) && (op != OP_DUP);
+}
+
+
+
+/**
+ * isCommutative function
+ * @param op is the opcode of a binary operator
+ * @return TRUE if the operands of op can be swapped else FALSE
+ */
+static BOOLEAN isCommutative(enum OPCODE op) {
+    return (op == OP_ADD) || (op == OP_MUL) || (op == OP_AND) || (op == OP_OR) || (op == OP_EQUAL);
+}
+
+
+
+/**
+ * powerOfTwo function
+ * @param c is the value
+ * @return k when c is 2^k with k between 1 and 62, else 0
+ */
+static int powerOfTwo(VALUE c) {
+    if ((c < 2) || ((c & (c - 1)) != 0))
+        return 0;
+    return __builtin_ctzll((unsigned long long) c);
+}
+
+
+
+/**
+ * neverFails function
+ * Tells whether an operator can set the error flag for any operands.
+ * Wrapping arithmetic fails only on division by zero and zero to a negative power,
+ * checked arithmetic also on overflow.
+ * @param node is the node array
+ * @param n is the pointer to operator node
+ * @param checked is TRUE for checked arithmetic
+ * @return TRUE if the operator can not fail else FALSE
+ */
+static BOOLEAN neverFails(const NODE *node, const NODE *n, BOOLEAN checked) {
+    const NODE *r = (n->right >= 0) ? &node[n->right] : NULL;
+    BOOLEAN constant = (r != NULL) && (r->op == OP_CONST);
+
+    switch (n->op) {
+        case OP_NEG:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            return !checked;
+        case OP_DIV:
+            return constant && (r->value != 0) && (!checked || (r->value != -1));
+        case OP_MOD:
+            return constant && (r->value != 0);
+        case OP_POW:
+            return !checked && constant && (r->value >= 0);
+        default:
+            return TRUE;
+    }
+}
+
+
+
+/**
+ * makeConstant function
+ * Replaces a node with a literal, its operands are dropped
+ * @param n is the pointer to node
+ * @param value is the literal
+ */
+static void makeConstant(NODE *n, VALUE value) {
+    n->op = OP_CONST;
+    n->value = value;
+    n->left = -1;
+    n->right = -1;
+    n->safe = TRUE;
+}
+
+
+
+/**
+ * makeUnary function
+ * Replaces a binary node with a unary operator applied to its left operand
+ * @param n is the pointer to node
+ * @param op is the unary opcode
+ * @param value is the instruction value of the unary operator
+ */
+static void makeUnary(NODE *n, enum OPCODE op, VALUE value) {
+    n->op = op;
+    n->value = value;
+    n->right = -1;
+}
+
+
+
+/**
+ * simplify function
+ * Simplifies a node whose operands are already simplified.
+ * Constant operands are folded, identities such as x + 0, x * 1 and x | 0 return the other operand,
+ * annihilators such as x * 0 and x & 0 become constants when x can not fail,
+ * x * 2 and x ^ 2 reuse x with a duplicate instead of computing it twice,
+ * division and remainder by powers of two become shifts, and constants of
+ * additions are gathered, (x + 3) + 4 is x + 7.
+ * A rewrite is done only when it gives the same value and the same error flag for every input
+ * in the selected arithmetic, so folding an operation that fails is left to run time.
+ * @param node is the node array
+ * @param i is the index of the node
+ * @param checked is TRUE for checked arithmetic
+ * @return index of the node that replaces node i, it is i or one of its operands
+ */
+static int simplify(NODE *node, int i, BOOLEAN checked) {
+    NODE *n = &node[i];
+    NODE *l, *r;
+    BOOLEAN error = FALSE;
+    VALUE c, sum;
+    int k;
+
+    if ((n->op == OP_CONST) || (n->op == OP_PARAM)) {
+        n->safe = TRUE;
+        return i;
+    }
+    l = &node[n->left];
+
+    // Shifts come from an earlier pass, they can only be folded
+    if ((n->op == OP_DIV_SHIFT) || (n->op == OP_MOD_MASK)) {
+        if (l->op == OP_CONST)
+            makeConstant(n, (n->op == OP_DIV_SHIFT) ? shiftDivide(l->value, (int) n->value)
+                                                    : maskModulo(l->value, (int) n->value));
+        else
+            n->safe = l->safe;
+        return i;
+    }
+
+    // Unary minus
+    if (n->op == OP_NEG) {
+        if (l->op == OP_CONST) {
+            c = OPCODE_FUNCTION[checked][OP_NEG](0, l->value, &error);
+            if (!error) {
+                makeConstant(n, c);
+                return i;
+            }
+        }
+        // --x is x only when negating the minimum value wraps
+        if (!checked && (l->op == OP_NEG))
+            return l->left;
+        n->safe = l->safe && neverFails(node, n, checked);
+        return i;
+    }
+
+    // Constants of commutative operators are moved to the right
+    if (isCommutative(n->op) && (l->op == OP_CONST) && (node[n->right].op != OP_CONST)) {
+        k = n->left;
+        n->left = n->right;
+        n->right = k;
+        l = &node[n->left];
+    }
+    r = &node[n->right];
+
+    if ((l->op == OP_CONST) && (r->op == OP_CONST)) {
+        c = OPCODE_FUNCTION[checked][n->op](l->value, r->value, &error);
+        if (!error) {
+            makeConstant(n, c);
+            return i;
+        }
+    } else if (r->op == OP_CONST) {
+        c = r->value;
+        switch (n->op) {
+            case OP_SUB:
+                if (c == INT64_MIN)
+                    break;
+                // x - c is x + -c, so its constant can be gathered with other additions
+                n->op = OP_ADD;
+                r->value = -c;
+                return simplify(node, i, checked);
+            case OP_ADD:
+                if (c == 0)
+                    return n->left;
+                // Constants of the same sign overflow together, so checked arithmetic can gather them too
+                if ((l->op == OP_ADD) && (node[l->right].op == OP_CONST)
+                    && !__builtin_add_overflow(c, node[l->right].value, &sum)
+                    && (!checked || ((c ^ node[l->right].value) >= 0))) {
+                    r->value = sum;
+                    n->left = l->left;
+                    return simplify(node, i, checked);
+                }
+                break;
+            case OP_MUL:
+                if (c == 1)
+                    return n->left;
+                if ((c == 0) && l->safe) {
+                    makeConstant(n, 0);
+                    return i;
+                }
+                if (c == -1) {
+                    makeUnary(n, OP_NEG, 0);
+                    return simplify(node, i, checked);
+                }
+                if (c == 2) {
+                    n->op = OP_ADD;
+                    n->right = n->left;
+                }
+                break;
+            case OP_DIV:
+                if (c == 1)
+                    return n->left;
+                if (c == -1) {
+                    makeUnary(n, OP_NEG, 0);
+                    return simplify(node, i, checked);
+                }
+                if ((k = powerOfTwo(c)) != 0)
+                    makeUnary(n, OP_DIV_SHIFT, k);
+                break;
+            case OP_MOD:
+                if (((c == 1) || (c == -1)) && l->safe) {
+                    makeConstant(n, 0);
+                    return i;
+                }
+                if ((k = powerOfTwo(c)) != 0)
+                    makeUnary(n, OP_MOD_MASK, k);
+                break;
+            case OP_POW:
+                if (c == 1)
+                    return n->left;
+                if ((c == 0) && l->safe) {
+                    makeConstant(n, 1);
+                    return i;
+                }
+                if (c == 2) {
+                    n->op = OP_MUL;
+                    n->right = n->left;
+                }
+                break;
+            case OP_AND:
+                if (c == -1)
+                    return n->left;
+                if ((c == 0) && l->safe) {
+                    makeConstant(n, 0);
+                    return i;
+                }
+                break;
+            case OP_OR:
+                if (c == 0)
+                    return n->left;
+                if ((c == -1) && l->safe) {
+                    makeConstant(n, -1);
+                    return i;
+                }
+                break;
+            default:
+                break;
+        }
+    } else if (l->op == OP_CONST) {
+        // 0 - x is -x and 1 ^ x is 1 for every x
+        if ((n->op == OP_SUB) && (l->value == 0)) {
+            n->left = n->right;
+            makeUnary(n, OP_NEG, 0);
+            return simplify(node, i, checked);
+        }
+        if ((n->op == OP_POW) && (l->value == 1) && r->safe) {
+            makeConstant(n, 1);
+            return i;
+        }
+    }
+
+    n->safe = node[n->left].safe && ((n->right < 0) || node[n->right].safe) && neverFails(node, n, checked);
+    return i;
+}
+
+
+
+/**
+ * optimizeProgram function
+ * Optimization pass over a compiled program. The postfix code is turned into an expression tree,
+ * every node is simplified right after its operands, then the nodes that are still used are
+ * written back in place in their original order. A node comes after all nodes of its operands
+ * in that order, so the result is again a valid postfix program and it is never longer
+ * than the original one. The operand stack depth is computed again.
+ * The program gives the same results and the same errors in the arithmetic it is optimized for.
+ * @param p is the pointer to compiled program
+ * @param checked is TRUE when the program will run with checked arithmetic
+ * @return number of operations eliminated, -1 if memory could not allocated
+ */
+int optimizeProgram(PROGRAM *p, BOOLEAN checked) {
+    NODE *node;
+    char *used;
+    INT_STACK operand;
+    int i, root = -1, length = 0, depth = 0, before = 0, after = 0;
+
+    if (p->length == 0)
+        return 0;
+    node = (NODE *) malloc(p->length * sizeof(NODE));
+    used = (char *) calloc(p->length, 1);
+    if ((node == NULL) || (used == NULL) || !intStackInit(&operand, p->maxDepth, FALSE)) {
+        free(node);
+        free(used);
+        return -1;
+    }
+
+    // Building the tree, the stack holds simplified operands
+    for (i = 0; i < p->length; i++) {
+        node[i].op = p->code[i].op;
+        node[i].value = p->code[i].value;
+        node[i].left = -1;
+        node[i].right = -1;
+        // A copy is the same node pushed again
+        if (node[i].op == OP_DUP) {
+            intStackPushUnchecked(&operand, intStackPeekUnchecked(&operand));
+            continue;
+        }
+        if ((node[i].op != OP_CONST) && (node[i].op != OP_PARAM)) {
+            if ((node[i].op != OP_NEG) && (node[i].op != OP_DIV_SHIFT) && (node[i].op != OP_MOD_MASK))
+                node[i].right = intStackPopUnchecked(&operand);
+            node[i].left = intStackPopUnchecked(&operand);
+        }
+        before += isOperation(node[i].op);
+        intStackPushUnchecked(&operand, simplify(node, i, checked));
+    }
+    // A valid program leaves its root on the stack, anything else is left as it is
+    if (!intStackPop(&operand, &root) || !intStackIsEmpty(&operand)) {
+        intStackDelete(&operand);
+        free(node);
+        free(used);
+        return 0;
+    }
+    intStackDelete(&operand);
+
+    // Marking nodes reachable from the root, operands have smaller indexes than their operator
+    used[root] = TRUE;
+    for (i = root; i >= 0; i--) {
+        if (!used[i])
+            continue;
+        if (node[i].left >= 0)
+            used[node[i].left] = TRUE;
+        if (node[i].right >= 0)
+            used[node[i].right] = TRUE;
+    }
+
+    // Writing the program back, a shared operand is duplicated on the stack
+    p->maxDepth = 0;
+    for (i = 0; i <= root; i++) {
+        if (!used[i])
+            continue;
+        if ((node[i].right >= 0) && (node[i].right == node[i].left)) {
+            p->code[length].op = OP_DUP;
+            p->code[length].value = 0;
+            length++;
+            depth++;
+            if (depth > p->maxDepth)
+                p->maxDepth = depth;
+        }
+        if ((node[i].op == OP_CONST) || (node[i].op == OP_PARAM))
+            depth++;
+        else if (node[i].right >= 0)
+            depth--;
+        if (depth > p->maxDepth)
+            p->maxDepth = depth;
+        p->code[length].op = node[i].op;
+        p->code[length].value = node[i].value;
+        after += isOperation(node[i].op);
+        length++;
+    }
+    p->length = length;
+
+    free(node);
+    free(used);
+    return before - after;
+}
\ No newline at end of file
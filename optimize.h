@@ -0,0 +1,26 @@
+#ifndef EXPEVAL_OPTIMIZE_H
+#define EXPEVAL_OPTIMIZE_H
+
+#include "stack.h"
+#include "program.h"
+
+/*
+ * Expression tree node of the optimizer, built from the postfix program.
+ * op and value are the instruction, left and right are node indexes of the operands,
+ * -1 when there is no operand. Unary operators use only left.
+ * left equals right when the operand is computed once and duplicated.
+ * safe is TRUE when evaluating the subtree can never set the error flag,
+ * only safe subtrees can be dropped without changing the result.
+ */
+typedef struct {
+    enum OPCODE op;
+    VALUE value;
+    int left;
+    int right;
+    BOOLEAN safe;
+} NODE;
+
+// Function prototypes
+int optimizeProgram(PROGRAM *program, BOOLEAN checked);
+
+#endif //EXPEVAL_OPTIMIZE_H
\ No newline at end of file
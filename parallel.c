@@ -0,0 +1,710 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "operators.h"
+#include "tokenizer.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREPASS_X86
+#endif
+
+/*
+ * How the groups of the split level are reduced.
+ * Sums and products are reduced inside every group and the group results are combined,
+ * bitwise and and or are folded the same way. Other operators keep the values of their terms
+ * and they are folded in expression order by the calling thread.
+ */
+enum REDUCTION {
+    REDUCE_SUM, REDUCE_PRODUCT, REDUCE_BITWISE, REDUCE_SEQUENTIAL
+};
+
+/*
+ * State of the top level scan.
+ * depth is the parenthesis nesting depth.
+ * last is the last character that is not a space, 0 before the first one.
+ * Binary operators at depth 0 are reported to boundary, only the ones of the given precedence
+ * level or all of them when level is 0.
+ * malformed is set when the structure can not be split the way the evaluator would parse it,
+ * such expressions are evaluated by one thread.
+ */
+typedef struct {
+    int depth;
+    char last;
+    BOOLEAN malformed;
+    int level;
+    void (*boundary)(void *context, size_t pos, char op);
+    void *context;
+} SCAN;
+
+/*
+ * Split plan made by the prepass.
+ * Group k should end at target[k]. For every precedence level, split[level][k] is the first top level
+ * operator of that level at or after target[k] and next[level] is the number of targets it covers.
+ * ops[level] has a bit for every opcode found at depth 0, minLevel is the loosest level found.
+ */
+typedef struct {
+    size_t target[MAX_PARALLEL_GROUPS];
+    size_t split[PRECEDENCE_LEVELS][MAX_PARALLEL_GROUPS];
+    int next[PRECEDENCE_LEVELS];
+    unsigned ops[PRECEDENCE_LEVELS];
+    int targetCount;
+    int minLevel;
+} SPLIT_PLAN;
+
+/*
+ * One group of terms of the split level.
+ * Text of the group is [begin, end), groups after the first begin with the operator that joins them
+ * to the previous group.
+ * sum, low and high are the sum of the terms and the lowest and highest running sum, they show whether
+ * the running sum of the whole expression leaves the range of VALUE inside the group.
+ * product is the product of the terms. magnitude is the absolute value of the running product before
+ * the first zero term, it stops growing above 2^64, and sign is its sign. positive and negative tell
+ * the signs the running product takes while its absolute value equals magnitude, zero is set after a zero term.
+ * value is the bitwise fold of the terms, terms and ops keep every term and its operator for the
+ * sequential fold.
+ */
+typedef struct {
+    size_t begin;
+    size_t end;
+    __int128 sum;
+    __int128 low;
+    __int128 high;
+    VALUE product;
+    unsigned __int128 magnitude;
+    int sign;
+    BOOLEAN positive;
+    BOOLEAN negative;
+    BOOLEAN zero;
+    VALUE value;
+    VALUE_STACK terms;
+    CHAR_STACK ops;
+    int count;
+    BOOLEAN error;
+    BOOLEAN invalid;
+} __attribute__((aligned(CACHE_LINE_SIZE))) GROUP;
+
+/*
+ * Parallel evaluation of one expression shared by the workers.
+ * next is the claim counter of the groups, checked is the arithmetic of the evaluator.
+ */
+typedef struct {
+    const char *exp;
+    GROUP *groups;
+    int groupCount;
+    int level;
+    enum REDUCTION reduction;
+    BOOLEAN checked;
+    volatile int next __attribute__((aligned(CACHE_LINE_SIZE)));
+} PARALLEL_JOB;
+
+/*
+ * Term reader of one group, the scan reports the operators between the terms.
+ */
+typedef struct {
+    const PARALLEL_JOB *job;
+    GROUP *group;
+    EVALUATOR *evaluator;
+    size_t termStart;
+    char termOp;
+} TERM_READER;
+
+
+
+/**
+ * scanSymbol function
+ * Handles a character of the scan that is not a digit or a space.
+ * Operators at depth 0 are binary after a number or a closing parenthesis,
+ * anywhere else a minus is a unary minus that starts a term and any other operator is malformed.
+ * @param s is the pointer to scan state
+ * @param c is the character
+ * @param pos is the index of the character
+ * @param prev is the last character before it that is not a space, 0 if there is none
+ */
+static inline void scanSymbol(SCAN *s, char c, size_t pos, char prev) {
+    const OPERATOR_INFO *info;
+
+    if (c == '(') {
+        s->depth++;
+        return;
+    }
+    if (c == ')') {
+        s->malformed |= (--s->depth < 0);
+        return;
+    }
+    if (s->depth > 0)
+        return;
+
+    // Only binary operators can be in the input, UNARY_MINUS is internal to the evaluator
+    info = operatorInfo(c);
+    if (info->arity != 2) {
+        s->malformed = TRUE;
+        return;
+    }
+    if ((CHAR_CLASS[(unsigned char) prev] == DIGIT) || (prev == ')')) {
+        if ((s->level == 0) || (info->precedence == s->level))
+            s->boundary(s->context, pos, c);
+        return;
+    }
+    // Unary minus binds tighter than any binary operator, it belongs to the term that follows.
+    // A minus after a unary minus is a unary minus too
+    if (c != '-')
+        s->malformed = TRUE;
+}
+
+
+
+/**
+ * scanScalar function
+ * Scans a range one character at a time
+ * @param s is the pointer to scan state
+ * @param exp is the expression
+ * @param begin is the index of the first character
+ * @param end is the index after the last character
+ */
+static void scanScalar(SCAN *s, const char *exp, size_t begin, size_t end) {
+    size_t i;
+    unsigned char type;
+
+    for (i = begin; (i < end) && !s->malformed; i++) {
+        type = CHAR_CLASS[(unsigned char) exp[i]];
+        if (type == SPACE)
+            continue;
+        if (type != DIGIT)
+            scanSymbol(s, exp[i], i, s->last);
+        s->last = exp[i];
+    }
+}
+
+
+
+#ifdef PREPASS_X86
+
+/**
+ * scanBlock function
+ * Scans 32 characters from their class masks. Only symbols are visited, and while the depth
+ * is above 0 only parentheses, so nested text and runs of digits cost nothing per character.
+ * @param s is the pointer to scan state
+ * @param p is the start of the block
+ * @param base is the index of the block
+ * @param symbols has a bit for every character that is not a digit or a space
+ * @param parens has a bit for every parenthesis
+ * @param significant has a bit for every character that is not a space
+ */
+static inline void scanBlock(SCAN *s, const char *p, size_t base, uint32_t symbols, uint32_t parens,
+                             uint32_t significant) {
+    uint32_t done = 0;
+    uint32_t m, below;
+    int k, j;
+
+    for (;;) {
+        m = ((s->depth == 0) ? symbols : parens) & ~done;
+        if (m == 0)
+            break;
+        k = __builtin_ctz(m);
+        done = (2u << k) - 1;
+        below = significant & ((1u << k) - 1);
+        if (below != 0) {
+            j = 31 - __builtin_clz(below);
+            scanSymbol(s, p[k], base + k, p[j]);
+        } else {
+            scanSymbol(s, p[k], base + k, s->last);
+        }
+    }
+    if (significant != 0) {
+        j = 31 - __builtin_clz(significant);
+        s->last = p[j];
+    }
+}
+
+
+
+/*
+ * Byte range tests for vectors, a byte is in [low, low + count] when (byte - low)
+ * as unsigned is not above count.
+ */
+__attribute__((target("sse2")))
+static inline uint32_t rangeBits128(__m128i v, char low, char count) {
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(low));
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(count)), x));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t rangeBits256(__m256i v, char low, char count) {
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(low));
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(count)), x));
+}
+
+
+
+/**
+ * scanSSE2 function
+ * Scans a range 32 characters at a time, masks are made from two 16 byte halves
+ * @param s is the pointer to scan state
+ * @param exp is the expression
+ * @param begin is the index of the first character
+ * @param end is the index after the last character
+ */
+__attribute__((target("sse2")))
+static void scanSSE2(SCAN *s, const char *exp, size_t begin, size_t end) {
+    size_t i = begin;
+    uint32_t digits, spaces, parens;
+    __m128i v[2];
+    int h;
+
+    while ((i + 32 <= end) && !s->malformed) {
+        digits = spaces = parens = 0;
+        for (h = 0; h < 2; h++) {
+            v[h] = _mm_loadu_si128((const __m128i *) (exp + i + 16 * h));
+            digits |= rangeBits128(v[h], '0', 9) << (16 * h);
+            spaces |= (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v[h], _mm_set1_epi8(' '))) << (16 * h);
+            spaces |= rangeBits128(v[h], '\t', '\r' - '\t') << (16 * h);
+            parens |= rangeBits128(v[h], '(', 1) << (16 * h);
+        }
+        scanBlock(s, exp + i, i, ~(digits | spaces), parens, ~spaces);
+        i += 32;
+    }
+    scanScalar(s, exp, i, end);
+}
+
+
+
+/**
+ * scanAVX2 function
+ * Scans a range 32 characters at a time
+ * @param s is the pointer to scan state
+ * @param exp is the expression
+ * @param begin is the index of the first character
+ * @param end is the index after the last character
+ */
+__attribute__((target("avx2")))
+static void scanAVX2(SCAN *s, const char *exp, size_t begin, size_t end) {
+    size_t i = begin;
+    uint32_t digits, spaces, parens;
+    __m256i v;
+
+    while ((i + 32 <= end) && !s->malformed) {
+        v = _mm256_loadu_si256((const __m256i *) (exp + i));
+        digits = rangeBits256(v, '0', 9);
+        spaces = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        spaces |= rangeBits256(v, '\t', '\r' - '\t');
+        parens = rangeBits256(v, '(', 1);
+        scanBlock(s, exp + i, i, ~(digits | spaces), parens, ~spaces);
+        i += 32;
+    }
+    scanScalar(s, exp, i, end);
+}
+
+#endif
+
+// Implementation selected for this CPU
+static void (*scanImpl)(SCAN *, const char *, size_t, size_t) = scanScalar;
+static const char *prepassName = "scalar";
+
+
+
+/**
+ * selectPrepass function
+ * Runtime CPU dispatch, runs once when the program is loaded
+ */
+__attribute__((constructor))
+static void selectPrepass(void) {
+#ifdef PREPASS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanImpl = scanAVX2;
+        prepassName = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        scanImpl = scanSSE2;
+        prepassName = "sse2";
+    }
+#endif
+}
+
+
+
+/**
+ * prepassBackend function
+ * Names the implementation selected by runtime dispatch
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *prepassBackend(void) {
+    return prepassName;
+}
+
+
+
+/**
+ * planBoundary function
+ * Prepass callback for every binary operator at depth 0
+ * @param context is the pointer to split plan
+ * @param pos is the index of the operator
+ * @param op is the operator character
+ */
+static void planBoundary(void *context, size_t pos, char op) {
+    SPLIT_PLAN *plan = (SPLIT_PLAN *) context;
+    int level = operatorInfo(op)->precedence;
+
+    plan->ops[level] |= 1u << operatorInfo(op)->opcode;
+    if (level < plan->minLevel)
+        plan->minLevel = level;
+    while ((plan->next[level] < plan->targetCount) && (plan->target[plan->next[level]] <= pos))
+        plan->split[level][plan->next[level]++] = pos;
+}
+
+
+
+/**
+ * reductionOf function
+ * Chooses how the terms of the split level are reduced
+ * @param ops has a bit for every opcode of the split level
+ * @return reduction of the level
+ */
+static enum REDUCTION reductionOf(unsigned ops) {
+    if ((ops & ~((1u << OP_ADD) | (1u << OP_SUB))) == 0)
+        return REDUCE_SUM;
+    if (ops == (1u << OP_MUL))
+        return REDUCE_PRODUCT;
+    if ((ops == (1u << OP_AND)) || (ops == (1u << OP_OR)))
+        return REDUCE_BITWISE;
+    return REDUCE_SEQUENTIAL;
+}
+
+
+
+/**
+ * applyTerm function
+ * Evaluates one term of a group and adds it to the reduction of the group
+ * @param r is the pointer to term reader
+ * @param end is the index after the last character of the term
+ */
+static void applyTerm(TERM_READER *r, size_t end) {
+    GROUP *g = r->group;
+    EVALUATOR *e = r->evaluator;
+    VALUE v = evaluateBuffer(r->job->exp + r->termStart, end - r->termStart, e);
+    unsigned __int128 size;
+
+    g->error |= e->error;
+    g->invalid |= e->invalid;
+    switch (r->job->reduction) {
+        case REDUCE_SUM:
+            g->sum += (r->termOp == '-') ? -(__int128) v : (__int128) v;
+            g->low = ((g->count == 0) || (g->sum < g->low)) ? g->sum : g->low;
+            g->high = ((g->count == 0) || (g->sum > g->high)) ? g->sum : g->high;
+            break;
+        case REDUCE_PRODUCT:
+            g->product = (VALUE) ((uint64_t) g->product * (uint64_t) v);
+            if (g->zero)
+                break;
+            if (v == 0) {
+                g->zero = TRUE;
+                break;
+            }
+            // Running product keeps its absolute value over terms of 1 and -1
+            size = (v < 0) ? (unsigned __int128) (0 - (uint64_t) v) : (unsigned __int128) v;
+            if (size > 1) {
+                g->magnitude *= size;
+                if (g->magnitude > ((unsigned __int128) 1 << 64))
+                    g->magnitude = (unsigned __int128) 1 << 64;
+                g->positive = FALSE;
+                g->negative = FALSE;
+            }
+            g->sign = (v < 0) ? -g->sign : g->sign;
+            g->positive |= (g->sign > 0);
+            g->negative |= (g->sign < 0);
+            break;
+        case REDUCE_BITWISE:
+            g->value = (g->count == 0) ? v : operatorInfo(r->termOp)->apply[0](g->value, v, &g->error);
+            break;
+        case REDUCE_SEQUENTIAL:
+            g->error |= !valueStackPush(&g->terms, v) || !charStackPush(&g->ops, r->termOp);
+            break;
+    }
+    g->count++;
+}
+
+
+
+/**
+ * termBoundary function
+ * Scan callback for an operator of the split level between two terms of a group
+ * @param context is the pointer to term reader
+ * @param pos is the index of the operator
+ * @param op is the operator character
+ */
+static void termBoundary(void *context, size_t pos, char op) {
+    TERM_READER *r = (TERM_READER *) context;
+
+    applyTerm(r, pos);
+    r->termStart = pos + 1;
+    r->termOp = op;
+}
+
+
+
+/**
+ * evaluateGroup function
+ * Evaluates the terms of a group and reduces them
+ * @param job is the pointer to parallel job
+ * @param g is the pointer to group
+ * @param e is the pointer to evaluator of the worker
+ */
+static void evaluateGroup(const PARALLEL_JOB *job, GROUP *g, EVALUATOR *e) {
+    TERM_READER reader = {job, g, e, g->begin, 0};
+    SCAN s = {0, 0, FALSE, job->level, termBoundary, &reader};
+
+    // Groups after the first start with the operator joining them to the previous one
+    if (g->begin > 0) {
+        reader.termOp = job->exp[g->begin];
+        reader.termStart = g->begin + 1;
+        s.last = job->exp[g->begin];
+    }
+    scanImpl(&s, job->exp, reader.termStart, g->end);
+    applyTerm(&reader, g->end);
+}
+
+
+
+/**
+ * parallelWorkerMain function
+ * Claims groups until every group is evaluated
+ * @param arg is the pointer to parallel job
+ * @return NULL
+ */
+static void *parallelWorkerMain(void *arg) {
+    PARALLEL_JOB *job = (PARALLEL_JOB *) arg;
+    EVALUATOR e;
+    int k;
+
+    initEvaluator(&e);
+    e.checked = job->checked;
+    while ((k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->groupCount)
+        evaluateGroup(job, &job->groups[k], &e);
+    deleteEvaluator(&e);
+    return NULL;
+}
+
+
+
+/**
+ * combineGroups function
+ * Combines the group results in expression order. Sums and products are checked against
+ * the running value the evaluator would have had, so an overflow is reported exactly
+ * when evaluating from left to right reports it.
+ * @param job is the pointer to parallel job
+ * @param error is the pointer to error flag of the expression
+ * @return value of the expression
+ */
+static VALUE combineGroups(const PARALLEL_JOB *job, BOOLEAN *error) {
+    const OPERATOR_FUNCTION *apply = OPCODE_FUNCTION[job->checked];
+    const GROUP *g;
+    __int128 sum = 0;
+    unsigned __int128 size;
+    VALUE value = 1;
+    char op = 0;
+    int k, i;
+
+    switch (job->reduction) {
+        case REDUCE_SUM:
+            for (k = 0; k < job->groupCount; k++) {
+                g = &job->groups[k];
+                *error |= job->checked && ((sum + g->low < INT64_MIN) || (sum + g->high > INT64_MAX));
+                sum += g->sum;
+            }
+            return (VALUE) (uint64_t) sum;
+        case REDUCE_PRODUCT:
+            for (k = 0; k < job->groupCount; k++) {
+                g = &job->groups[k];
+                if (job->checked && (value != 0) && (g->positive || g->negative)) {
+                    size = (value < 0) ? (unsigned __int128) (0 - (uint64_t) value) : (unsigned __int128) value;
+                    size *= g->magnitude;
+                    *error |= (size > ((unsigned __int128) 1 << 63)) ||
+                              ((size == ((unsigned __int128) 1 << 63)) &&
+                               (((value > 0) && g->positive) || ((value < 0) && g->negative)));
+                }
+                value = (VALUE) ((uint64_t) value * (uint64_t) g->product);
+            }
+            return value;
+        case REDUCE_BITWISE:
+            value = job->groups[0].value;
+            for (k = 1; k < job->groupCount; k++)
+                value = operatorInfo(job->exp[job->groups[k].begin])->apply[0](value, job->groups[k].value, error);
+            return value;
+        case REDUCE_SEQUENTIAL:
+            break;
+    }
+
+    // Right associative operators are folded from the last term
+    if (operatorInfo(job->exp[job->groups[1].begin])->associativity == RIGHT_ASSOCIATIVE) {
+        for (k = job->groupCount - 1; k >= 0; k--) {
+            g = &job->groups[k];
+            for (i = g->terms.top - 1; i >= 0; i--) {
+                value = (op == 0) ? g->terms.item[i] : apply[operatorInfo(op)->opcode](g->terms.item[i], value, error);
+                op = g->ops.item[i];
+            }
+        }
+        return value;
+    }
+    value = job->groups[0].terms.item[0];
+    for (k = 0; k < job->groupCount; k++) {
+        g = &job->groups[k];
+        for (i = (k == 0) ? 1 : 0; i < g->terms.top; i++)
+            value = apply[operatorInfo(g->ops.item[i])->opcode](value, g->terms.item[i], error);
+    }
+    return value;
+}
+
+
+
+/**
+ * initGroups function
+ * Cuts the expression into groups at the split operators of the level and resets their reductions
+ * @param plan is the pointer to split plan made by the prepass
+ * @param len is the length of the expression
+ * @param job is the pointer to parallel job, its groups and groupCount are filled
+ * @return TRUE if there are at least two groups else FALSE
+ */
+static BOOLEAN initGroups(const SPLIT_PLAN *plan, size_t len, PARALLEL_JOB *job) {
+    const size_t *split = plan->split[job->level];
+    size_t begin = 0;
+    int k, count = 0;
+    GROUP *g;
+
+    job->groups = (GROUP *) aligned_alloc(CACHE_LINE_SIZE, (plan->next[job->level] + 1) * sizeof(GROUP));
+    if (job->groups == NULL)
+        return FALSE;
+    for (k = 0; k <= plan->next[job->level]; k++) {
+        // Close targets can share a split operator
+        if ((k < plan->next[job->level]) && (k > 0) && (split[k] == split[k - 1]))
+            continue;
+        g = &job->groups[count++];
+        g->begin = begin;
+        g->end = (k < plan->next[job->level]) ? split[k] : len;
+        begin = g->end;
+        g->sum = 0;
+        g->low = 0;
+        g->high = 0;
+        g->product = 1;
+        g->magnitude = 1;
+        g->sign = 1;
+        g->positive = FALSE;
+        g->negative = FALSE;
+        g->zero = FALSE;
+        g->value = 0;
+        g->count = 0;
+        g->error = FALSE;
+        g->invalid = FALSE;
+        if (job->reduction == REDUCE_SEQUENTIAL) {
+            valueStackInitInline(&g->terms, NULL);
+            charStackInitInline(&g->ops, NULL);
+        }
+    }
+    job->groupCount = count;
+    return count > 1;
+}
+
+
+
+/**
+ * deleteGroups function
+ * Frees the groups of a job
+ * @param job is the pointer to parallel job
+ */
+static void deleteGroups(PARALLEL_JOB *job) {
+    int k;
+
+    for (k = 0; (job->reduction == REDUCE_SEQUENTIAL) && (k < job->groupCount); k++) {
+        valueStackDelete(&job->groups[k].terms);
+        charStackDelete(&job->groups[k].ops);
+    }
+    free(job->groups);
+}
+
+
+
+/**
+ * evaluateParallel function
+ * Evaluates one long expression on several threads in two phases.
+ * The prepass scans the expression once with vector class masks, it follows the parenthesis depth,
+ * finds the loosest operator level at depth 0 and picks split operators of that level near
+ * equally spaced offsets. Groups of terms between the split operators are then evaluated by workers,
+ * each with its own stacks, and the group results are combined in expression order.
+ * Results, overflow and division by zero are the same as evaluateBuffer gives. A failed expression
+ * is evaluated again by evaluateBuffer, so its status and error offset are the same too.
+ * Short expressions and expressions that can not be split are evaluated by evaluateBuffer.
+ * @param exp is the start of the expression
+ * @param len is the length of the expression in bytes
+ * @param threadCount is the number of threads to use
+ * @param e is the pointer to evaluator context, its error and invalid flags are set
+ * @return result of the expression, not meaningful when e->error is set
+ */
+VALUE evaluateParallel(const char *exp, size_t len, int threadCount, EVALUATOR *e) {
+    pthread_t threads[MAX_THREAD_COUNT];
+    PARALLEL_JOB job;
+    SPLIT_PLAN *plan = NULL;
+    SCAN s = {0, 0, FALSE, 0, planBoundary, NULL};
+    BOOLEAN ok;
+    VALUE value;
+    int k, started;
+
+    if (threadCount > MAX_THREAD_COUNT)
+        threadCount = MAX_THREAD_COUNT;
+    if ((threadCount > 1) && (len >= PARALLEL_MIN_SIZE))
+        plan = (SPLIT_PLAN *) malloc(sizeof(SPLIT_PLAN));
+    if (plan == NULL)
+        return evaluateBuffer(exp, len, e);
+
+    // Prepass
+    memset(plan->next, 0, sizeof(plan->next));
+    memset(plan->ops, 0, sizeof(plan->ops));
+    plan->minLevel = PRECEDENCE_LEVELS;
+    plan->targetCount = threadCount * PARALLEL_GROUPS_PER_THREAD - 1;
+    for (k = 0; k < plan->targetCount; k++)
+        plan->target[k] = len / (plan->targetCount + 1) * (k + 1);
+    s.context = plan;
+    scanImpl(&s, exp, 0, len);
+    ok = !s.malformed && (s.depth == 0) && (plan->minLevel < PRECEDENCE_LEVELS) &&
+         ((CHAR_CLASS[(unsigned char) s.last] == DIGIT) || (s.last == ')'));
+
+    job.exp = exp;
+    job.level = plan->minLevel;
+    job.reduction = ok ? reductionOf(plan->ops[plan->minLevel]) : REDUCE_SUM;
+    job.checked = e->checked;
+    job.next = 0;
+    job.groups = NULL;
+    job.groupCount = 0;
+    if (!ok || !initGroups(plan, len, &job)) {
+        if (job.groups != NULL)
+            deleteGroups(&job);
+        free(plan);
+        return evaluateBuffer(exp, len, e);
+    }
+    free(plan);
+
+    // Groups are claimed by the workers, the calling thread works when no thread could be started
+    for (started = 0; (started < threadCount) && (started < job.groupCount); started++) {
+        if (pthread_create(&threads[started], NULL, parallelWorkerMain, &job) != 0)
+            break;
+    }
+    if (started == 0)
+        parallelWorkerMain(&job);
+    for (k = 0; k < started; k++)
+        pthread_join(threads[k], NULL);
+
+    e->error = FALSE;
+    e->invalid = FALSE;
+    for (k = 0; k < job.groupCount; k++) {
+        e->error |= job.groups[k].error;
+        e->invalid |= job.groups[k].invalid;
+    }
+    value = e->invalid ? 0 : combineGroups(&job, &e->error);
+    deleteGroups(&job);
+    // Failed expression is evaluated again in one piece for the reason and offset of its first error
+    if (UNLIKELY(e->error))
+        return evaluateBuffer(exp, len, e);
+    return value;
+}
\ No newline at end of file
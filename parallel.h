@@ -0,0 +1,21 @@
+#ifndef EXPEVAL_PARALLEL_H
+#define EXPEVAL_PARALLEL_H
+
+#include <stddef.h>
+#include "stack.h"
+#include "batch.h"
+
+// Shorter expressions are evaluated on the calling thread
+#define PARALLEL_MIN_SIZE (64 * 1024)
+// Every worker gets a few groups, so groups of different cost are balanced by claiming
+#define PARALLEL_GROUPS_PER_THREAD 4
+#define MAX_PARALLEL_GROUPS (MAX_THREAD_COUNT * PARALLEL_GROUPS_PER_THREAD)
+// Operator precedence values of the registry are below this
+#define PRECEDENCE_LEVELS 9
+
+// Function prototypes
+VALUE evaluateParallel(const char *exp, size_t len, int threadCount, EVALUATOR *e);
+
+const char *prepassBackend(void);
+
+#endif //EXPEVAL_PARALLEL_H
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "program.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * emit function
+ * Appends an instruction to the program and keeps track of
+ * the operand stack depth the program will need at run time
+ * @param p is the pointer to program
+ * @param op is the opcode of the instruction
+ * @param value is the literal or the parameter index
+ * @param depth is the pointer to current operand stack depth
+ * @return FALSE if the instruction would pop from an empty stack else TRUE
+ */
+static BOOLEAN emit(PROGRAM *p, enum OPCODE op, VALUE value, int *depth) {
+    switch (op) {
+        case OP_CONST:
+        case OP_PARAM:
+            *depth += 1;
+            if (*depth > p->maxDepth)
+                p->maxDepth = *depth;
+            break;
+        case OP_NEG:
+            if (*depth < 1)
+                return FALSE;
+            break;
+        default:
+            if (*depth < 2)
+                return FALSE;
+            *depth -= 1;
+            break;
+    }
+    p->code[p->length].op = op;
+    p->code[p->length].value = value;
+    p->length++;
+    return TRUE;
+}
+
+
+
+/**
+ * emitOperator function
+ * Pops one operator from the operator stack and appends it to the program
+ * @param p is the pointer to program
+ * @param operator is the pointer to operator stack
+ * @param depth is the pointer to current operand stack depth
+ * @return FALSE if the stack is empty, the popped character is a parenthesis or the program is malformed else TRUE
+ */
+static BOOLEAN emitOperator(PROGRAM *p, CHAR_STACK *operator, int *depth) {
+    char c;
+    if (!charStackPop(operator, &c) || (operatorInfo(c)->precedence == 0))
+        return FALSE;
+    return emit(p, operatorInfo(c)->opcode, 0, depth);
+}
+
+
+
+/**
+ * findName function
+ * Finds a variable name in the name list
+ * @param names is the array of variable names
+ * @param nameCount is the number of names
+ * @param name is the start of the name in the expression
+ * @param len is the length of the name
+ * @return index of the name, -1 if it is not in the list
+ */
+static int findName(const char *const *names, int nameCount, const char *name, size_t len) {
+    int k;
+    for (k = 0; k < nameCount; k++) {
+        if ((strncmp(names[k], name, len) == 0) && (names[k][len] == '\0'))
+            return k;
+    }
+    return -1;
+}
+
+
+
+/**
+ * compileProgram function
+ * This function parses the expression once and converts it to a postfix program
+ * with the shunting yard algorithm. Operator precedence comes from compare function,
+ * so compiled programs give the same results as evaluateExpression.
+ * Placeholders are written as $1, $2, ... and they are bound at execution time.
+ * @param exp is the expression string
+ * @param p is the pointer to program to be filled
+ * @param arena is the pointer to arena owning the program, NULL to use malloc
+ * @return TRUE if the expression is compiled else FALSE
+ */
+BOOLEAN compileProgram(const char *exp, PROGRAM *p, ARENA *arena) {
+    return compileNamedProgram(exp, NULL, 0, p, arena);
+}
+
+
+
+/**
+ * compileNamedProgram function
+ * Compiles an expression that refers to its parameters by name as well as by $1, $2, ...
+ * A name is a letter or underscore followed by letters, digits and underscores,
+ * names[k] is bound to the same parameter as $k+1.
+ * A minus sign in operand position is a unary minus. It negates the next literal, parameter or
+ * parenthesized expression and binds tighter than any binary operator, the same way punctEval does.
+ * Literals that do not fit in VALUE and unknown names are rejected.
+ * When an arena is given, the program is taken from it, the compiler's scratch stack spills
+ * to it when the nesting is deep and the scratch space is given back before returning.
+ * @param exp is the expression string
+ * @param names is the array of parameter names, NULL when there are none
+ * @param nameCount is the number of names
+ * @param p is the pointer to program to be filled
+ * @param arena is the pointer to arena owning the program, NULL to use malloc
+ * @return TRUE if the expression is compiled else FALSE
+ */
+BOOLEAN compileNamedProgram(const char *exp, const char *const *names, int nameCount, PROGRAM *p, ARENA *arena) {
+    size_t len = strlen(exp);
+    size_t i = 0;
+    size_t start;
+    int index;
+    int depth = 0;
+    VALUE value;
+    BOOLEAN overflow = FALSE;
+    char c;
+    char top;
+    BOOLEAN expectOperand = TRUE;
+    BOOLEAN ok = TRUE;
+    size_t mark = 0;
+    CHAR_STACK operator;
+
+    p->length = 0;
+    p->paramCount = 0;
+    p->maxDepth = 0;
+    p->arena = arena;
+    // Every instruction consumes at least one character of the expression
+    if (arena != NULL) {
+        p->code = (INSTRUCTION *) arenaAlloc(arena, (len + 1) * sizeof(INSTRUCTION));
+        mark = arenaMark(arena);
+    } else {
+        p->code = (INSTRUCTION *) malloc((len + 1) * sizeof(INSTRUCTION));
+    }
+    // Operator stack lives in this frame, it spills to the arena or the heap only for deep nesting
+    charStackInitInline(&operator, arena);
+    ok = (p->code != NULL);
+    if (!ok) {
+        deleteProgram(p);
+        return FALSE;
+    }
+
+    while (ok && (i < len)) {
+        c = exp[i];
+        if (typeOfChar(c) == SPACE) {
+            i++;
+        } else if (isdigit(c)) {
+            value = digitHandler(exp, len, &i, &overflow);
+            // Unary minus in front of a literal is folded into the literal
+            if (charStackPeek(&operator, &top) && (top == UNARY_MINUS)) {
+                charStackPop(&operator, &top);
+                value = (VALUE) (0 - (uint64_t) value);
+            }
+            ok = expectOperand && !overflow && emit(p, OP_CONST, value, &depth);
+            expectOperand = FALSE;
+        } else if (c == '$') {
+            i++;
+            ok = expectOperand && (i < len) && isdigit(exp[i]);
+            if (ok) {
+                value = digitHandler(exp, len, &i, &overflow);
+                ok = !overflow && (value >= 1) && (value <= MAX_PARAM_COUNT) && emit(p, OP_PARAM, value - 1, &depth);
+                if (ok && (value > p->paramCount))
+                    p->paramCount = (int) value;
+            }
+            expectOperand = FALSE;
+        } else if (isalpha((unsigned char) c) || (c == '_')) {
+            start = i;
+            while ((i < len) && (isalnum((unsigned char) exp[i]) || (exp[i] == '_')))
+                i++;
+            index = findName(names, nameCount, exp + start, i - start);
+            ok = expectOperand && (index >= 0) && (index < MAX_PARAM_COUNT) && emit(p, OP_PARAM, index, &depth);
+            if (ok && (index >= p->paramCount))
+                p->paramCount = index + 1;
+            expectOperand = FALSE;
+        } else if (c == '(') {
+            ok = expectOperand && charStackPush(&operator, c);
+            i++;
+        } else if (c == ')') {
+            ok = !expectOperand;
+            while (ok && charStackPeek(&operator, &top) && (top != '('))
+                ok = emitOperator(p, &operator, &depth);
+            // Closing parenthesis must have a relative opening parenthesis
+            ok = ok && charStackPop(&operator, &top);
+            i++;
+        } else if (operatorInfo(c)->arity == 2) {
+            if (expectOperand) {
+                c = UNARY_MINUS;
+                ok = (exp[i] == '-') && charStackPush(&operator, c);
+            } else {
+                while (ok && charStackPeek(&operator, &top) && (top != '(') && (compare(c, top) != HIGHER))
+                    ok = emitOperator(p, &operator, &depth);
+                ok = ok && charStackPush(&operator, c);
+                expectOperand = TRUE;
+            }
+            i++;
+        } else {
+            ok = FALSE;
+        }
+    }
+
+    // Remaining operators are executed in stack order
+    ok = ok && !expectOperand;
+    while (ok && !charStackIsEmpty(&operator))
+        ok = emitOperator(p, &operator, &depth);
+    ok = ok && (depth == 1);
+
+    charStackDelete(&operator);
+    if (arena != NULL)
+        arenaRelease(arena, mark);
+    if (!ok)
+        deleteProgram(p);
+    return ok;
+}
+
+
+
+/**
+ * executeProgram function
+ * This function runs a compiled program with the given parameter values.
+ * Only the operand stack is used, there is no character classification
+ * and no precedence comparison at execution time.
+ * Operators are called through the registry, checked or wrapping as selected by the evaluator.
+ * Compilation has proven the stack depth, so after the stack is reserved
+ * every push and pop is unchecked. When the stack can not be reserved the execution
+ * fails with EVAL_NO_MEMORY.
+ * @param p is the pointer to compiled program
+ * @param params is the array of parameter values, params[0] is bound to $1
+ * @param e is the pointer to evaluator context, only its operand stack, error flag and status are used
+ * @return result of the mathematical operations, not meaningful when e->error is set
+ */
+VALUE executeProgram(const PROGRAM *p, const VALUE *params, EVALUATOR *e) {
+    const INSTRUCTION *code = p->code;
+    const OPERATOR_FUNCTION *apply = OPCODE_FUNCTION[e->checked];
+    VALUE_STACK *operand = &e->operand;
+    int i;
+    VALUE a, b;
+
+    valueStackReset(operand);
+    e->error = FALSE;
+    e->status = EVAL_OK;
+    if (UNLIKELY(!valueStackReserve(operand, p->maxDepth))) {
+        e->error = TRUE;
+        e->status = EVAL_NO_MEMORY;
+        return 0;
+    }
+    for (i = 0; i < p->length; i++) {
+        switch (code[i].op) {
+            case OP_CONST:
+                valueStackPushUnchecked(operand, code[i].value);
+                break;
+            case OP_PARAM:
+                valueStackPushUnchecked(operand, params[code[i].value]);
+                break;
+            case OP_NEG:
+                a = valueStackPopUnchecked(operand);
+                valueStackPushUnchecked(operand, apply[OP_NEG](0, a, &e->error));
+                break;
+            case OP_DUP:
+                valueStackPushUnchecked(operand, valueStackPeekUnchecked(operand));
+                break;
+            case OP_DIV_SHIFT:
+                a = valueStackPopUnchecked(operand);
+                valueStackPushUnchecked(operand, shiftDivide(a, (int) code[i].value));
+                break;
+            case OP_MOD_MASK:
+                a = valueStackPopUnchecked(operand);
+                valueStackPushUnchecked(operand, maskModulo(a, (int) code[i].value));
+                break;
+            default:
+                a = valueStackPopUnchecked(operand);
+                b = valueStackPopUnchecked(operand);
+                valueStackPushUnchecked(operand, apply[code[i].op](b, a, &e->error));
+                break;
+        }
+    }
+
+    return valueStackPopUnchecked(operand);
+}
+
+
+
+/**
+ * deleteProgram function
+ * Frees the instruction array and handles dangling pointers.
+ * Programs compiled into an arena are released with the arena.
+ * @param p is the pointer to program
+ */
+void deleteProgram(PROGRAM *p) {
+    if (p->arena == NULL)
+        free(p->code);
+    p->code = NULL;
+    p->length = 0;
+}
\ No newline at end of file
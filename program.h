@@ -0,0 +1,44 @@
+#ifndef EXPEVAL_PROGRAM_H
+#define EXPEVAL_PROGRAM_H
+
+#include "stack.h"
+#include "operators.h"
+
+#define MAX_PARAM_COUNT 64
+
+/*
+ * One instruction of a program.
+ * value is the literal for OP_CONST and zero based parameter index for OP_PARAM,
+ * other opcodes do not use it.
+ */
+typedef struct {
+    enum OPCODE op;
+    VALUE value;
+} INSTRUCTION;
+
+/*
+ * Compiled(prepared) expression.
+ * code is the instruction array with length elements
+ * paramCount is the highest placeholder number used in the expression ($1 is 1)
+ * maxDepth is the operand stack depth needed to execute the program
+ * arena is the owner of code array, NULL when it is allocated with malloc
+ */
+typedef struct {
+    INSTRUCTION *code;
+    int length;
+    int paramCount;
+    int maxDepth;
+    struct ARENA *arena;
+} PROGRAM;
+
+// Function prototypes
+BOOLEAN compileProgram(const char *exp, PROGRAM *program, struct ARENA *arena);
+
+BOOLEAN compileNamedProgram(const char *exp, const char *const *names, int nameCount, PROGRAM *program,
+                            struct ARENA *arena);
+
+VALUE executeProgram(const PROGRAM *program, const VALUE *params, EVALUATOR *e);
+
+void deleteProgram(PROGRAM *program);
+
+#endif //EXPEVAL_PROGRAM_H
\ No newline at end of file
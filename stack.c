@@ -1,32 +1,136 @@
+#define _GNU_SOURCE
 #include "stack.h"
+#include "arena.h"
+#include "tokenizer.h"
+#include "operators.h"
+#include "trace.h"
+#include "metrics.h"
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
-#include <errno.h>
 #include <string.h>
 #include <ctype.h>
-#include <stdarg.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * resetStack function
+ * Empties the stack without releasing its memory,
+ * so the same stack can be reused for the next expression
+ * @param s is the pointer of the stack
+ */
+void resetStack(STACK *s) {
+    if (s->type == INT)
+        intStackReset(&s->items.ints);
+    else
+        charStackReset(&s->items.chars);
+}
 
-enum OPERATION_TYPE LAST_OPERATION;
 
-BOOLEAN NEGATIVE_FLAG = FALSE;
 
 /**
- * finalize function
- * This function handles memory free operations
- * Takes variable length arguments
- * @param s is the STACK* of the stack
+ * growStackItems function
+ * Doubles the capacity of a growable stack array.
+ * Small heap arrays are grown with realloc. When the array reaches
+ * MAPPED_STACK_BYTES it is moved to mapped memory once, after that it is
+ * grown with mremap, which remaps pages instead of copying elements.
+ * Arena arrays are copied to a bigger block of the same arena,
+ * when the arena is exhausted they move to heap or mapped memory.
+ * Inline arrays spill the same way, to the arena of the stack when it has one.
+ * @param item is the pointer to element array pointer, updated when the array moves
+ * @param capacity is the pointer to number of elements the array can hold
+ * @param top is the number of elements in use
+ * @param size is the size of one element
+ * @param storage is the pointer to storage type of the array
+ * @param arena is the owner of arena storage or the arena inline arrays spill to, NULL otherwise
+ * @return TRUE if the array is grown else FALSE
  */
-void finalize(STACK *s, ...) {
-    va_list valist;
-    va_start(valist, s);
-    STACK *tmp = s;
-    while (tmp != NULL) {
-        deleteStack(tmp);
-        free(tmp);
-        tmp->item = NULL;
-        tmp = va_arg(valist, STACK*);
+BOOLEAN growStackItems(void **item, int *capacity, int top, size_t size, enum STORAGE_TYPE *storage,
+                       struct ARENA *arena) {
+    size_t oldBytes = *capacity * size;
+    size_t newBytes = 2 * oldBytes;
+    size_t page;
+    void *tmp;
+
+    if ((*storage == ARENA_STORAGE) || ((*storage == INLINE_STORAGE) && (arena != NULL))) {
+        tmp = arenaAlloc(arena, newBytes);
+        if (tmp != NULL) {
+            memcpy(tmp, *item, top * size);
+            *item = tmp;
+            *capacity = (int) (newBytes / size);
+            *storage = ARENA_STORAGE;
+            return TRUE;
+        }
+        // Arena is exhausted, array moves out of the arena
+    }
+
+    if (newBytes < MAPPED_STACK_BYTES) {
+        if (*storage == HEAP_STORAGE) {
+            tmp = realloc(*item, newBytes);
+            if (tmp == NULL)
+                return FALSE;
+        } else {
+            tmp = malloc(newBytes);
+            if (tmp == NULL)
+                return FALSE;
+            memcpy(tmp, *item, top * size);
+            *storage = HEAP_STORAGE;
+        }
+    } else {
+        // Mapped sizes are rounded up to whole pages
+        page = (size_t) sysconf(_SC_PAGESIZE);
+        newBytes = (newBytes + page - 1) / page * page;
+#ifdef __linux__
+        if (*storage == MAPPED_STORAGE) {
+            tmp = mremap(*item, oldBytes, newBytes, MREMAP_MAYMOVE);
+            if (tmp == MAP_FAILED)
+                return FALSE;
+            *item = tmp;
+            *capacity = (int) (newBytes / size);
+            return TRUE;
+        }
+#endif
+        tmp = mmap(NULL, newBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (tmp == MAP_FAILED)
+            return FALSE;
+        memcpy(tmp, *item, top * size);
+        freeStackItems(*item, *capacity, size, *storage);
+        *storage = MAPPED_STORAGE;
     }
-    va_end(valist);
+    *item = tmp;
+    *capacity = (int) (newBytes / size);
+    return TRUE;
+}
+
+
+
+/**
+ * allocStackItems function
+ * Takes a stack array from the arena
+ * @param arena is the pointer to arena
+ * @param bytes is the size of the array
+ * @return pointer to the array, NULL if the arena is exhausted
+ */
+void *allocStackItems(struct ARENA *arena, size_t bytes) {
+    return arenaAlloc(arena, bytes);
+}
+
+
+
+/**
+ * freeStackItems function
+ * Releases a stack array allocated by malloc or mmap.
+ * Arena arrays are released with their arena, inline arrays with their stack.
+ * @param item is the element array
+ * @param capacity is the number of elements the array can hold
+ * @param size is the size of one element
+ * @param storage is the storage type of the array
+ */
+void freeStackItems(void *item, int capacity, size_t size, enum STORAGE_TYPE storage) {
+    if (storage == MAPPED_STORAGE)
+        munmap(item, capacity * size);
+    else if (storage == HEAP_STORAGE)
+        free(item);
 }
 
 
@@ -37,62 +141,114 @@ void finalize(STACK *s, ...) {
  * @param s is the pointer of the stack
  */
 void deleteStack(STACK *s) {
-    free(s->item);
-    s->item = NULL;
+    if (s->type == INT)
+        intStackDelete(&s->items.ints);
+    else
+        charStackDelete(&s->items.chars);
 }
 
 
 
 /**
  * typeOfChar function
- * Finds the enumeration type of the character given
+ * Finds the enumeration type of the character given.
+ * Type is read from the CHAR_CLASS table of the tokenizer.
  * @param c is the character to find the type
  * @return type of the character as enum
  */
 enum CHAR_TYPE typeOfChar(char c) {
-    if (isspace(c))
-        return SPACE;
-    else if (isdigit(c))
-        return DIGIT;
-    else if (ispunct(c))
-        return PUNCTUATION;
-    else
-        return WRONG;
+    return (enum CHAR_TYPE) CHAR_CLASS[(unsigned char) c];
+}
+
+
+
+/**
+ * raiseError function
+ * Records an error of the expression. Only the first error keeps its reason and offset,
+ * the offset is the token being evaluated or the end of the expression after the last token.
+ * It is called only on error paths, so it is kept out of the evaluation loop.
+ * @param status is the reason of the error
+ * @param e is the pointer to evaluator context
+ */
+static void __attribute__((noinline, cold)) raiseError(enum EVAL_STATUS status, EVALUATOR *e) {
+    e->error = TRUE;
+    if (e->status != EVAL_OK)
+        return;
+    e->status = status;
+    e->errorOffset = e->consumed + ((e->position != NULL) ? *e->position : 0);
+}
+
+
+
+/**
+ * arithmeticStatus function
+ * Finds the reason an operation failed
+ * @param op is the operator character
+ * @param b is the left operand
+ * @param a is the right operand
+ * @return EVAL_DIVISION_BY_ZERO or EVAL_OVERFLOW
+ */
+static enum EVAL_STATUS __attribute__((cold)) arithmeticStatus(char op, VALUE b, VALUE a) {
+    // Negative power of zero is a division by zero too
+    if ((((op == '/') || (op == '%')) && (a == 0)) || ((op == '^') && (b == 0) && (a < 0)))
+        return EVAL_DIVISION_BY_ZERO;
+    return EVAL_OVERFLOW;
 }
 
 
 
 /**
  * executeOperation function
- * This function pops two operand and pops one operator from stacks
+ * This function pops one operator and its operands from stacks
  * and does mathematical operation, pushes result back to operand stack
+ * Operator is applied through the operator registry, checked or wrapping
+ * as selected by the evaluator. Overflow and division by zero raise an error.
+ * An operator without enough operands or a parenthesis that was not closed raise an error
+ * and are dropped, operands are never popped from an empty stack.
  * Function contains pop and push function calls. Before calling this function,
  * you must not pop or push any value.
- * @param operator is the pointer to operator stack
- * @param operand is the pointer to operand stack
+ * @param e is the pointer to evaluator context
+ */
+void executeOperation(EVALUATOR *e) {
+    VALUE a = 0, b = 0, result;
+    char op = 0;
+    const OPERATOR_INFO *info;
+    charStackPop(&e->operator, &op);
+    info = operatorInfo(op);
+    if (UNLIKELY(info->apply[0] == NULL)) {
+        raiseError((op == '(') ? EVAL_UNBALANCED_PARENTHESIS : EVAL_MISSING_OPERAND, e);
+        return;
+    }
+    // Pops check for an empty stack anyway, so a missing operand costs no extra branch
+    if (UNLIKELY(!valueStackPop(&e->operand, &a) ||
+                 ((info->arity != 1) && !valueStackPop(&e->operand, &b)))) {
+        raiseError(EVAL_MISSING_OPERAND, e);
+        return;
+    }
+    result = info->apply[e->checked](b, a, &e->error);
+    // Error flag is sticky, only the first error of the expression is located
+    if (UNLIKELY(e->error))
+        raiseError(arithmeticStatus(op, b, a), e);
+    valueStackPushUnchecked(&e->operand, result);
+    METRICS_OPERATION(e, op);
+    TRACE_STEP(TRACE_REDUCE, op, e);
+}
+
+
+
+/**
+ * pushOperator function
+ * Pushes an operator or an opening parenthesis to the operator stack.
+ * A push refused by a full stack that can not grow fails the expression.
+ * @param c is the operator character
+ * @param e is the pointer to evaluator context
  */
-void executeOperation(STACK *operator, STACK *operand) {
-    int a, b, result;
-    char op;
-    pop(&a, operand);
-    pop(&b, operand);
-    pop(&op, operator);
-    switch (op) {
-        case '+':
-            result = b + a;
-            break;
-        case '-':
-            result = b - a;
-            break;
-        case '*':
-            result = b * a;
-            break;
-        case '/':
-            result = b / a;
-        default:
-            break;
+static inline void pushOperator(char c, EVALUATOR *e) {
+    if (UNLIKELY(!charStackPush(&e->operator, c))) {
+        METRICS_REJECT(e->metrics);
+        raiseError(EVAL_NO_MEMORY, e);
     }
-    push(&result, operand);
+    METRICS_DEPTH(e, operatorHigh, e->operator.top);
 }
 
 
@@ -100,38 +256,59 @@ void executeOperation(STACK *operator, STACK *operand) {
 /**
  * punctEval function
  * This function evaluates punctuation characters.
+ * A minus in operand position is a unary minus. In front of a number it is folded into the number,
+ * in front of a parenthesis or another minus it is pushed as UNARY_MINUS, which binds tighter
+ * than any binary operator, so -(2+3) is -5 and --3 is 3 like in a compiled program.
+ * A closing parenthesis without an opening one or without an operand before it
+ * and punctuation that is not an operator raise an error, evaluation goes on with the next token.
  * @param c is the punctuation character
- * @param operator is the pointer to operator stack
- * @param operand is the pointer to operand stack
+ * @param e is the pointer to evaluator context
  */
-void punctEval(char c, STACK *operator, STACK *operand) {
+void punctEval(char c, EVALUATOR *e) {
     char tmp = 'a';
 
-    if((c == '-') && (LAST_OPERATION == OPERATOR)) {
-        LAST_OPERATION = OPERAND;
-        NEGATIVE_FLAG = TRUE;
+    if((c == '-') && (e->lastOperation == OPERATOR)) {
+        // Minus waiting for a number is followed by another one, the first one negates the rest
+        if (e->negativeFlag)
+            pushOperator(UNARY_MINUS, e);
+        e->negativeFlag = TRUE;
         return;
     }
     // If it is opening parenthesis, push to stack
     if (c == '(') {
-        LAST_OPERATION = OPERATOR;
-        push(&c, operator);
+        if (e->negativeFlag) {
+            e->negativeFlag = FALSE;
+            pushOperator(UNARY_MINUS, e);
+            // Replay takes one push per step, the parenthesis is recorded with the token
+            TRACE_STEP(TRACE_PUSH, UNARY_MINUS, e);
+        }
+        e->lastOperation = OPERATOR;
+        pushOperator(c, e);
         return;
     }
 
     // If it is closing parenthesis, execute all operations
     // until relative opening parenthesis
     if (c == ')') {
-        while (tmp != '(') {
-            executeOperation(operator, operand);
-            peek(&tmp, operator);
-        }
-        pop(&tmp, operator);
+        if (UNLIKELY(e->lastOperation == OPERATOR))
+            raiseError(EVAL_MISSING_OPERAND, e);
+        while (charStackPeek(&e->operator, &tmp) && (tmp != '('))
+            executeOperation(e);
+        if (UNLIKELY(!charStackPop(&e->operator, &tmp)))
+            raiseError(EVAL_UNBALANCED_PARENTHESIS, e);
+        e->lastOperation = OPERAND;
+        return;
+    }
+    // UNARY_MINUS is only pushed by the evaluator, it is not an operator of the input
+    if (UNLIKELY(operatorInfo(c)->arity != 2)) {
+        raiseError(EVAL_INVALID_CHARACTER, e);
         return;
     }
 
-    // If it is not a parenthesis then it is an operator
-    operatorEval(c, operator, operand);
+    // If it is not a parenthesis then it is a binary operator,
+    // a minus right after it is a unary minus
+    e->lastOperation = OPERATOR;
+    operatorEval(c, e);
 }
 
 
@@ -141,21 +318,20 @@ void punctEval(char c, STACK *operator, STACK *operand) {
  * This function evaluates operations. For every operator state,
  * function checks and calls appropriate functions
  * @param c is the operator character
- * @param operator is the pointer to operator stack
- * @param operand is the pointer to operand stack
+ * @param e is the pointer to evaluator context
  */
-void operatorEval(char c, STACK *operator, STACK *operand) {
+void operatorEval(char c, EVALUATOR *e) {
     char tmp = 'a';
     BOOLEAN flag = TRUE;
 
-    if (!isEmpty(operator)) {
-        peek(&tmp, operator);
+    if (!charStackIsEmpty(&e->operator)) {
+        charStackPeek(&e->operator, &tmp);
         if ((tmp != '(') && (tmp != ')')) {
             enum PRECEDENCE p = compare(c, tmp);
-            operate(c, tmp, p, flag, operator, operand);
+            operate(c, tmp, p, flag, e);
         }
     }
-    push(&c, operator);
+    pushOperator(c, e);
 }
 
 
@@ -167,13 +343,12 @@ void operatorEval(char c, STACK *operator, STACK *operand) {
  * @param peekValue is the top character on the operator stack
  * @param p is the precedence of the two operator
  * @param flag controls if pop operation happened
- * @param operator is the pointer to operator stack
- * @param operand is the pointer to operand stack
+ * @param e is the pointer to evaluator context
  */
-void operate(char c, char peekValue, enum PRECEDENCE p, BOOLEAN flag, STACK *operator, STACK *operand) {
+void operate(char c, char peekValue, enum PRECEDENCE p, BOOLEAN flag, EVALUATOR *e) {
     while (((p == LOWER) || (p == EQUAL)) && (flag)) {
-        executeOperation(operator, operand);
-        flag = peek(&peekValue, operator) ? TRUE : FALSE;
+        executeOperation(e);
+        flag = charStackPeek(&e->operator, &peekValue) ? TRUE : FALSE;
         if ((peekValue != '(') && (peekValue != ')'))
             p = compare(c, peekValue);
         else
@@ -186,96 +361,43 @@ void operate(char c, char peekValue, enum PRECEDENCE p, BOOLEAN flag, STACK *ope
 /**
  * compare function
  * This function compares given two operator.
+ * Precedence and associativity come from the operator registry.
  * @param input is the character read from input string
  * @param peekValue is the character at the top of the stack
  * @return enum PRECEDENCE of the input character
  */
 enum PRECEDENCE compare(char input, char peekValue) {
-    if (input == '/') {
-        switch (peekValue) {
-            case '/':
-                return EQUAL;
-            case '*':
-                return EQUAL;
-            case '+':
-                return HIGHER;
-            case '-':
-                return HIGHER;
-            default:
-                return LOWER;
-        }
-    }
-
-    if (input == '*') {
-        switch (peekValue) {
-            case '/':
-                return EQUAL;
-            case '*':
-                return EQUAL;
-            case '+':
-                return HIGHER;
-            case '-':
-                return HIGHER;
-            default:
-                return LOWER;
-        }
-    }
-
-    if (input == '+') {
-        switch (peekValue) {
-            case '/':
-                return LOWER;
-            case '*':
-                return LOWER;
-            case '+':
-                return EQUAL;
-            case '-':
-                return EQUAL;
-            default:
-                return LOWER;
-        }
-    }
-
-    if (input == '-') {
-        switch (peekValue) {
-            case '/':
-                return LOWER;
-            case '*':
-                return LOWER;
-            case '+':
-                return EQUAL;
-            case '-':
-                return EQUAL;
-            default:
-                return LOWER;
-        }
-    }
-
-    return HIGHER;
+    const OPERATOR_INFO *in = operatorInfo(input);
+    const OPERATOR_INFO *top = operatorInfo(peekValue);
+
+    if (in->precedence == 0)
+        return HIGHER;
+    if ((top->precedence == 0) || (in->precedence < top->precedence))
+        return LOWER;
+    if (in->precedence > top->precedence)
+        return HIGHER;
+    // Right associative operator waits for its right operand instead of reducing the left one
+    return (in->associativity == RIGHT_ASSOCIATIVE) ? HIGHER : EQUAL;
 }
 
 
 
 /**
  * digitHandler function
- * This function finds the integer number as a string in a
- * given string and returns its integer equivalent
+ * This function finds the integer number in a given string
+ * and returns its integer equivalent.
+ * Digits are found and converted in a single pass without copying them.
  * @param exp is the expression string
+ * @param len is the length of the expression
  * @param i is the pointer to index number of the starting character
- * @return integer equivalent of the string
- */
-int digitHandler(const char *exp, int *i) {
-    size_t len = strlen(exp);
-    char str[MAX_INPUT_SIZE];
-    char tmp[MAX_INPUT_SIZE];
-    strcpy(str, "");
-    strcpy(tmp, "");
-    while ((*i < len) && (isdigit(exp[*i]))) {
-        sprintf(tmp, "%c", exp[*i]);
-        strcat(str, tmp);
-        *i += 1;
-    }
-    int intRep = toInt(str);
+ * @param overflow is the pointer to error flag, set when the number does not fit in VALUE,
+ * the caller decides whether it is an error
+ * @return integer equivalent of the string, it wraps around on overflow
+ */
+VALUE digitHandler(const char *exp, size_t len, size_t *i, BOOLEAN *overflow) {
+    size_t n = scanDigits(exp + *i, len - *i);
+    VALUE intRep = parseDigits(exp + *i, n, overflow);
+    *i += n;
     return intRep;
 }
 
@@ -283,65 +405,291 @@ int digitHandler(const char *exp, int *i) {
 
 /**
  * evaluateExpression function
- * This function is the main evaluation function.
- * All evaluation functions are called from this function.
- * @throws Input/Output error when invalid character is encountered
+ * This function evaluates a NUL terminated expression string.
  * @param exp is the expression string
- * @param operand is the pointer to operand stack
- * @param operator is the pointer to operator stack
+ * @param e is the pointer to evaluator context
  * @return result of the mathematical operations
  */
-int evaluateExpression(const char *exp, STACK *operand, STACK *operator) {
-    // Take the string length
-    size_t len = strlen(exp);
-    int i = 0;
-    if(exp[i] == '-') {
-        NEGATIVE_FLAG = TRUE;
-        i++;
+VALUE evaluateExpression(const char *exp, EVALUATOR *e) {
+    return evaluateBuffer(exp, strlen(exp), e);
+}
+
+
+
+/**
+ * pushOperand function
+ * Pushes a number read from the expression, negated when a unary minus is waiting.
+ * A push refused by a full stack that can not grow fails the expression.
+ * @param value is the value of the number
+ * @param overflow is TRUE when the number does not fit in VALUE
+ * @param e is the pointer to evaluator context
+ */
+static inline void pushOperand(VALUE value, BOOLEAN overflow, EVALUATOR *e) {
+    // Literals out of range are an error only in checked mode
+    if (UNLIKELY(overflow & e->checked))
+        raiseError(EVAL_OVERFLOW, e);
+    if(e->negativeFlag) {
+        e->negativeFlag = FALSE;
+
+        value = (VALUE) (0 - (uint64_t) value);
     }
-    enum CHAR_TYPE charType;
-    int tmp;
-
-    while (i < len) {
-        charType = typeOfChar(exp[i]);
-        switch (charType) {
-            case SPACE:
-                i++;
-                break;
-            case DIGIT:
-                tmp = digitHandler(exp, &i);
-                if(NEGATIVE_FLAG) {
-                    NEGATIVE_FLAG = FALSE;
+    e->lastOperation = OPERAND;
+    if (UNLIKELY(!valueStackPush(&e->operand, value))) {
+        METRICS_REJECT(e->metrics);
+        raiseError(EVAL_NO_MEMORY, e);
+    }
+    METRICS_DEPTH(e, operandHigh, e->operand.top);
+    TRACE_STEP(TRACE_NUMBER, 0, e);
+}
 
-                    tmp = -tmp;
+
+
+/**
+ * evaluateTokens function
+ * Reads the tokens of a buffer and applies them to the stacks.
+ * In a stream a number that reaches the end of the buffer may go on in the next buffer,
+ * it is kept in the context instead of being pushed.
+ * Errors raised while a token is evaluated are at the offset of the token.
+ * @param exp is the start of the buffer
+ * @param len is the length of the buffer in bytes
+ * @param stream is TRUE when the buffer is a part of the expression
+ * @param e is the pointer to evaluator context
+ * @return FALSE if an invalid character stopped the evaluation else TRUE
+ */
+static inline BOOLEAN evaluateTokens(const char *exp, size_t len, BOOLEAN stream, EVALUATOR *e) {
+    TOKENIZER tokenizer;
+    TOKEN token;
+    size_t end = 0;
+
+    initTokenizer(&tokenizer, exp, len);
+    e->position = &token.offset;
+    while (nextToken(&tokenizer, &token)) {
+        METRICS_TOKEN(e, &token, end);
+        switch (token.type) {
+            case TOKEN_NUMBER:
+                if (stream && (token.offset + token.length == len)) {
+                    e->partial = token.value;
+                    e->partialOverflow = token.overflow;
+                    e->partialOffset = e->consumed + token.offset;
+                    e->inNumber = TRUE;
+                    break;
                 }
-                LAST_OPERATION = OPERAND;
-                push(&tmp, operand);
-                printStackStatus(operand, operator);
+                pushOperand(token.value, token.overflow, e);
                 break;
-            case PUNCTUATION:
-                punctEval(exp[i], operator, operand);
-                //LAST_OPERATION = OPERATOR;
-                printStackStatus(operand, operator);
-                i++;
+            case TOKEN_PUNCTUATION:
+                punctEval(token.c, e);
+                //e->lastOperation = OPERATOR;
+                TRACE_STEP(TRACE_PUNCTUATION, token.c, e);
                 break;
-            case WRONG:
-                fprintf(stderr, "Invalid character\n");
-                errno = 5;
-                perror("Error: Invalid expression");
-                finalize(operand, operator);
-                exit(EXIT_FAILURE);
+            case TOKEN_INVALID:
+                // Caller decides how to report it, stacks are reset by the next expression
+                raiseError(EVAL_INVALID_CHARACTER, e);
+                e->invalid = TRUE;
+                e->position = NULL;
+                METRICS_END(e);
+                return FALSE;
         }
     }
+    e->position = NULL;
+    e->consumed += len;
+    return TRUE;
+}
+
+
 
-    // If any operation left, do operations until operand stack has 1 value
-    while (operand->top != 1) {
-        executeOperation(operator, operand);
-        printStackStatus(operand, operator);
+/**
+ * finishExpression function
+ * Executes the operations left on the stack after the last token.
+ * A well formed expression leaves exactly one operand, otherwise an error is raised.
+ * @param e is the pointer to evaluator context
+ * @return result of the expression
+ */
+static inline VALUE finishExpression(EVALUATOR *e) {
+    // If any operation left, do operations until operator stack is empty
+    while (!charStackIsEmpty(&e->operator)) {
+        executeOperation(e);
+        TRACE_STEP(TRACE_FINISH, 0, e);
     }
+    if (UNLIKELY(e->operand.top != 1))
+        raiseError((e->operand.top == 0) ? EVAL_MISSING_OPERAND : EVAL_MISSING_OPERATOR, e);
+    METRICS_END(e);
 
     // Return operand->item[0]
-    return *((int *) (operand->item));
+    return e->operand.item[0];
+}
+
+
+
+/**
+ * evaluateBuffer function
+ * This function is the main evaluation function.
+ * All evaluation functions are called from this function.
+ * Expression is read as a token stream produced by the tokenizer.
+ * Expression is given as pointer and length, it does not need a NUL terminator,
+ * so expressions can be evaluated in place inside a larger buffer or a mapped file.
+ * Nothing is printed and the process is never terminated, an invalid character
+ * stops the evaluation and sets e->invalid and e->error. Reason and offset of
+ * the first error are in e->status and e->errorOffset.
+ * @param exp is the start of the expression
+ * @param len is the length of the expression in bytes
+ * @param e is the pointer to evaluator context
+ * @return result of the mathematical operations, not meaningful when e->error is set
+ */
+VALUE evaluateBuffer(const char *exp, size_t len, EVALUATOR *e) {
+    beginEvaluation(e);
+    if (!evaluateTokens(exp, len, FALSE, e))
+        return 0;
+    return finishExpression(e);
+}
+
+
+
+/**
+ * beginEvaluation function
+ * Starts a streamed expression, it is given in parts with feedEvaluation.
+ * Stacks and parse state left over from a previous expression are reset.
+ * @param e is the pointer to evaluator context
+ */
+void beginEvaluation(EVALUATOR *e) {
+    valueStackReset(&e->operand);
+    charStackReset(&e->operator);
+    // Minus at the start of the expression is a unary minus
+    e->lastOperation = OPERATOR;
+    e->negativeFlag = FALSE;
+    e->error = FALSE;
+    e->invalid = FALSE;
+    e->status = EVAL_OK;
+    e->errorOffset = 0;
+    e->position = NULL;
+    e->consumed = 0;
+    e->inNumber = FALSE;
+    TRACE_BEGIN(e);
+    METRICS_BEGIN(e);
+}
+
+
+
+/**
+ * pushPartial function
+ * Pushes the number completed after the end of the part it started in
+ * @param e is the pointer to evaluator context
+ */
+static void pushPartial(EVALUATOR *e) {
+    size_t consumed = e->consumed;
+
+    // Offset of the number is counted from the start of the expression
+    e->inNumber = FALSE;
+    e->consumed = 0;
+    e->position = &e->partialOffset;
+    pushOperand(e->partial, e->partialOverflow, e);
+    e->position = NULL;
+    e->consumed = consumed;
+}
+
+
+
+/**
+ * feedEvaluation function
+ * Evaluates the next part of a streamed expression. Parts can be split anywhere,
+ * a number cut by the end of a part is completed with the leading digits of the next one.
+ * Operations are executed as soon as precedence allows, so memory depends on the
+ * nesting depth of the expression and not on its length.
+ * @param exp is the start of the part
+ * @param len is the length of the part in bytes
+ * @param e is the pointer to evaluator context
+ * @return FALSE if an invalid character stopped the evaluation else TRUE
+ */
+BOOLEAN feedEvaluation(const char *exp, size_t len, EVALUATOR *e) {
+    size_t n;
+
+    if (e->invalid)
+        return FALSE;
+    if (e->inNumber) {
+        n = scanDigits(exp, len);
+        e->partial = appendDigits(e->partial, exp, n, &e->partialOverflow);
+        e->consumed += n;
+        if (n == len)
+            return TRUE;
+        pushPartial(e);
+        exp += n;
+        len -= n;
+    }
+    return evaluateTokens(exp, len, TRUE, e);
+}
+
+
+
+/**
+ * endEvaluation function
+ * Ends a streamed expression and executes the operations left
+ * @param e is the pointer to evaluator context
+ * @return result of the expression, not meaningful when e->error is set
+ */
+VALUE endEvaluation(EVALUATOR *e) {
+    if (e->invalid)
+        return 0;
+    if (e->inNumber)
+        pushPartial(e);
+    return finishExpression(e);
+}
+
+
+
+/**
+ * initEvaluator function
+ * This function initializes evaluator context given as a pointer.
+ * Context owns the operand and operator stacks and all parse state,
+ * so every thread can evaluate expressions with its own context.
+ * Stacks start inside the context and move to the heap only for deep expressions.
+ * @param e is the pointer to evaluator context
+ */
+void initEvaluator(EVALUATOR *e) {
+    initEvaluatorArena(e, NULL);
+}
+
+
+
+/**
+ * initEvaluatorArena function
+ * This function initializes evaluator context whose stacks spill to the arena,
+ * so setting up a context does not call malloc and a deep expression calls it
+ * only when the arena is exhausted.
+ * Stacks start inside the context, nothing is allocated before they spill, so it can not fail.
+ * @param e is the pointer to evaluator context
+ * @param a is the pointer to arena the stacks spill to, NULL to spill to the heap
+ */
+void initEvaluatorArena(EVALUATOR *e, ARENA *a) {
+    valueStackInitInline(&e->operand, a);
+    charStackInitInline(&e->operator, a);
+    e->lastOperation = OPERAND;
+    e->negativeFlag = FALSE;
+    e->verbose = FALSE;
+    e->checked = TRUE;
+    e->error = FALSE;
+    e->invalid = FALSE;
+    e->status = EVAL_OK;
+    e->errorOffset = 0;
+    e->position = NULL;
+    e->consumed = 0;
+    e->partialOffset = 0;
+    e->inNumber = FALSE;
+    e->explain = FALSE;
+    e->cache = NULL;
+    e->metrics = NULL;
+}
+
+
+
+/**
+ * deleteEvaluator function
+ * Frees stacks of the evaluator context.
+ * Stacks taken from an arena are released with the arena,
+ * unless they have grown out of it.
+ * @param e is the pointer to evaluator context
+ */
+void deleteEvaluator(EVALUATOR *e) {
+    valueStackDelete(&e->operand);
+    charStackDelete(&e->operator);
 }
 
 
@@ -350,17 +698,43 @@ int evaluateExpression(const char *exp, STACK *operand, STACK *operator) {
  * initStack function
  * This function initialize stack given as a pointer
  * with its data type. Stack is simulated over array structure.
- * Array is dynamically allocated and its type is depends on type of t
+ * First STACK_INLINE_SIZE elements are kept inside the stack, the array is
+ * allocated only when the stack gets deeper. Stack holds MAX_STACK_SIZE elements.
  * @param s is the stack pointer
  * @param t is the enumeration type of the stack
  */
 void initStack(STACK *s, enum STACK_TYPE t) {
     s->type = t;
+    s->limit = MAX_STACK_SIZE;
     if (s->type == INT)
-        s->item = (int *) malloc(MAX_STACK_SIZE * sizeof(int));
+        intStackInitInline(&s->items.ints, NULL);
+    else
+        charStackInitInline(&s->items.chars, NULL);
+}
+
+
+
+/**
+ * initGrowableStack function
+ * This function initializes a stack without a size limit.
+ * Array starts with the given capacity and doubles whenever it is full,
+ * so memory use follows the deepest point the stack reaches.
+ * Capacities up to STACK_INLINE_SIZE are kept inside the stack.
+ * @param s is the stack pointer
+ * @param t is the enumeration type of the stack
+ * @param capacity is the initial number of elements
+ */
+void initGrowableStack(STACK *s, enum STACK_TYPE t, int capacity) {
+    s->type = t;
+    s->limit = 0;
+    if ((capacity <= STACK_INLINE_SIZE) && (s->type == INT))
+        intStackInitInline(&s->items.ints, NULL);
+    else if (capacity <= STACK_INLINE_SIZE)
+        charStackInitInline(&s->items.chars, NULL);
+    else if (s->type == INT)
+        intStackInit(&s->items.ints, capacity, TRUE);
     else
-        s->item = (char *) malloc(MAX_STACK_SIZE * sizeof(char));
-    s->top = 0;
+        charStackInit(&s->items.chars, capacity, TRUE);
 }
 
 
@@ -373,7 +747,7 @@ void initStack(STACK *s, enum STACK_TYPE t) {
  * @return TRUE if SP is 0 else FALSE
  */
 BOOLEAN isEmpty(const STACK *s) {
-    return (s->top == 0) ? TRUE : FALSE;
+    return (s->type == INT) ? intStackIsEmpty(&s->items.ints) : charStackIsEmpty(&s->items.chars);
 }
 
 
@@ -381,12 +755,15 @@ BOOLEAN isEmpty(const STACK *s) {
 /**
  * isFull function
  * This function controls top field of the given stack
- * and returns TRUE if top indicates MAX_STACK_SIZE else FALSE
+ * and returns TRUE if top indicates capacity of the stack else FALSE
+ * Stack of initStack is full at its limit, not when its inline elements are used.
  * @param s is the stack pointer
- * @return TRUE if SP is MAX_STACK_SIZE else FALSE
+ * @return TRUE if SP is capacity else FALSE
  */
 BOOLEAN isFull(const STACK *s) {
-    return (s->top == MAX_STACK_SIZE) ? TRUE : FALSE;
+    if (s->limit != 0)
+        return (s->type == INT) ? (s->items.ints.top == s->limit) : (s->items.chars.top == s->limit);
+    return (s->type == INT) ? intStackIsFull(&s->items.ints) : charStackIsFull(&s->items.chars);
 }
 
 
@@ -394,20 +771,24 @@ BOOLEAN isFull(const STACK *s) {
 /**
  * push function
  * This function appends given value to array field of the stack
+ * Growable stacks are grown when they are full, stack of initStack rejects values over its limit.
  *
  * @param x is the pointer of the variable which holds value appended to array
  * @param s is the pointer to stack
  * @return TRUE if stack is not full else FALSE
  */
 BOOLEAN push(void *x, STACK *s) {
-    if (isFull(s) == FALSE) {
-        if (s->type == INT)
-            *((int *) (s->item) + s->top++) = *(int *) x;
-        else
-            *((char *) (s->item) + s->top++) = *(char *) x;
-        return TRUE;
-    }
-    return FALSE;
+    BOOLEAN ok;
+
+    if ((s->limit != 0) && isFull(s))
+        ok = FALSE;
+    else if (s->type == INT)
+        ok = intStackPush(&s->items.ints, *(int *) x);
+    else
+        ok = charStackPush(&s->items.chars, *(char *) x);
+    if (UNLIKELY(!ok))
+        METRICS_REJECT(metricsActive);
+    return ok;
 }
 
 
@@ -421,16 +802,10 @@ BOOLEAN push(void *x, STACK *s) {
  * @return TRUE if stack is not empty else FALSE
  */
 BOOLEAN pop(void *x, STACK *s) {
-    if (isEmpty(s) == FALSE) {
-        s->top -= 1;
-        if (s->type == INT)
-            *(int *) x = *((int *) (s->item) + (s->top));
-        else
-            *(char *) x = *((char *) (s->item) + (s->top));
-
-        return TRUE;
-    }
-    return FALSE;
+    if (s->type == INT)
+        return intStackPop(&s->items.ints, (int *) x);
+    else
+        return charStackPop(&s->items.chars, (char *) x);
 }
 
 
@@ -444,14 +819,58 @@ BOOLEAN pop(void *x, STACK *s) {
  * @return TRUE if stack is not empty else FALSE
  */
 BOOLEAN peek(void *x, const STACK *s) {
-    if (isEmpty(s) == FALSE) {
-        if (s->type == INT)
-            *(int *) x = *((int *) (s->item) + (s->top-1));
-        else
-            *(char *) x = *((char *) (s->item) + (s->top-1));
-        return TRUE;
-    }
-    return FALSE;
+    if (s->type == INT)
+        return intStackPeek(&s->items.ints, (int *) x);
+    else
+        return charStackPeek(&s->items.chars, (char *) x);
+}
+
+
+
+/**
+ * printIntStack function
+ * This function prints values of an int stack
+ * @param s is the pointer to stack
+ * @param out is the output stream
+ */
+static void printIntStack(const INT_STACK *s, FILE *out) {
+    int i;
+    fprintf(out, "\nStack: \n");
+    for (i = 0; i < s->top; i++)
+        fprintf(out, "%d\t", s->item[i]);
+    fprintf(out, "\n");
+}
+
+
+
+/**
+ * printValueStack function
+ * This function prints values of an operand stack
+ * @param s is the pointer to stack
+ * @param out is the output stream
+ */
+static void printValueStack(const VALUE_STACK *s, FILE *out) {
+    int i;
+    fprintf(out, "\nStack: \n");
+    for (i = 0; i < s->top; i++)
+        fprintf(out, "%" PRId64 "\t", s->item[i]);
+    fprintf(out, "\n");
+}
+
+
+
+/**
+ * printCharStack function
+ * This function prints values of a char stack
+ * @param s is the pointer to stack
+ * @param out is the output stream
+ */
+static void printCharStack(const CHAR_STACK *s, FILE *out) {
+    int i;
+    fprintf(out, "\nStack: \n");
+    for (i = 0; i < s->top; i++)
+        fprintf(out, "%c\t", s->item[i]);
+    fprintf(out, "\n");
 }
 
 
@@ -460,34 +879,31 @@ BOOLEAN peek(void *x, const STACK *s) {
  * printStack function
  * This function prints given stack and its values
  * @param s is the pointer to stack
+ * @param out is the output stream
  */
-void printStack(const STACK *s) {
-    int i;
-    printf("\nStack: \n");
-    if (s->type == INT) {
-        for (i = 0; i < s->top; i++)
-            printf("%d\t", *((int *) (s->item) + i));
-    } else {
-        for (i = 0; i < s->top; i++)
-            printf("%c\t", *((char *) (s->item) + i));
-    }
-    printf("\n");
+void printStack(const STACK *s, FILE *out) {
+    if (s->type == INT)
+        printIntStack(&s->items.ints, out);
+    else
+        printCharStack(&s->items.chars, out);
 }
 
 
 
 /**
  * printStackStatus function
- * This function calls printStack function and prints styling
- * characters to terminal.
- * This function is called whenever a stack operation happens.
+ * This function prints both stacks of the evaluator and styling
+ * characters to the given stream.
+ * Trace decoder calls this function for every recorded step
+ * of a verbose evaluator context.
  * @param operand is the pointer to operand stack
  * @param operator is the pointer to operator stack
+ * @param out is the output stream
  */
-void printStackStatus(const STACK *operand, const STACK *operator) {
-    printStack(operand);
-    printStack(operator);
-    printf("-----------\n");
+void printStackStatus(const VALUE_STACK *operand, const CHAR_STACK *operator, FILE *out) {
+    printValueStack(operand, out);
+    printCharStack(operator, out);
+    fprintf(out, "-----------\n");
 }
 
 
@@ -496,19 +912,34 @@ void printStackStatus(const STACK *operand, const STACK *operator) {
  * toInt function
  * This function finds integer equivalent of the given string
  * @param str is the given string
+ * Values that do not fit in VALUE wrap around.
  * @return integer equivalent of the given string
  */
-int toInt(const char *str) {
-    int len = 0;
-    int i = 0;
-    while(str[len++] != '\0');
-    len--;
-    int result=0;
+VALUE toInt(const char *str) {
+    BOOLEAN overflow;
+    return parseDigits(str, strlen(str), &overflow);
+}
 
-    for(i = 0; i < len; i++) {
-        result *= 10;
-        result += str[i] - '0';
-    }
 
-    return result;
+
+/**
+ * evalStatusString function
+ * Finds the message of an evaluation status, a value outside the enum has a message too
+ * @param status is the status of an evaluation
+ * @return message of the status, "unknown status" for a value outside the enum
+ */
+const char *evalStatusString(enum EVAL_STATUS status) {
+    static const char *const STRINGS[] = {
+            "success",
+            "arithmetic overflow",
+            "division by zero",
+            "invalid character",
+            "missing operand",
+            "missing operator",
+            "unbalanced parenthesis",
+            "out of memory"
+    };
+    if (((int) status < 0) || ((int) status >= (int) (sizeof(STRINGS) / sizeof(STRINGS[0]))))
+        return "unknown status";
+    return STRINGS[status];
 }
\ No newline at end of file
@@ -1,10 +1,14 @@
 #ifndef EXPEVAL_STACK_H
 #define EXPEVAL_STACK_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include "stack_template.h"
+
 #define MAX_STACK_SIZE 100
 #define MAX_INPUT_SIZE 100
-#define FALSE 0
-#define TRUE 1
+// Streamed expressions are read in parts of this size
+#define STREAM_CHUNK_SIZE (64 * 1024)
 
 enum OPERATION_TYPE {
     OPERAND, OPERATOR
@@ -35,24 +39,97 @@ enum PRECEDENCE {
     HIGHER, EQUAL, LOWER
 };
 
+/*
+ * Reason an expression has no result, EVAL_OK when it has one.
+ * Overflow and division by zero are arithmetic errors of a well formed expression,
+ * no memory is a stack that could not grow, the others are found in malformed input.
+ */
+enum EVAL_STATUS {
+    EVAL_OK, EVAL_OVERFLOW, EVAL_DIVISION_BY_ZERO, EVAL_INVALID_CHARACTER,
+    EVAL_MISSING_OPERAND, EVAL_MISSING_OPERATOR, EVAL_UNBALANCED_PARENTHESIS, EVAL_NO_MEMORY
+};
+
+// Operand type of the evaluator, arithmetic is done on 64 bits
+typedef int64_t VALUE;
+
+// Typed stacks used by the evaluator
+DEFINE_STACK(INT_STACK, intStack, int)
+
+DEFINE_STACK(VALUE_STACK, valueStack, VALUE)
+
+DEFINE_STACK(CHAR_STACK, charStack, char)
+
 /*
  * Using struct for Stack data type.
- * It holds and keeps everything about stack in one place.
- * void *item is keeps elements
- * int top is the stack pointer(SP) and shows top of the stack
- * STACK_TYPE is the type of the elements in the item array
+ * It is the type erased wrapper over the typed stacks and keeps
+ * the original push/pop/peek API with void * arguments.
+ * items holds the typed stack selected by type
+ * STACK_TYPE is the type of the elements in the stack
+ * limit is the number of elements push accepts, 0 when the stack grows without limit
  */
 typedef struct {
-    void *item;
-    int top;
+    union {
+        INT_STACK ints;
+        CHAR_STACK chars;
+    } items;
     enum STACK_TYPE type;
+    int limit;
 } STACK;
 
-typedef int BOOLEAN;
+/*
+ * Evaluator context.
+ * It owns both stacks and all parse state of one evaluation,
+ * so independent contexts can be used from different threads.
+ * lastOperation is the type of the last token, it separates unary and binary minus
+ * negativeFlag is set when the next number will be negated, unary minus in front of
+ * a parenthesis is an operator on the operator stack instead
+ * verbose records every step to the trace ring of the thread, see trace.h
+ * checked selects overflow checked arithmetic, otherwise results wrap around at 64 bits
+ * error is set when an operation overflows or divides by zero or the expression is malformed,
+ * it stays set until the next expression
+ * invalid is set when evaluation stops at a character that can not be in an expression,
+ * error is set with it, so callers that only test error treat the expression as failed
+ * status is the reason of the first error and errorOffset is the byte offset where it was found,
+ * errors found after the last token are at the length of the expression
+ * position points to the offset of the token being evaluated in the current part, NULL between parts,
+ * consumed is the length of the parts before it, errors read them only when they are raised
+ * partial is the value of a number cut by the end of a streamed part, inNumber is set while
+ * there is one, partialOverflow is its overflow flag and partialOffset is where it starts
+ * explain makes batch mode write the reason and offset of an error instead of error only
+ * cache is the expression cache shared by batch workers, NULL when caching is off, see cache.h
+ * metrics are the counters of the evaluating thread while metrics are collected, see metrics.h
+ */
+struct CACHE;
+
+struct METRICS_COUNTERS;
+
+typedef struct {
+    VALUE_STACK operand;
+    CHAR_STACK operator;
+    enum OPERATION_TYPE lastOperation;
+    BOOLEAN negativeFlag;
+    BOOLEAN verbose;
+    BOOLEAN checked;
+    BOOLEAN error;
+    BOOLEAN invalid;
+    enum EVAL_STATUS status;
+    size_t errorOffset;
+    const size_t *position;
+    size_t consumed;
+    VALUE partial;
+    BOOLEAN partialOverflow;
+    size_t partialOffset;
+    BOOLEAN inNumber;
+    BOOLEAN explain;
+    struct CACHE *cache;
+    struct METRICS_COUNTERS *metrics;
+} EVALUATOR;
 
 // Function prototypes
 void initStack(STACK *stack, enum STACK_TYPE type);
 
+void initGrowableStack(STACK *stack, enum STACK_TYPE type, int capacity);
+
 BOOLEAN isEmpty(const STACK *stack);
 
 BOOLEAN isFull(const STACK *stack);
@@ -63,28 +140,46 @@ BOOLEAN pop(void *x, STACK *stack);
 
 BOOLEAN peek(void *x, const STACK *stack);
 
-void printStack(const STACK *stack);
+void printStack(const STACK *stack, FILE *out);
 
-void printStackStatus(const STACK *operand, const STACK *operator);
+void printStackStatus(const VALUE_STACK *operand, const CHAR_STACK *operator, FILE *out);
+
+void resetStack(STACK *stack);
 
 void deleteStack(STACK *stack);
 
-void finalize(STACK *stack, ...);
+void initEvaluator(EVALUATOR *e);
+
+void initEvaluatorArena(EVALUATOR *e, struct ARENA *a);
+
+void deleteEvaluator(EVALUATOR *e);
 
-int evaluateExpression(const char *exp, STACK *operand, STACK *operator);
+VALUE evaluateExpression(const char *exp, EVALUATOR *e);
 
-void operatorEval(char c, STACK *operator, STACK *operand);
+VALUE evaluateBuffer(const char *exp, size_t len, EVALUATOR *e);
 
-void operate(char c, char peek, enum PRECEDENCE p, BOOLEAN flag, STACK *operator, STACK *operand);
+void beginEvaluation(EVALUATOR *e);
+
+BOOLEAN feedEvaluation(const char *exp, size_t len, EVALUATOR *e);
+
+VALUE endEvaluation(EVALUATOR *e);
+
+void punctEval(char c, EVALUATOR *e);
+
+void operatorEval(char c, EVALUATOR *e);
+
+void operate(char c, char peek, enum PRECEDENCE p, BOOLEAN flag, EVALUATOR *e);
 
 enum CHAR_TYPE typeOfChar(char c);
 
 enum PRECEDENCE compare(char input, char peekValue);
 
-int digitHandler(const char *exp, int *i);
+VALUE digitHandler(const char *exp, size_t len, size_t *i, BOOLEAN *overflow);
+
+void executeOperation(EVALUATOR *e);
 
-void executeOperation(STACK *operator, STACK *operand);
+VALUE toInt(const char *str);
 
-int toInt(const char *str);
+const char *evalStatusString(enum EVAL_STATUS status);
 
 #endif //EXPEVAL_STACK_H
\ No newline at end of file
@@ -0,0 +1,177 @@
+#ifndef EXPEVAL_STACK_TEMPLATE_H
+#define EXPEVAL_STACK_TEMPLATE_H
+
+#include <stdlib.h>
+
+#define FALSE 0
+#define TRUE 1
+#define INITIAL_STACK_SIZE 16
+// Number of elements every stack keeps inside its struct, at least 1
+#ifndef STACK_INLINE_SIZE
+#define STACK_INLINE_SIZE 16
+#endif
+// Growable stacks larger than this are kept in mapped memory and grown with mremap
+#define MAPPED_STACK_BYTES (64 * 1024)
+
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+typedef int BOOLEAN;
+
+/*
+ * Where the item array of a stack lives.
+ * Heap arrays come from malloc, mapped arrays from mmap
+ * and arena arrays are blocks of an ARENA released with the arena.
+ * Inline array is the inlineItem field of the stack itself.
+ */
+enum STORAGE_TYPE {
+    HEAP_STORAGE, MAPPED_STORAGE, ARENA_STORAGE, INLINE_STORAGE
+};
+
+struct ARENA;
+
+// Storage helpers shared by every generated stack type
+BOOLEAN growStackItems(void **item, int *capacity, int top, size_t size, enum STORAGE_TYPE *storage,
+                       struct ARENA *arena);
+
+void freeStackItems(void *item, int capacity, size_t size, enum STORAGE_TYPE storage);
+
+void *allocStackItems(struct ARENA *arena, size_t bytes);
+
+/*
+ * Typed stack template.
+ * DEFINE_STACK(TYPE, PREFIX, T) generates a stack struct named TYPE holding
+ * elements of T and static inline functions named PREFIX##Push, PREFIX##Pop, ...
+ * Element type is known at compile time, so there is no type branch and no
+ * cast through void *, and the compiler can keep top in a register.
+ * T can be any type that can be copied by assignment, including structs.
+ * PREFIX##InitArena takes the array from an arena, such stacks grow inside the arena
+ * and are released together with it.
+ * PREFIX##InitInline starts with the STACK_INLINE_SIZE elements inside the struct, so a stack
+ * in a local variable or in a context needs no allocation until it gets deeper than that.
+ * Then it spills to the arena, or to the heap when there is no arena. The item array of an inline
+ * stack points into the struct, so the stack must not be copied or moved after it is initialized.
+ *
+ * Example:
+ *      DEFINE_STACK(DOUBLE_STACK, doubleStack, double)
+ *      DOUBLE_STACK s;
+ *      doubleStackInit(&s, INITIAL_STACK_SIZE, TRUE);
+ *      doubleStackPush(&s, 2.5);
+ *
+ * Unchecked variants do not test for full or empty stack. They are for callers that
+ * have already proven the depth bound, for example after PREFIX##Reserve.
+ *
+ * item is the element array, top is the stack pointer(SP)
+ * capacity is the number of elements item array can hold
+ * growable stacks double their capacity instead of rejecting push when full
+ * storage tells how item array is allocated, arena is the owner of arena storage
+ * inlineItem is the array of inline storage, it is placed after the fields push and pop use
+ */
+#define DEFINE_STACK(TYPE, PREFIX, T)                                           \
+typedef struct {                                                                \
+    T *item;                                                                    \
+    int top;                                                                    \
+    int capacity;                                                               \
+    BOOLEAN growable;                                                           \
+    enum STORAGE_TYPE storage;                                                  \
+    struct ARENA *arena;                                                        \
+    T inlineItem[STACK_INLINE_SIZE];                                            \
+} TYPE;                                                                         \
+                                                                                \
+static inline BOOLEAN PREFIX##Init(TYPE *s, int capacity, BOOLEAN growable) {   \
+    s->capacity = (capacity > 0) ? capacity : INITIAL_STACK_SIZE;               \
+    s->item = (T *) malloc(s->capacity * sizeof(T));                            \
+    s->top = 0;                                                                 \
+    s->growable = growable;                                                     \
+    s->storage = HEAP_STORAGE;                                                  \
+    s->arena = NULL;                                                            \
+    return (s->item != NULL) ? TRUE : FALSE;                                    \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##InitArena(TYPE *s, struct ARENA *arena, int capacity) { \
+    s->capacity = (capacity > 0) ? capacity : INITIAL_STACK_SIZE;               \
+    s->item = (T *) allocStackItems(arena, s->capacity * sizeof(T));            \
+    s->top = 0;                                                                 \
+    s->growable = TRUE;                                                         \
+    s->storage = ARENA_STORAGE;                                                 \
+    s->arena = arena;                                                           \
+    return (s->item != NULL) ? TRUE : FALSE;                                    \
+}                                                                               \
+                                                                                \
+static inline void PREFIX##InitInline(TYPE *s, struct ARENA *arena) {           \
+    s->capacity = STACK_INLINE_SIZE;                                            \
+    s->item = s->inlineItem;                                                    \
+    s->top = 0;                                                                 \
+    s->growable = TRUE;                                                         \
+    s->storage = INLINE_STORAGE;                                                \
+    s->arena = arena;                                                           \
+}                                                                               \
+                                                                                \
+static inline void PREFIX##Delete(TYPE *s) {                                    \
+    freeStackItems(s->item, s->capacity, sizeof(T), s->storage);                \
+    s->item = NULL;                                                             \
+    s->capacity = 0;                                                            \
+    s->top = 0;                                                                 \
+}                                                                               \
+                                                                                \
+static inline void PREFIX##Reset(TYPE *s) {                                     \
+    s->top = 0;                                                                 \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##IsEmpty(const TYPE *s) {                          \
+    return (s->top == 0) ? TRUE : FALSE;                                        \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##IsFull(const TYPE *s) {                           \
+    return (s->top == s->capacity) ? TRUE : FALSE;                              \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##Grow(TYPE *s) {                                   \
+    void *item = s->item;                                                       \
+    if (!s->growable || !growStackItems(&item, &s->capacity, s->top, sizeof(T), &s->storage, s->arena)) \
+        return FALSE;                                                           \
+    s->item = (T *) item;                                                       \
+    return TRUE;                                                                \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##Reserve(TYPE *s, int count) {                     \
+    while (s->capacity - s->top < count) {                                      \
+        if (!PREFIX##Grow(s))                                                   \
+            return FALSE;                                                       \
+    }                                                                           \
+    return TRUE;                                                                \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##Push(TYPE *s, T x) {                              \
+    if (UNLIKELY(s->top == s->capacity) && !PREFIX##Grow(s))                    \
+        return FALSE;                                                           \
+    s->item[s->top++] = x;                                                      \
+    return TRUE;                                                                \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##Pop(TYPE *s, T *x) {                              \
+    if (UNLIKELY(s->top == 0))                                                  \
+        return FALSE;                                                           \
+    *x = s->item[--s->top];                                                     \
+    return TRUE;                                                                \
+}                                                                               \
+                                                                                \
+static inline BOOLEAN PREFIX##Peek(const TYPE *s, T *x) {                       \
+    if (UNLIKELY(s->top == 0))                                                  \
+        return FALSE;                                                           \
+    *x = s->item[s->top - 1];                                                   \
+    return TRUE;                                                                \
+}                                                                               \
+                                                                                \
+static inline void PREFIX##PushUnchecked(TYPE *s, T x) {                        \
+    s->item[s->top++] = x;                                                      \
+}                                                                               \
+                                                                                \
+static inline T PREFIX##PopUnchecked(TYPE *s) {                                 \
+    return s->item[--s->top];                                                   \
+}                                                                               \
+                                                                                \
+static inline T PREFIX##PeekUnchecked(const TYPE *s) {                          \
+    return s->item[s->top - 1];                                                 \
+}
+
+#endif //EXPEVAL_STACK_TEMPLATE_H
\ No newline at end of file
@@ -0,0 +1,442 @@
+#include "tokenizer.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86
+#endif
+
+/*
+ * Character classes of the C locale, same as isspace, isdigit and ispunct.
+ * One table load replaces the three library calls of typeOfChar.
+ */
+#define S SPACE
+#define D DIGIT
+#define P PUNCTUATION
+#define W WRONG
+const unsigned char CHAR_CLASS[256] = {
+        W, W, W, W, W, W, W, W, W, S, S, S, S, S, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        S, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P,
+        D, D, D, D, D, D, D, D, D, D, P, P, P, P, P, P,
+        P, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, P, P, P, P, P,
+        P, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, P, P, P, P, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W,
+        W, W, W, W, W, W, W, W, W, W, W, W, W, W, W, W
+};
+#undef S
+#undef D
+#undef P
+#undef W
+
+// Powers of ten used to place a partial block of digits
+static const uint32_t POW10[9] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+
+
+/**
+ * skipSpacesScalar function
+ * Counts whitespace characters at the start of the buffer, one byte at a time
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading whitespace characters
+ */
+static size_t skipSpacesScalar(const char *p, size_t len) {
+    size_t i = 0;
+    while ((i < len) && (CHAR_CLASS[(unsigned char) p[i]] == SPACE))
+        i++;
+    return i;
+}
+
+
+
+/**
+ * scanDigitsScalar function
+ * Counts digit characters at the start of the buffer, one byte at a time
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading digits
+ */
+static size_t scanDigitsScalar(const char *p, size_t len) {
+    size_t i = 0;
+    while ((i < len) && (CHAR_CLASS[(unsigned char) p[i]] == DIGIT))
+        i++;
+    return i;
+}
+
+
+
+#ifdef TOKENIZER_X86
+
+/*
+ * Byte range tests for vectors.
+ * A byte is in [low, low + count] when (byte - low) as unsigned is not above count,
+ * min_epu8 gives the unsigned comparison SSE2 and AVX2 do not have.
+ */
+__attribute__((target("sse2")))
+static inline __m128i rangeMask128(__m128i v, char low, char count) {
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(count)), x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rangeMask256(__m256i v, char low, char count) {
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(count)), x);
+}
+
+
+
+/**
+ * skipSpacesSSE2 function
+ * Counts leading whitespace characters 16 bytes at a time
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading whitespace characters
+ */
+__attribute__((target("sse2")))
+static size_t skipSpacesSSE2(const char *p, size_t len) {
+    size_t i = 0;
+    unsigned mask;
+    __m128i v;
+
+    while (i + 16 <= len) {
+        v = _mm_loadu_si128((const __m128i *) (p + i));
+        v = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), rangeMask128(v, '\t', '\r' - '\t'));
+        mask = ~(unsigned) _mm_movemask_epi8(v) & 0xFFFFu;
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + skipSpacesScalar(p + i, len - i);
+}
+
+
+
+/**
+ * scanDigitsSSE2 function
+ * Counts leading digits 16 bytes at a time
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading digits
+ */
+__attribute__((target("sse2")))
+static size_t scanDigitsSSE2(const char *p, size_t len) {
+    size_t i = 0;
+    unsigned mask;
+    __m128i v;
+
+    while (i + 16 <= len) {
+        v = rangeMask128(_mm_loadu_si128((const __m128i *) (p + i)), '0', 9);
+        mask = ~(unsigned) _mm_movemask_epi8(v) & 0xFFFFu;
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + scanDigitsScalar(p + i, len - i);
+}
+
+
+
+/**
+ * skipSpacesAVX2 function
+ * Counts leading whitespace characters 32 bytes at a time
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading whitespace characters
+ */
+__attribute__((target("avx2")))
+static size_t skipSpacesAVX2(const char *p, size_t len) {
+    size_t i = 0;
+    unsigned mask;
+    __m256i v;
+
+    while (i + 32 <= len) {
+        v = _mm256_loadu_si256((const __m256i *) (p + i));
+        v = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), rangeMask256(v, '\t', '\r' - '\t'));
+        mask = ~(unsigned) _mm256_movemask_epi8(v);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    return i + skipSpacesSSE2(p + i, len - i);
+}
+
+
+
+/**
+ * scanDigitsAVX2 function
+ * Counts leading digits 32 bytes at a time
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading digits
+ */
+__attribute__((target("avx2")))
+static size_t scanDigitsAVX2(const char *p, size_t len) {
+    size_t i = 0;
+    unsigned mask;
+    __m256i v;
+
+    while (i + 32 <= len) {
+        v = rangeMask256(_mm256_loadu_si256((const __m256i *) (p + i)), '0', 9);
+        mask = ~(unsigned) _mm256_movemask_epi8(v);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    return i + scanDigitsSSE2(p + i, len - i);
+}
+
+#endif
+
+// Implementations selected for this CPU
+static size_t (*skipSpacesImpl)(const char *, size_t) = skipSpacesScalar;
+static size_t (*scanDigitsImpl)(const char *, size_t) = scanDigitsScalar;
+static const char *backendName = "scalar";
+
+
+
+/**
+ * selectTokenizer function
+ * Runtime CPU dispatch, runs once when the program is loaded.
+ * Picks the widest vector unit the CPU supports.
+ */
+__attribute__((constructor))
+static void selectTokenizer(void) {
+#ifdef TOKENIZER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        skipSpacesImpl = skipSpacesAVX2;
+        scanDigitsImpl = scanDigitsAVX2;
+        backendName = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        skipSpacesImpl = skipSpacesSSE2;
+        scanDigitsImpl = scanDigitsSSE2;
+        backendName = "sse2";
+    }
+#endif
+}
+
+
+
+/**
+ * tokenizerBackend function
+ * Names the implementation selected by runtime dispatch
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *tokenizerBackend(void) {
+    return backendName;
+}
+
+
+
+/**
+ * skipSpaces function
+ * Counts whitespace characters at the start of the buffer
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading whitespace characters
+ */
+size_t skipSpaces(const char *p, size_t len) {
+    return skipSpacesImpl(p, len);
+}
+
+
+
+/**
+ * scanDigits function
+ * Counts digit characters at the start of the buffer
+ * @param p is the start of the buffer
+ * @param len is the length of the buffer
+ * @return number of leading digits
+ */
+size_t scanDigits(const char *p, size_t len) {
+    return scanDigitsImpl(p, len);
+}
+
+
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+/**
+ * swarDigits function
+ * Converts 8 ASCII digits to their value with three multiply and mask steps.
+ * First digit is in the lowest byte and it is the most significant digit.
+ * Every step merges neighbouring lanes: pairs of digits, then pairs of two digit
+ * numbers, then pairs of four digit numbers.
+ * @param v is the 8 digit characters loaded as a little endian integer
+ * @return value of the 8 digit number
+ */
+static inline uint32_t swarDigits(uint64_t v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v * 10000 + (v >> 32)) & 0x00000000FFFFFFFFULL;
+    return (uint32_t) v;
+}
+
+
+
+/**
+ * parseDigits function
+ * Converts a run of digits to its integer value, 8 digits per step.
+ * A last partial block is padded with leading zeros, so there is no branch per digit.
+ * Overflow is collected per block with flag setting instructions instead of branches.
+ * Values wider than VALUE wrap around at 64 bits.
+ * @param p is the first digit
+ * @param len is the number of digits
+ * @param overflow is the pointer to flag set when the value does not fit in VALUE
+ * @return integer value of the digits
+ */
+VALUE parseDigits(const char *p, size_t len, BOOLEAN *overflow) {
+    uint64_t result = 0;
+    uint64_t block;
+    char padded[8];
+    BOOLEAN wide = FALSE;
+
+    while (len >= 8) {
+        memcpy(&block, p, 8);
+        wide |= __builtin_mul_overflow(result, 100000000u, &result);
+        wide |= __builtin_add_overflow(result, swarDigits(block), &result);
+        p += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        memset(padded, '0', 8);
+        memcpy(padded + 8 - len, p, len);
+        memcpy(&block, padded, 8);
+        wide |= __builtin_mul_overflow(result, POW10[len], &result);
+        wide |= __builtin_add_overflow(result, swarDigits(block), &result);
+    }
+    *overflow = wide | (result > (uint64_t) INT64_MAX);
+    return (VALUE) result;
+}
+
+#else
+
+/**
+ * parseDigits function
+ * Converts a run of digits to its integer value, digit by digit on big endian targets
+ * @param p is the first digit
+ * @param len is the number of digits
+ * @param overflow is the pointer to flag set when the value does not fit in VALUE
+ * @return integer value of the digits
+ */
+VALUE parseDigits(const char *p, size_t len, BOOLEAN *overflow) {
+    uint64_t result = 0;
+    BOOLEAN wide = FALSE;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        wide |= __builtin_mul_overflow(result, 10u, &result);
+        wide |= __builtin_add_overflow(result, (uint64_t) (p[i] - '0'), &result);
+    }
+    *overflow = wide | (result > (uint64_t) INT64_MAX);
+    return (VALUE) result;
+}
+
+#endif
+
+
+
+/**
+ * appendDigits function
+ * Continues a number whose first digits were parsed before, for numbers
+ * split between two buffers. Digits are taken 8 at a time like parseDigits.
+ * @param value is the value of the digits parsed before
+ * @param p is the first digit of the continuation
+ * @param len is the number of digits
+ * @param overflow is the pointer to flag of the number, it is set and never cleared
+ * @return integer value of all digits, wraps around at 64 bits
+ */
+VALUE appendDigits(VALUE value, const char *p, size_t len, BOOLEAN *overflow) {
+    uint64_t result = (uint64_t) value;
+    uint64_t block;
+    BOOLEAN wide = FALSE;
+    BOOLEAN unused;
+    size_t n;
+
+    while (len > 0) {
+        n = (len < 8) ? len : 8;
+        block = (uint64_t) parseDigits(p, n, &unused);
+        wide |= __builtin_mul_overflow(result, POW10[n], &result);
+        wide |= __builtin_add_overflow(result, block, &result);
+        p += n;
+        len -= n;
+    }
+    *overflow |= wide | (result > (uint64_t) INT64_MAX);
+    return (VALUE) result;
+}
+
+
+
+/**
+ * initTokenizer function
+ * Prepares the tokenizer to read the expression from the start
+ * @param t is the pointer to tokenizer
+ * @param exp is the start of the expression
+ * @param len is the length of the expression
+ */
+void initTokenizer(TOKENIZER *t, const char *exp, size_t len) {
+    t->exp = exp;
+    t->len = len;
+    t->pos = 0;
+}
+
+
+
+/**
+ * nextToken function
+ * Reads the next token of the expression in a single pass.
+ * Whitespace is skipped, a run of digits becomes one number token with its value.
+ * Short runs are decided from the first bytes, vector scans start only for longer runs.
+ * @param t is the pointer to tokenizer
+ * @param token is the pointer to token to be filled
+ * @return TRUE if a token is read, FALSE at the end of the expression
+ */
+BOOLEAN nextToken(TOKENIZER *t, TOKEN *token) {
+    const char *exp = t->exp;
+    size_t len = t->len;
+    size_t pos = t->pos;
+    size_t n;
+
+    if ((pos < len) && (CHAR_CLASS[(unsigned char) exp[pos]] == SPACE))
+        pos += skipSpaces(exp + pos, len - pos);
+    if (pos >= len) {
+        t->pos = pos;
+        return FALSE;
+    }
+
+    token->offset = pos;
+    token->c = exp[pos];
+    switch (CHAR_CLASS[(unsigned char) exp[pos]]) {
+        case DIGIT:
+            n = 1;
+            if ((pos + 1 < len) && (CHAR_CLASS[(unsigned char) exp[pos + 1]] == DIGIT))
+                n += scanDigits(exp + pos + 1, len - pos - 1);
+            token->type = TOKEN_NUMBER;
+            token->value = parseDigits(exp + pos, n, &token->overflow);
+            token->length = n;
+            break;
+        case PUNCTUATION:
+            token->type = TOKEN_PUNCTUATION;
+            token->length = 1;
+            break;
+        default:
+            token->type = TOKEN_INVALID;
+            token->length = 1;
+            break;
+    }
+    t->pos = pos + token->length;
+    return TRUE;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef EXPEVAL_TOKENIZER_H
+#define EXPEVAL_TOKENIZER_H
+
+#include <stddef.h>
+#include "stack.h"
+
+/*
+ * Token types produced by the tokenizer.
+ * Numbers carry their value, punctuation tokens carry the character.
+ * overflow is set for numbers that do not fit in VALUE, their value wraps around.
+ * Invalid token is a character that can not appear in an expression.
+ */
+enum TOKEN_TYPE {
+    TOKEN_NUMBER, TOKEN_PUNCTUATION, TOKEN_INVALID
+};
+
+/*
+ * One token of the expression.
+ * offset is the index of the first character of the token
+ * length is the number of characters of the token
+ */
+typedef struct {
+    enum TOKEN_TYPE type;
+    char c;
+    VALUE value;
+    BOOLEAN overflow;
+    size_t offset;
+    size_t length;
+} TOKEN;
+
+/*
+ * Single pass tokenizer over a pointer and length.
+ * pos is the index of the next character to be read.
+ */
+typedef struct {
+    const char *exp;
+    size_t len;
+    size_t pos;
+} TOKENIZER;
+
+// Character class table indexed by byte, values are enum CHAR_TYPE
+extern const unsigned char CHAR_CLASS[256];
+
+// Function prototypes
+void initTokenizer(TOKENIZER *t, const char *exp, size_t len);
+
+BOOLEAN nextToken(TOKENIZER *t, TOKEN *token);
+
+size_t skipSpaces(const char *p, size_t len);
+
+size_t scanDigits(const char *p, size_t len);
+
+VALUE parseDigits(const char *p, size_t len, BOOLEAN *overflow);
+
+VALUE appendDigits(VALUE value, const char *p, size_t len, BOOLEAN *overflow);
+
+const char *tokenizerBackend(void);
+
+#endif //EXPEVAL_TOKENIZER_H
\ No newline at end of file
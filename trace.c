@@ -0,0 +1,278 @@
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Event ring of one thread.
+ * Only the owner thread writes events, head is published with release order
+ * so rings can be read by another thread without a lock.
+ * head is the number of events ever written, the newest event is at (head - 1) % TRACE_RING_SIZE
+ * thread is the index of the ring in creation order
+ * next links all rings of the process
+ */
+typedef struct TRACE_RING {
+    TRACE_EVENT events[TRACE_RING_SIZE];
+    uint64_t head;
+    uint32_t thread;
+    struct TRACE_RING *next;
+} TRACE_RING;
+
+__thread BOOLEAN traceActive = FALSE;
+
+static __thread TRACE_RING *traceRing = NULL;
+static __thread uint32_t traceSequence = 0;
+
+// All rings of the process, rings are pushed with compare and swap
+static TRACE_RING *traceRings = NULL;
+static uint32_t traceThreadCount = 0;
+
+/**
+ * ringOfThread function
+ * Finds the ring of the calling thread and creates it on first use
+ * @return pointer to ring, NULL if it could not be allocated
+ */
+static TRACE_RING *ringOfThread(void) {
+    TRACE_RING *ring = traceRing;
+
+    if (ring != NULL)
+        return ring;
+    ring = (TRACE_RING *) malloc(sizeof(TRACE_RING));
+    if (ring == NULL)
+        return NULL;
+    ring->head = 0;
+    ring->thread = __sync_fetch_and_add(&traceThreadCount, 1);
+    do {
+        ring->next = traceRings;
+    } while (!__sync_bool_compare_and_swap(&traceRings, ring->next, ring));
+    traceRing = ring;
+    return ring;
+}
+
+
+
+/**
+ * appendEvent function
+ * Writes an event to the ring, the oldest event is overwritten when the ring is full
+ * @param ring is the pointer to ring of the calling thread
+ * @param event is the pointer to event
+ */
+static void appendEvent(TRACE_RING *ring, const TRACE_EVENT *event) {
+    uint64_t head = ring->head;
+    ring->events[head & (TRACE_RING_SIZE - 1)] = *event;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * traceBegin function
+ * Starts the trace of an expression on a verbose evaluator.
+ * At sampled level only one of TRACE_SAMPLE_RATE expressions is recorded,
+ * the first expression of every thread is always recorded.
+ */
+void traceBegin(void) {
+    TRACE_EVENT event = {0};
+    uint32_t sequence = traceSequence++;
+    TRACE_RING *ring;
+
+#if TRACE_LEVEL == TRACE_SAMPLED
+    if ((sequence % TRACE_SAMPLE_RATE) != 0) {
+        traceActive = FALSE;
+        return;
+    }
+#endif
+    ring = ringOfThread();
+    traceActive = (ring != NULL) ? TRUE : FALSE;
+    if (ring == NULL)
+        return;
+    event.kind = TRACE_BEGIN;
+    event.operandTop = (int64_t) sequence;
+    appendEvent(ring, &event);
+}
+
+
+
+/**
+ * traceRecord function
+ * Records the state of the stacks after an evaluation step
+ * @param kind is the kind of the step
+ * @param token is the punctuation character or the operator of the step
+ * @param operand is the pointer to operand stack
+ * @param operator is the pointer to operator stack
+ */
+void traceRecord(enum TRACE_KIND kind, char token, const VALUE_STACK *operand, const CHAR_STACK *operator) {
+    TRACE_EVENT event;
+
+    event.kind = (uint8_t) kind;
+    event.token = token;
+    memset(event.reserved, 0, sizeof(event.reserved));
+    event.operandDepth = (uint32_t) operand->top;
+    event.operatorDepth = (uint32_t) operator->top;
+    event.operandTop = (operand->top > 0) ? operand->item[operand->top - 1] : 0;
+    event.operatorTop = (operator->top > 0) ? operator->item[operator->top - 1] : 0;
+    appendEvent(traceRing, &event);
+}
+
+
+
+/**
+ * copyEvents function
+ * Copies the events kept in a ring to an array, oldest first
+ * @param ring is the pointer to ring
+ * @param events is the array of at least TRACE_RING_SIZE events
+ * @return number of copied events
+ */
+static uint32_t copyEvents(const TRACE_RING *ring, TRACE_EVENT *events) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+    uint64_t i;
+
+    for (i = first; i < head; i++)
+        events[i - first] = ring->events[i & (TRACE_RING_SIZE - 1)];
+    return (uint32_t) (head - first);
+}
+
+
+
+/**
+ * traceWrite function
+ * Writes the events of every thread to a binary trace file
+ * @param out is the output stream
+ * @return TRUE if the trace is written else FALSE
+ */
+BOOLEAN traceWrite(FILE *out) {
+    TRACE_EVENT *events = (TRACE_EVENT *) malloc(TRACE_RING_SIZE * sizeof(TRACE_EVENT));
+    TRACE_HEADER header;
+    const TRACE_RING *ring;
+    BOOLEAN ok = (events != NULL) ? TRUE : FALSE;
+
+    for (ring = traceRings; ok && (ring != NULL); ring = ring->next) {
+        header.magic = TRACE_MAGIC;
+        header.thread = ring->thread;
+        header.count = copyEvents(ring, events);
+        header.reserved = 0;
+        ok = (fwrite(&header, sizeof(header), 1, out) == 1) &&
+             (fwrite(events, sizeof(TRACE_EVENT), header.count, out) == header.count);
+    }
+    free(events);
+    return ok;
+}
+
+
+
+/**
+ * replayEvents function
+ * Rebuilds the stacks from the events and prints them after every token
+ * and every final operation, the same way a verbose evaluation did.
+ * Events before the first begin event belong to an expression that
+ * was partly overwritten in the ring, they are skipped.
+ * @param events is the array of events, oldest first
+ * @param count is the number of events
+ * @param thread is the index of the thread that recorded the events
+ * @param headers prints a line naming every expression when TRUE
+ * @param out is the output stream of the stack dumps
+ */
+static void replayEvents(const TRACE_EVENT *events, uint32_t count, uint32_t thread, BOOLEAN headers,
+                         FILE *out) {
+    VALUE_STACK operand;
+    CHAR_STACK operator;
+    BOOLEAN synced = FALSE;
+    uint32_t i;
+
+    valueStackInitInline(&operand, NULL);
+    charStackInitInline(&operator, NULL);
+    for (i = 0; i < count; i++) {
+        const TRACE_EVENT *event = &events[i];
+        if (event->kind == TRACE_BEGIN) {
+            synced = TRUE;
+            valueStackReset(&operand);
+            charStackReset(&operator);
+            if (headers)
+                fprintf(out, "\nThread %u expression %u\n", thread, (uint32_t) event->operandTop);
+            continue;
+        }
+        if (!synced)
+            continue;
+
+        // Every step pushes at most one value, deeper slots are already known
+        while (operand.top < (int) event->operandDepth)
+            valueStackPush(&operand, event->operandTop);
+        operand.top = (int) event->operandDepth;
+        if (operand.top > 0)
+            operand.item[operand.top - 1] = event->operandTop;
+        while (operator.top < (int) event->operatorDepth)
+            charStackPush(&operator, event->operatorTop);
+        operator.top = (int) event->operatorDepth;
+        if (operator.top > 0)
+            operator.item[operator.top - 1] = event->operatorTop;
+
+        if ((event->kind != TRACE_REDUCE) && (event->kind != TRACE_PUSH))
+            printStackStatus(&operand, &operator, out);
+    }
+    valueStackDelete(&operand);
+    charStackDelete(&operator);
+}
+
+
+
+/**
+ * traceDecode function
+ * Offline decoder, prints the stack dumps of a binary trace file
+ * @param in is the trace file
+ * @param out is the output stream of the stack dumps
+ * @return TRUE if the whole file is decoded else FALSE
+ */
+BOOLEAN traceDecode(FILE *in, FILE *out) {
+    TRACE_EVENT *events = (TRACE_EVENT *) malloc(TRACE_RING_SIZE * sizeof(TRACE_EVENT));
+    TRACE_HEADER header;
+    BOOLEAN ok = (events != NULL) ? TRUE : FALSE;
+
+    while (ok && (fread(&header, sizeof(header), 1, in) == 1)) {
+        ok = (header.magic == TRACE_MAGIC) && (header.count <= TRACE_RING_SIZE) &&
+             (fread(events, sizeof(TRACE_EVENT), header.count, in) == header.count);
+        if (ok)
+            replayEvents(events, header.count, header.thread, TRUE, out);
+    }
+    free(events);
+    return ok;
+}
+
+
+
+/**
+ * traceDecodeThread function
+ * Prints the stack dumps recorded by the calling thread
+ * @param out is the output stream of the stack dumps
+ */
+void traceDecodeThread(FILE *out) {
+    TRACE_EVENT *events;
+
+    if (traceRing == NULL)
+        return;
+    events = (TRACE_EVENT *) malloc(TRACE_RING_SIZE * sizeof(TRACE_EVENT));
+    if (events == NULL)
+        return;
+    replayEvents(events, copyEvents(traceRing, events), traceRing->thread, FALSE, out);
+    free(events);
+}
+
+
+
+/**
+ * traceShutdown function
+ * Frees the rings of every thread.
+ * Must be called after all traced threads are finished.
+ */
+void traceShutdown(void) {
+    TRACE_RING *ring = traceRings;
+    TRACE_RING *next;
+
+    while (ring != NULL) {
+        next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    traceRings = NULL;
+    traceRing = NULL;
+    traceActive = FALSE;
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef EXPEVAL_TRACE_H
+#define EXPEVAL_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "stack.h"
+
+/*
+ * Trace levels, selected at compile time with TRACE_LEVEL.
+ * TRACE_OFF removes every trace point from the evaluator
+ * TRACE_SAMPLED records one of TRACE_SAMPLE_RATE expressions
+ * TRACE_FULL records every expression of a verbose evaluator
+ */
+#define TRACE_OFF 0
+#define TRACE_SAMPLED 1
+#define TRACE_FULL 2
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_FULL
+#endif
+
+#ifndef TRACE_SAMPLE_RATE
+#define TRACE_SAMPLE_RATE 1024
+#endif
+
+// Number of events every thread keeps, must be a power of two
+#define TRACE_RING_SIZE 4096
+// First word of every ring in a trace file, "EXTR"
+#define TRACE_MAGIC 0x52545845u
+
+/*
+ * Kinds of trace events.
+ * Begin starts an expression, number and punctuation follow a token,
+ * reduce follows an operation done while a token is handled,
+ * finish follows an operation done after the last token and
+ * push follows an operator pushed before the one of the token, like the unary minus of -(.
+ */
+enum TRACE_KIND {
+    TRACE_BEGIN, TRACE_NUMBER, TRACE_PUNCTUATION, TRACE_REDUCE, TRACE_FINISH, TRACE_PUSH
+};
+
+/*
+ * Fixed size binary trace event.
+ * Stacks are described by their depths and top values after the step,
+ * the decoder rebuilds their contents by replaying the events.
+ * token is the punctuation character or the reduced operator
+ * operandTop is the sequence number of the expression in begin events
+ */
+typedef struct {
+    int64_t operandTop;
+    uint32_t operandDepth;
+    uint32_t operatorDepth;
+    uint8_t kind;
+    char token;
+    char operatorTop;
+    uint8_t reserved[5];
+} TRACE_EVENT;
+
+/*
+ * Header of one thread's events in a trace file.
+ * count events follow the header, oldest first.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t thread;
+    uint32_t count;
+    uint32_t reserved;
+} TRACE_HEADER;
+
+// TRUE while the current expression of this thread is recorded
+extern __thread BOOLEAN traceActive;
+
+#if TRACE_LEVEL == TRACE_OFF
+#define TRACE_BEGIN(e) ((void) 0)
+#define TRACE_STEP(kind, token, e) ((void) 0)
+#else
+#define TRACE_BEGIN(e)                                                          \
+    do {                                                                        \
+        if (UNLIKELY((e)->verbose))                                             \
+            traceBegin();                                                       \
+        else                                                                    \
+            traceActive = FALSE;                                                \
+    } while (0)
+#define TRACE_STEP(kind, token, e)                                              \
+    do {                                                                        \
+        if (UNLIKELY(traceActive))                                              \
+            traceRecord(kind, token, &(e)->operand, &(e)->operator);            \
+    } while (0)
+#endif
+
+// Function prototypes
+void traceBegin(void);
+
+void traceRecord(enum TRACE_KIND kind, char token, const VALUE_STACK *operand, const CHAR_STACK *operator);
+
+BOOLEAN traceWrite(FILE *out);
+
+BOOLEAN traceDecode(FILE *in, FILE *out);
+
+void traceDecodeThread(FILE *out);
+
+void traceShutdown(void);
+
+#endif //EXPEVAL_TRACE_H
\ No newline at end of file